@@ -6,8 +6,14 @@ RESULTS_DIR="$ROOT/results"
 CSV="$RESULTS_DIR/results_all.csv"
 mkdir -p "$RESULTS_DIR"
 
+CSV_HEADER="backend,queueName,duration,messageSize,maxMessages,producers,consumers,nonBlocking,randomPayload,latencySample,elapsedSec,recv,bytesRecv,msgPerSec,MiBps,p50us,p90us,p95us,p99us,p999us,p9999us,maxus,extra"
 if [[ ! -f "$CSV" ]]; then
-  echo "backend,queueName,duration,messageSize,maxMessages,producers,consumers,nonBlocking,randomPayload,latencySample,elapsedSec,recv,bytesRecv,msgPerSec,MiBps,p50us,p90us,p95us,p99us,p999us" > "$CSV"
+  echo "$CSV_HEADER" > "$CSV"
+elif [[ "$(head -n 1 "$CSV")" != "$CSV_HEADER" ]]; then
+  # Appending would mix column layouts (the 20-column rows of an older build
+  # are kept in results/results_v1.csv); start a new file instead.
+  echo "$CSV has a different header from this build's rows; move it aside to start a new one." >&2
+  exit 1
 fi
 
 OS="$(uname -s)"
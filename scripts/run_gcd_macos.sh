@@ -9,6 +9,7 @@ fi
 ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
 RESULTS_DIR="$ROOT/results"
 CSV="$RESULTS_DIR/results_all.csv"
+RESULTS="${RESULTS:-$RESULTS_DIR/results_all.mqr}"
 mkdir -p "$RESULTS_DIR"
 
 echo "Building GCD and NSOperation benchmarks..."
@@ -17,17 +18,29 @@ make -C "$ROOT" all
 GCD_BIN="$ROOT/build/gcd_benchmark"
 NSOP_BIN="$ROOT/build/nsop_benchmark"
 
+CSV_HEADER="backend,queueName,duration,messageSize,maxMessages,producers,consumers,nonBlocking,randomPayload,latencySample,elapsedSec,recv,bytesRecv,msgPerSec,MiBps,p50us,p90us,p95us,p99us,p999us,p9999us,maxus,extra"
 if [[ ! -f "$CSV" ]]; then
-  echo "backend,queueName,duration,messageSize,maxMessages,producers,consumers,nonBlocking,randomPayload,latencySample,elapsedSec,recv,bytesRecv,msgPerSec,MiBps,p50us,p90us,p95us,p99us,p999us" > "$CSV"
+  echo "$CSV_HEADER" > "$CSV"
+elif [[ "$(head -n 1 "$CSV")" != "$CSV_HEADER" ]]; then
+  # Appending would mix column layouts (the 20-column rows of an older build
+  # are kept in results/results_v1.csv); start a new file instead.
+  echo "$CSV has a different header from this build's rows; move it aside to start a new one." >&2
+  exit 1
 fi
 
 DURATION="${DURATION:-3}"
-LAT_SAMPLE="${LAT_SAMPLE:-50000}"
+LAT_SAMPLE="${LAT_SAMPLE:-1}"
 RANDPAY="${RANDPAY:-false}"
 MSG_SIZES="${MSG_SIZES:-64 256 1024 4096 8192}"
 THREADS_P="${THREADS_P:-1 2 4}"
 THREADS_C="${THREADS_C:-1 2 4}"
 INFLIGHT="${INFLIGHT:-1024}"
+RATE="${RATE:-0}"
+WORK="${WORK:-none}"
+ZERO_COPY="${ZERO_COPY:-false}"
+NSOP_BATCH="${NSOP_BATCH:-1}"
+NSOP_PACK="${NSOP_PACK:-1}"
+NSOP_REUSE="${NSOP_REUSE:-false}"
 
 echo "Running GCD matrix..."
 for ms in $MSG_SIZES; do
@@ -41,9 +54,13 @@ for ms in $MSG_SIZES; do
         --producers "$p" \
         --consumers "$c" \
         --random-payload "$RANDPAY" \
+        --rate "$RATE" \
+        --work "$WORK" \
+        --zero-copy "$ZERO_COPY" \
         --latency-sample "$LAT_SAMPLE" \
         --print-interval 1 \
-        --csv "$CSV"
+        --csv "$CSV" \
+        --results "$RESULTS"
       echo
     done
   done
@@ -61,14 +78,20 @@ for ms in $MSG_SIZES; do
         --producers "$p" \
         --consumers "$c" \
         --random-payload "$RANDPAY" \
+        --rate "$RATE" \
+        --work "$WORK" \
+        --batch "$NSOP_BATCH" \
+        --pack "$NSOP_PACK" \
+        --reuse "$NSOP_REUSE" \
         --latency-sample "$LAT_SAMPLE" \
         --print-interval 1 \
-        --csv "$CSV"
+        --csv "$CSV" \
+        --results "$RESULTS"
       echo
     done
   done
 done
 
-echo "Done. Results at $CSV"
+echo "Done. Results at $CSV and $RESULTS (build/mq_report readme $RESULTS)"
 
 
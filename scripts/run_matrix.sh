@@ -3,25 +3,60 @@ set -euo pipefail
 
 ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
 BIN="$ROOT/build/mq_benchmark"
+SHM_BIN="$ROOT/build/shm_benchmark"
+URING_BIN="$ROOT/build/uring_benchmark"
+STEAL_BIN="$ROOT/build/steal_benchmark"
 RESULTS_DIR="$ROOT/results"
 CSV="$RESULTS_DIR/results_all.csv"
+RESULTS="${RESULTS:-$RESULTS_DIR/results_all.mqr}"
 
 mkdir -p "$RESULTS_DIR"
 
-if [[ ! -x "$BIN" ]]; then
+if [[ ! -x "$BIN" || ! -x "$SHM_BIN" || ! -x "$URING_BIN" || ! -x "$STEAL_BIN" ]]; then
   echo "Building benchmark..."
   make -C "$ROOT" all
 fi
 
+CSV_HEADER="backend,queueName,duration,messageSize,maxMessages,producers,consumers,nonBlocking,randomPayload,latencySample,elapsedSec,recv,bytesRecv,msgPerSec,MiBps,p50us,p90us,p95us,p99us,p999us,p9999us,maxus,extra"
 if [[ ! -f "$CSV" ]]; then
-  echo "backend,queueName,duration,messageSize,maxMessages,producers,consumers,nonBlocking,randomPayload,latencySample,elapsedSec,recv,bytesRecv,msgPerSec,MiBps,p50us,p90us,p95us,p99us,p999us" > "$CSV"
+  echo "$CSV_HEADER" > "$CSV"
+elif [[ "$(head -n 1 "$CSV")" != "$CSV_HEADER" ]]; then
+  # Appending would mix column layouts (the 20-column rows of an older build
+  # are kept in results/results_v1.csv); start a new file instead.
+  echo "$CSV has a different header from this build's rows; move it aside to start a new one." >&2
+  exit 1
 fi
 
 DURATION="${DURATION:-3}"
 MAXMSGS="${MAXMSGS:-10}"
-LAT_SAMPLE="${LAT_SAMPLE:-50000}"
+LAT_SAMPLE="${LAT_SAMPLE:-1}"
 NONBLOCK="${NONBLOCK:-false}"
 RANDPAY="${RANDPAY:-false}"
+PROCESS_MODE="${PROCESS_MODE:-false}"
+BATCH="${BATCH:-1}"
+CONSUMER_WAIT="${CONSUMER_WAIT:-timed}"
+BACKOFF="${BACKOFF:-sleep}"
+RATE="${RATE:-0}"
+WORK="${WORK:-none}"
+RUN_SHM="${RUN_SHM:-true}"
+RUN_URING="${RUN_URING:-false}"
+URING_CARRIER="${URING_CARRIER:-pipe}"
+URING_BATCH="${URING_BATCH:-32}"
+RUN_STEAL="${RUN_STEAL:-false}"
+STEAL_MAX_INFLIGHT="${STEAL_MAX_INFLIGHT:-1024}"
+PLACEMENTS="${PLACEMENTS:-none}"
+PRIORITY_MIX="${PRIORITY_MIX:-}"
+SIZE_DIST="${SIZE_DIST:-fixed}"
+WARMUP="${WARMUP:-0}"
+PERF="${PERF:-false}"
+INTERVAL_CSV="${INTERVAL_CSV:-$RESULTS_DIR/intervals.csv}"
+MQ_SWEEP="${MQ_SWEEP:-false}"
+SWEEP_TOLERANCE="${SWEEP_TOLERANCE:-2}"
+REPEAT="${REPEAT:-1}"
+QUEUES="${QUEUES:-1}"
+ROUTING="${ROUTING:-round-robin}"
+PING_PONG="${PING_PONG:-0}"
+BASELINE="${BASELINE:-}"
 
 MSG_SIZES="${MSG_SIZES:-64 256 1024 4096 8192}"
 THREADS_P="${THREADS_P:-1 2 4}"
@@ -32,32 +67,144 @@ echo "  duration:    $DURATION s"
 echo "  msg sizes:   $MSG_SIZES"
 echo "  producers:   $THREADS_P"
 echo "  consumers:   $THREADS_C"
-echo "  nonblocking: $NONBLOCK  random-payload: $RANDPAY"
+echo "  placements:  $PLACEMENTS"
+echo "  nonblocking: $NONBLOCK  random-payload: $RANDPAY  process-mode: $PROCESS_MODE"
 echo
 
+# MQ_SWEEP=true: one in-process mq_benchmark --sweep covers the whole mqueue
+# matrix (DURATION caps each point); the loop below then only runs shm.
+if [[ "$MQ_SWEEP" == "true" ]]; then
+  echo "==> mqueue sweep"
+  "$BIN" \
+    --queue-name "/mq_bench" \
+    --sweep true \
+    --sweep-sizes "$(echo $MSG_SIZES | tr ' ' ',')" \
+    --sweep-producers "$(echo $THREADS_P | tr ' ' ',')" \
+    --sweep-consumers "$(echo $THREADS_C | tr ' ' ',')" \
+    --sweep-tolerance "$SWEEP_TOLERANCE" \
+    --repeat "$REPEAT" \
+    ${BASELINE:+--compare "$BASELINE"} \
+    --duration-seconds "$DURATION" \
+    --max-messages "$MAXMSGS" \
+    --nonblocking "$NONBLOCK" \
+    --random-payload "$RANDPAY" \
+    --rate "$RATE" \
+    --work "$WORK" \
+    --batch "$BATCH" \
+    --consumer-wait "$CONSUMER_WAIT" \
+    --backoff "$BACKOFF" \
+    --latency-sample "$LAT_SAMPLE" \
+    --csv "$CSV" \
+    --results "$RESULTS" \
+    --unlink-start true \
+    --unlink-end true
+  echo
+fi
+
 for ms in $MSG_SIZES; do
   for p in $THREADS_P; do
     for c in $THREADS_C; do
-      echo "==> size=$ms producers=$p consumers=$c"
-      "$BIN" \
-        --queue-name "/mq_bench" \
-        --duration-seconds "$DURATION" \
-        --message-size "$ms" \
-        --max-messages "$MAXMSGS" \
-        --producers "$p" \
-        --consumers "$c" \
-        --nonblocking "$NONBLOCK" \
-        --random-payload "$RANDPAY" \
-        --latency-sample "$LAT_SAMPLE" \
-        --csv "$CSV" \
-        --unlink-start true \
-        --unlink-end true \
-        --print-interval 1
-      echo
+      for pl in $PLACEMENTS; do
+        if [[ "$MQ_SWEEP" != "true" ]]; then
+          echo "==> size=$ms producers=$p consumers=$c placement=$pl"
+          "$BIN" \
+            --queue-name "/mq_bench" \
+            --queues "$QUEUES" \
+            --routing "$ROUTING" \
+            --ping-pong "$PING_PONG" \
+            --duration-seconds "$DURATION" \
+            --message-size "$ms" \
+            --max-messages "$MAXMSGS" \
+            --producers "$p" \
+            --consumers "$c" \
+            --nonblocking "$NONBLOCK" \
+            --random-payload "$RANDPAY" \
+            --rate "$RATE" \
+            --work "$WORK" \
+            --process-mode "$PROCESS_MODE" \
+            --batch "$BATCH" \
+            --consumer-wait "$CONSUMER_WAIT" \
+            --backoff "$BACKOFF" \
+            --placement "$pl" \
+            ${PRIORITY_MIX:+--priority-mix "$PRIORITY_MIX"} \
+            --size-dist "$SIZE_DIST" \
+            --warmup-seconds "$WARMUP" \
+            --perf "$PERF" \
+            --repeat "$REPEAT" \
+            ${BASELINE:+--compare "$BASELINE"} \
+            --interval-csv "$INTERVAL_CSV" \
+            --latency-sample "$LAT_SAMPLE" \
+            --csv "$CSV" \
+            --results "$RESULTS" \
+            --unlink-start true \
+            --unlink-end true \
+            --print-interval 1
+          echo
+        fi
+        if [[ "$RUN_SHM" == "true" ]]; then
+          echo "==> shm size=$ms producers=$p consumers=$c placement=$pl"
+          "$SHM_BIN" \
+            --queue-name "/shm_bench" \
+            --duration-seconds "$DURATION" \
+            --message-size "$ms" \
+            --max-messages "$MAXMSGS" \
+            --producers "$p" \
+            --consumers "$c" \
+            --nonblocking "$NONBLOCK" \
+            --random-payload "$RANDPAY" \
+            --rate "$RATE" \
+            --work "$WORK" \
+            --placement "$pl" \
+            --latency-sample "$LAT_SAMPLE" \
+            --csv "$CSV" \
+            --results "$RESULTS" \
+            --unlink-start true \
+            --unlink-end true \
+            --print-interval 1
+          echo
+        fi
+        if [[ "$RUN_URING" == "true" ]]; then
+          echo "==> io_uring carrier=$URING_CARRIER size=$ms producers=$p consumers=$c"
+          "$URING_BIN" \
+            --carrier "$URING_CARRIER" \
+            --queue-name "/uring_bench" \
+            --duration-seconds "$DURATION" \
+            --message-size "$ms" \
+            --max-messages "$MAXMSGS" \
+            --producers "$p" \
+            --consumers "$c" \
+            --batch "$URING_BATCH" \
+            --random-payload "$RANDPAY" \
+            --rate "$RATE" \
+            --work "$WORK" \
+            --latency-sample "$LAT_SAMPLE" \
+            --csv "$CSV" \
+            --results "$RESULTS" \
+            --print-interval 1
+          echo
+        fi
+        if [[ "$RUN_STEAL" == "true" ]]; then
+          echo "==> work-stealing max-inflight=$STEAL_MAX_INFLIGHT size=$ms producers=$p consumers=$c"
+          "$STEAL_BIN" \
+            --duration-seconds "$DURATION" \
+            --message-size "$ms" \
+            --max-inflight "$STEAL_MAX_INFLIGHT" \
+            --producers "$p" \
+            --consumers "$c" \
+            --random-payload "$RANDPAY" \
+            --rate "$RATE" \
+            --work "$WORK" \
+            --latency-sample "$LAT_SAMPLE" \
+            --csv "$CSV" \
+            --results "$RESULTS" \
+            --print-interval 1
+          echo
+        fi
+      done
     done
   done
 done
 
-echo "Done. Results at $CSV"
+echo "Done. Results at $CSV and $RESULTS (build/mq_report readme $RESULTS)"
 
 
@@ -0,0 +1,942 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <csignal>
+#include <new>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "result_file.h"
+
+// Measurement core shared by every backend: clock and pacing, the message
+// header, latency histograms and percentiles, the common options, the summary
+// lines every backend prints and the results CSV row. Keeping them in one place
+// is what makes numbers from different backends comparable; backends only add
+// their own transport, worker loops and mode-specific reporting.
+
+inline std::atomic<bool> stopFlag{false};
+
+inline uint64_t monotonicNs() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// Timestamp source behind nowNs(). Reading the CPU counter directly (rdtsc on
+// x86, cntvct_el0 on ARMv8) costs a few ns against ~20 ns for a vDSO
+// clock_gettime, which adds up at two or three stamps per small message. Ticks
+// are converted with a factor calibrated against CLOCK_MONOTONIC by
+// setupClock(), so headers, Pacer deadlines and histograms stay in ns and
+// samples taken on different cores or in forked children stay comparable. The
+// x86 TSC is only used when it is invariant (constant_tsc and nonstop_tsc);
+// otherwise cores may drift apart or stop counting in deep idle states.
+struct TickClock {
+	const char* source = "clock_gettime";
+	bool ticks = false;
+	double nsPerTick = 1.0;
+	uint64_t baseTicks = 0;
+	uint64_t baseNs = 0;
+	double readNs = 0.0;          // cost of one nowNs(), measured by setupClock()
+	double clockGettimeNs = 0.0; // cost of one clock_gettime(CLOCK_MONOTONIC)
+};
+
+inline TickClock tickClock;
+
+inline uint64_t readTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#elif defined(__aarch64__)
+	uint64_t v;
+	asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+	return v;
+#else
+	return monotonicNs();
+#endif
+}
+
+inline bool hasInvariantTicks() {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__linux__)
+	std::ifstream in("/proc/cpuinfo");
+	std::string line;
+	while (std::getline(in, line)) {
+		if (line.compare(0, 5, "flags") != 0) continue;
+		std::istringstream flags(line.substr(line.find(':') + 1));
+		bool constant = false, nonstop = false;
+		std::string flag;
+		while (flags >> flag) {
+			constant = constant || flag == "constant_tsc";
+			nonstop = nonstop || flag == "nonstop_tsc";
+		}
+		return constant && nonstop;
+	}
+	return false;
+#elif defined(__aarch64__)
+	return true;
+#else
+	return false;
+#endif
+}
+
+// A core whose counter reads slightly below the calibration base (small
+// cross-core skew) would wrap the unsigned difference; it is clamped to baseNs.
+inline uint64_t nowNs() {
+	if (!tickClock.ticks) return monotonicNs();
+	const int64_t delta = static_cast<int64_t>(readTicks() - tickClock.baseTicks);
+	if (delta <= 0) return tickClock.baseNs;
+	return tickClock.baseNs + static_cast<uint64_t>(static_cast<double>(delta) * tickClock.nsPerTick);
+}
+
+// Picks the nowNs() source for --clock (auto, tsc or monotonic), calibrates it
+// and measures the cost of a read, which every latency sample includes once.
+// Call from main before any thread or child process starts; returns false for
+// an unknown mode.
+inline bool setupClock(const std::string& mode) {
+	if (mode != "auto" && mode != "tsc" && mode != "monotonic") return false;
+	bool useTicks = mode != "monotonic" && hasInvariantTicks();
+	if (mode == "tsc" && !useTicks) std::cerr << "Note: no invariant TSC/cntvct on this CPU; using clock_gettime\n";
+	if (useTicks) {
+		// Pair a tick read with the midpoint of the tightest of a few
+		// clock_gettime brackets, at both ends of a 20 ms interval.
+		auto sample = [](uint64_t& ns, uint64_t& ticks) {
+			uint64_t best = UINT64_MAX;
+			for (int i = 0; i < 16; ++i) {
+				uint64_t before = monotonicNs();
+				uint64_t t = readTicks();
+				uint64_t after = monotonicNs();
+				if (after - before < best) {
+					best = after - before;
+					ns = before + best / 2;
+					ticks = t;
+				}
+			}
+		};
+		uint64_t ns0 = 0, ticks0 = 0, ns1 = 0, ticks1 = 0;
+		sample(ns0, ticks0);
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		sample(ns1, ticks1);
+		if (ticks1 > ticks0 && ns1 > ns0) {
+			tickClock.nsPerTick = static_cast<double>(ns1 - ns0) / static_cast<double>(ticks1 - ticks0);
+			tickClock.baseTicks = ticks1;
+			tickClock.baseNs = ns1;
+			tickClock.ticks = true;
+#if defined(__x86_64__) || defined(__i386__)
+			tickClock.source = "tsc";
+#else
+			tickClock.source = "cntvct";
+#endif
+		}
+	}
+
+	constexpr int kReads = 200000;
+	auto cost = [](uint64_t (*read)()) {
+		volatile uint64_t sink = 0;
+		uint64_t start = monotonicNs();
+		for (int i = 0; i < kReads; ++i) sink = read();
+		(void)sink;
+		return static_cast<double>(monotonicNs() - start) / kReads;
+	};
+	tickClock.readNs = cost(nowNs);
+	tickClock.clockGettimeNs = cost(monotonicNs);
+	return true;
+}
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+struct MsgHeader {
+	uint64_t sequence;
+	uint64_t sendTimeNs;
+	uint64_t intendedTimeNs; // == sendTimeNs unless --rate paces the producer
+	uint32_t producerId;
+	uint32_t checksum; // CRC32C of the record with this field skipped; --verify only
+};
+
+// Open-loop pacing for --rate. Producer i of n sends on a fixed schedule
+// (period n/rate, offset i/rate) no matter how long earlier sends took, and
+// stamps each message with its intended send time. A stall therefore shows up
+// as latency on every message that should have gone out during it, instead of
+// silently thinning the samples (coordinated omission).
+struct Pacer {
+	double periodNs = 0.0;
+	double nextNs = 0.0;
+
+	Pacer(double totalRate, int producers, int producerId) {
+		if (totalRate <= 0.0) return;
+		periodNs = 1e9 * producers / totalRate;
+		nextNs = static_cast<double>(nowNs()) + periodNs * producerId / producers;
+	}
+
+	bool enabled() const { return periodNs > 0.0; }
+
+	uint64_t next() {
+		uint64_t t = static_cast<uint64_t>(nextNs);
+		nextNs += periodNs;
+		return t;
+	}
+
+	// Sleeps while far from the deadline, then spins the last 100 us.
+	static void waitUntil(uint64_t targetNs) {
+		while (!stopFlag.load(std::memory_order_relaxed)) {
+			uint64_t now = nowNs();
+			if (now >= targetNs) return;
+			uint64_t remaining = targetNs - now;
+			if (remaining > 200000) {
+				std::this_thread::sleep_for(std::chrono::nanoseconds(std::min<uint64_t>(remaining - 100000, 10000000)));
+			} else {
+				cpuRelax();
+			}
+		}
+	}
+};
+
+// Log-linear latency histogram (HDR-style). Values below 2^kSubBits ns get an
+// exact bucket; each power-of-two range above that is split into 2^kSubBits
+// linear sub-buckets, which bounds the relative error to 2^-kSubBits (~0.8%).
+// The layout is fixed-size and written by a single thread, so record() takes
+// no lock and never allocates; per-thread histograms are merged after the run.
+// As with the per-thread counters, the owner publishes each field with a
+// relaxed store (no locked RMW), so a reader that copies a histogram while it
+// is still being recorded into (mq_benchmark's interval and warmup deltas)
+// uses loadFrom() instead of a plain copy. The fields stay plain uint64_t so
+// histograms remain copyable and can live in shared memory.
+struct LatencyHistogram {
+	static constexpr int kSubBits = 7;
+	static constexpr size_t kSubCount = size_t(1) << kSubBits;
+	static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSubCount;
+
+	uint64_t counts[kBuckets] = {};
+	uint64_t total = 0;
+	uint64_t maxNs = 0;
+
+	static size_t bucketFor(uint64_t valueNs) {
+		if (valueNs < kSubCount) return static_cast<size_t>(valueNs);
+		int shift = (63 - __builtin_clzll(valueNs)) - kSubBits;
+		return (static_cast<size_t>(shift) + 1) * kSubCount + static_cast<size_t>((valueNs >> shift) - kSubCount);
+	}
+
+	// Midpoint of the value range covered by a bucket.
+	static uint64_t bucketValue(size_t index) {
+		if (index < kSubCount) return index;
+		int shift = static_cast<int>(index / kSubCount) - 1;
+		uint64_t lower = static_cast<uint64_t>(kSubCount + index % kSubCount) << shift;
+		return lower + ((uint64_t(1) << shift) >> 1);
+	}
+
+	void record(uint64_t valueNs) {
+		size_t bucket = bucketFor(valueNs);
+		__atomic_store_n(&counts[bucket], counts[bucket] + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&total, total + 1, __ATOMIC_RELAXED);
+		if (valueNs > maxNs) __atomic_store_n(&maxNs, valueNs, __ATOMIC_RELAXED);
+	}
+
+	// Copies live, which its owner may still be recording into. The fields
+	// are read one by one, so total is re-derived from the buckets, and a max
+	// that lags behind the highest non-empty bucket is raised to that bucket.
+	void loadFrom(const LatencyHistogram& live) {
+		total = 0;
+		size_t top = 0;
+		for (size_t i = 0; i < kBuckets; ++i) {
+			counts[i] = __atomic_load_n(&live.counts[i], __ATOMIC_RELAXED);
+			total += counts[i];
+			if (counts[i]) top = i;
+		}
+		maxNs = __atomic_load_n(&live.maxNs, __ATOMIC_RELAXED);
+		if (total && bucketFor(maxNs) < top) maxNs = bucketValue(top);
+	}
+
+	void merge(const LatencyHistogram& other) {
+		for (size_t i = 0; i < kBuckets; ++i) counts[i] += other.counts[i];
+		total += other.total;
+		maxNs = std::max(maxNs, other.maxNs);
+	}
+
+	// Removes the samples of base, an earlier copy of this histogram. The max is
+	// re-derived from the highest non-empty bucket, so it is bucket-accurate.
+	void subtract(const LatencyHistogram& base) {
+		uint64_t oldMax = maxNs;
+		total = 0;
+		maxNs = 0;
+		for (size_t i = 0; i < kBuckets; ++i) {
+			counts[i] -= base.counts[i];
+			total += counts[i];
+			if (counts[i]) maxNs = std::min(bucketValue(i), oldMax);
+		}
+	}
+};
+
+// Appends {quantile, us} for p50..p99.99, followed by {1.0, max}.
+inline void computePercentiles(const LatencyHistogram& hist, std::vector<std::pair<double, double>>& outPctToUs) {
+	if (hist.total == 0) return;
+	const double pcts[] = {0.5, 0.90, 0.95, 0.99, 0.999, 0.9999};
+	size_t bucket = 0;
+	uint64_t cumulative = 0;
+	for (double p : pcts) {
+		uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * static_cast<double>(hist.total))));
+		while (cumulative + hist.counts[bucket] < rank) cumulative += hist.counts[bucket++];
+		uint64_t vNs = std::min(LatencyHistogram::bucketValue(bucket), hist.maxNs);
+		outPctToUs.push_back({p, vNs / 1000.0});
+	}
+	outPctToUs.push_back({1.0, hist.maxNs / 1000.0});
+}
+
+// Counters owned by one producer or consumer, padded to a cache line so no two
+// threads ever write the same line. Only the owner writes (plain load+store,
+// no locked RMW); main reads them with relaxed loads while the run progresses.
+// Backends that count more derive from it and add their own fields.
+struct alignas(64) ThreadCounters {
+	std::atomic<uint64_t> messages{0};
+	std::atomic<uint64_t> bytes{0};
+	std::atomic<uint64_t> errors{0};
+	std::atomic<uint64_t> eagain{0};
+	std::atomic<uint64_t> workNs{0}; // consumers: time spent in the --work kernel
+
+	static void bump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+		counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+};
+
+// Sum of all producer and consumer slots at one point in time.
+struct Stats {
+	uint64_t sentMessages = 0;
+	uint64_t sentBytes = 0;
+	uint64_t recvMessages = 0;
+	uint64_t recvBytes = 0;
+	uint64_t sendErrors = 0;
+	uint64_t recvErrors = 0;
+	uint64_t sendEagain = 0;
+	uint64_t recvEagain = 0;
+	uint64_t workNs = 0;
+};
+
+// Adds the ThreadCounters fields of every slot to s. Counters is the slot type
+// (ThreadCounters or a backend's derived one), so the arrays are walked with
+// their real stride.
+template <typename Counters>
+inline void addCounters(Stats& s, const Counters* producerSlots, int producers, const Counters* consumerSlots, int consumers) {
+	for (int i = 0; i < producers; ++i) {
+		s.sentMessages += producerSlots[i].messages.load(std::memory_order_relaxed);
+		s.sentBytes += producerSlots[i].bytes.load(std::memory_order_relaxed);
+		s.sendErrors += producerSlots[i].errors.load(std::memory_order_relaxed);
+		s.sendEagain += producerSlots[i].eagain.load(std::memory_order_relaxed);
+	}
+	for (int i = 0; i < consumers; ++i) {
+		s.recvMessages += consumerSlots[i].messages.load(std::memory_order_relaxed);
+		s.recvBytes += consumerSlots[i].bytes.load(std::memory_order_relaxed);
+		s.recvErrors += consumerSlots[i].errors.load(std::memory_order_relaxed);
+		s.recvEagain += consumerSlots[i].eagain.load(std::memory_order_relaxed);
+		s.workNs += consumerSlots[i].workNs.load(std::memory_order_relaxed);
+	}
+}
+
+template <typename Counters>
+inline Stats sumCounters(const Counters* producerSlots, int producers, const Counters* consumerSlots, int consumers) {
+	Stats s;
+	addCounters(s, producerSlots, producers, consumerSlots, consumers);
+	return s;
+}
+
+// Shared anonymous mapping used by --process-mode. The header is followed by
+// the producer counter slots, the consumer counter slots, `histograms` latency
+// histograms and extraBytes of backend-specific state; forked children update
+// their own slots in place. create() constructs the slots and histograms, the
+// backend constructs whatever it keeps in extra().
+template <typename Counters>
+struct alignas(64) SharedBlock {
+	int producers = 0;
+	int consumers = 0;
+	int histograms = 0;
+	size_t extraBytes = 0;
+
+	Counters* producerSlots() {
+		return reinterpret_cast<Counters*>(this + 1);
+	}
+
+	Counters* consumerSlots() {
+		return producerSlots() + producers;
+	}
+
+	LatencyHistogram* histogram(int index) {
+		return reinterpret_cast<LatencyHistogram*>(consumerSlots() + consumers) + index;
+	}
+
+	void* extra() {
+		return histogram(histograms);
+	}
+
+	size_t bytes() const {
+		return sizeof(SharedBlock) + static_cast<size_t>(producers + consumers) * sizeof(Counters) +
+		       static_cast<size_t>(histograms) * sizeof(LatencyHistogram) + extraBytes;
+	}
+
+	// Returns nullptr (errno set by mmap) when the mapping fails.
+	static SharedBlock* create(int producers, int consumers, int histograms, size_t extraBytes = 0) {
+		SharedBlock layout;
+		layout.producers = producers;
+		layout.consumers = consumers;
+		layout.histograms = histograms;
+		layout.extraBytes = extraBytes;
+		void* mem = mmap(nullptr, layout.bytes(), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (mem == MAP_FAILED) return nullptr;
+		SharedBlock* block = new (mem) SharedBlock(layout);
+		for (int i = 0; i < producers + consumers; ++i) new (block->producerSlots() + i) Counters();
+		for (int i = 0; i < histograms; ++i) new (block->histogram(i)) LatencyHistogram();
+		return block;
+	}
+
+	// Destroys the slots and histograms and unmaps the block; anything in
+	// extra() must be trivially destructible or destroyed by the backend first.
+	void destroy() {
+		const size_t length = bytes();
+		for (int i = 0; i < histograms; ++i) histogram(i)->~LatencyHistogram();
+		for (int i = 0; i < producers + consumers; ++i) producerSlots()[i].~Counters();
+		this->~SharedBlock();
+		munmap(this, length);
+	}
+};
+
+// Forks a --process-mode worker. The child runs body(), which sets up its own
+// descriptors or mappings (the parent's are not shared) and returns the exit
+// status. stopFlag is per-process, so the parent stops children with
+// stopWorkers().
+template <typename Body>
+inline pid_t spawnWorker(Body body) {
+	pid_t pid = fork();
+	if (pid != 0) return pid;
+	_exit(body());
+}
+
+// Sends SIGTERM to every child and reaps it, noting any that did not exit 0.
+inline void stopWorkers(const std::vector<pid_t>& children) {
+	for (pid_t pid : children) kill(pid, SIGTERM);
+	for (pid_t pid : children) {
+		int status = 0;
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			std::cerr << "Note: worker process " << pid << " exited abnormally (status " << status << ")\n";
+		}
+	}
+}
+
+// Point-to-point message transport as a producer or consumer loop sees it.
+// send/recv move one message (which may pack several records, see batch) and
+// wait at most timeoutNs for space or data; 0 means do not wait. They return
+// 0 / the received length, or -1 with errno EAGAIN or ETIMEDOUT when the
+// transport stayed full / empty and any other errno on a real error.
+// Implementations are final and the loops hold the concrete type, so the
+// calls are devirtualized on the hot path.
+class Transport {
+public:
+	virtual ~Transport() = default;
+	virtual int send(const uint8_t* data, size_t len, unsigned prio, uint64_t timeoutNs) = 0;
+	virtual ssize_t recv(uint8_t* buf, size_t cap, unsigned* prio, uint64_t timeoutNs) = 0;
+	// Records of recordSize bytes that fit into one message.
+	virtual size_t batch(size_t recordSize) const = 0;
+};
+
+// Consumer-side work per message for --work, standing in for the parsing and
+// hashing a real service does: memcpy:N copies the payload N times into a
+// per-consumer sink, hash:N runs FNV-1a over it N times, spin:NS busy-waits NS
+// ns per record. The time spent is measured around each call and reported as
+// the per-message service time next to throughput, so runs with increasing
+// cost trace throughput against service time for fitting queueing models.
+struct WorkKernel {
+	enum class Kind { None, Memcpy, Hash, Spin };
+	Kind kind = Kind::None;
+	long amount = 0; // passes over the payload (memcpy, hash) or ns per record (spin)
+
+	bool enabled() const { return kind != Kind::None; }
+
+	std::string describe() const {
+		switch (kind) {
+		case Kind::Memcpy: return "memcpy:" + std::to_string(amount);
+		case Kind::Hash: return "hash:" + std::to_string(amount);
+		case Kind::Spin: return "spin:" + std::to_string(amount);
+		default: return "none";
+		}
+	}
+};
+
+// Parses none, memcpy[:PASSES], hash[:PASSES] or spin:NS.
+inline bool parseWorkKernel(const std::string& spec, WorkKernel& out) {
+	size_t colon = spec.find(':');
+	std::string name = spec.substr(0, colon);
+	long amount = 1;
+	if (colon != std::string::npos) {
+		const std::string arg = spec.substr(colon + 1);
+		char* end = nullptr;
+		amount = std::strtol(arg.c_str(), &end, 10);
+		if (arg.empty() || *end != '\0' || amount <= 0) return false;
+	}
+	WorkKernel k;
+	if (name == "none" && colon == std::string::npos) k.kind = WorkKernel::Kind::None;
+	else if (name == "memcpy") k.kind = WorkKernel::Kind::Memcpy;
+	else if (name == "hash") k.kind = WorkKernel::Kind::Hash;
+	else if (name == "spin" && colon != std::string::npos) k.kind = WorkKernel::Kind::Spin;
+	else return false;
+	k.amount = k.enabled() ? amount : 0;
+	out = k;
+	return true;
+}
+
+// Per-consumer destination of the work kernels; the folded hash keeps the
+// compiler from dropping work whose result nobody reads.
+struct WorkSink {
+	std::vector<uint8_t> buffer;
+	uint64_t hash = 0;
+};
+
+// Runs the kernel over one received message carrying `records` records and
+// returns the ns it took (0 without --work).
+inline uint64_t runWork(const WorkKernel& k, WorkSink& sink, const uint8_t* data, size_t len, size_t records = 1) {
+	if (!k.enabled()) return 0;
+	const uint64_t start = nowNs();
+	switch (k.kind) {
+	case WorkKernel::Kind::Memcpy:
+		if (sink.buffer.size() < len) sink.buffer.resize(len);
+		for (long pass = 0; pass < k.amount; ++pass) {
+			std::memcpy(sink.buffer.data(), data, len);
+			asm volatile("" : : "r"(sink.buffer.data()) : "memory");
+		}
+		break;
+	case WorkKernel::Kind::Hash:
+		for (long pass = 0; pass < k.amount; ++pass) {
+			uint64_t h = 1469598103934665603ull ^ static_cast<uint64_t>(pass);
+			for (size_t i = 0; i < len; ++i) h = (h ^ data[i]) * 1099511628211ull;
+			sink.hash ^= h;
+		}
+		break;
+	case WorkKernel::Kind::Spin: {
+		const uint64_t until = start + static_cast<uint64_t>(k.amount) * records;
+		while (nowNs() < until) cpuRelax();
+		break;
+	}
+	default: break;
+	}
+	return nowNs() - start;
+}
+
+// Options every backend takes; each backend's Config derives from this.
+struct BenchConfig {
+	int durationSeconds = 5;
+	size_t messageSize = 256;
+	int producers = 1;
+	int consumers = 1;
+	bool randomPayload = false;
+	double rate = 0.0;
+	bool latencySample = true; // record every message's latency in the histograms
+	int printIntervalSeconds = 1;
+	std::string csvPath = "";
+	std::string resultsPath = ""; // binary run records, see result_file.h
+	std::string clock = "auto";
+	std::string work = "none";
+	WorkKernel workKernel; // parsed from work by setupWork()
+};
+
+inline bool parseBool(const std::string& s) {
+	return s == "1" || s == "true" || s == "True" || s == "TRUE" || s == "yes" || s == "on";
+}
+
+// Handles arg if it is one of the BenchConfig options; value() returns the
+// option's argument. Returns false for anything else.
+template <typename Value>
+inline bool parseCommonOption(BenchConfig& cfg, const std::string& arg, Value value) {
+	if (arg == "--duration-seconds") cfg.durationSeconds = std::stoi(value());
+	else if (arg == "--message-size") cfg.messageSize = static_cast<size_t>(std::stoll(value()));
+	else if (arg == "--producers") cfg.producers = std::stoi(value());
+	else if (arg == "--consumers") cfg.consumers = std::stoi(value());
+	else if (arg == "--random-payload") cfg.randomPayload = parseBool(value());
+	else if (arg == "--rate") cfg.rate = std::stod(value());
+	else if (arg == "--latency-sample") {
+		// A switch: the histograms take every message. The old sample count
+		// still parses, any number other than 0 meaning on.
+		std::string v = value();
+		bool number = !v.empty() && v.find_first_not_of("0123456789") == std::string::npos;
+		cfg.latencySample = number ? v.find_first_not_of('0') != std::string::npos : parseBool(v);
+	}
+	else if (arg == "--print-interval") cfg.printIntervalSeconds = std::stoi(value());
+	else if (arg == "--csv") cfg.csvPath = value();
+	else if (arg == "--results") cfg.resultsPath = value();
+	else if (arg == "--clock") cfg.clock = value();
+	else if (arg == "--work") cfg.work = value();
+	else return false;
+	return true;
+}
+
+// Call from main after parsing; returns false for a malformed --work spec.
+inline bool setupWork(BenchConfig& cfg) {
+	return parseWorkKernel(cfg.work, cfg.workKernel);
+}
+
+inline long readLongFromFile(const char* path, long fallback) {
+	std::ifstream in(path);
+	if (!in.good()) return fallback;
+	long v = fallback;
+	in >> v;
+	return in.fail() ? fallback : v;
+}
+
+// The CSV's trailing "extra" column holds mode-specific key=value pairs
+// separated by ';', so the fixed columns stay identical across backends.
+inline void appendExtra(std::string& extra, const std::string& key, const std::string& value) {
+	if (!extra.empty()) extra += ';';
+	extra += key + "=" + value;
+}
+
+// A user-supplied spec (size-dist, priority-mix) as an extra value: ',' and ';'
+// would split the CSV row or the extra column, so they become '/'.
+inline std::string extraSpec(std::string spec) {
+	std::replace(spec.begin(), spec.end(), ',', '/');
+	std::replace(spec.begin(), spec.end(), ';', '/');
+	return spec;
+}
+
+inline std::string formatDouble(double v, int precision = 2) {
+	std::ostringstream os;
+	os << std::fixed << std::setprecision(precision) << v;
+	return os.str();
+}
+
+// Samples a queue-depth gauge (mq_curmsgs, or a dispatch backend's in-flight
+// count) every intervalUs on its own thread and keeps the exact distribution
+// of levels 0..capacity, so occupancy can be read next to latency: a p99 at
+// capacity with a latency close to Little's-law queueing time means the
+// latency is waiting in the queue, not transport cost. read(g) returns the
+// level of gauge g, or -1 to skip it.
+struct OccupancyStats {
+	uint64_t samples = 0;
+	double mean = 0.0;
+	long p50 = 0;
+	long p99 = 0;
+	long max = 0;
+	double fullPct = 0.0;
+	double emptyPct = 0.0;
+};
+
+class OccupancySampler {
+public:
+	OccupancySampler(long capacity, int gauges, int intervalUs, std::function<long(int)> read)
+	    : capacity_(std::max(capacity, 1L)), gauges_(gauges), intervalUs_(intervalUs),
+	      read_(std::move(read)), counts_(static_cast<size_t>(capacity_) + 1, 0) {}
+
+	~OccupancySampler() { stop(); }
+
+	void start() {
+		if (intervalUs_ > 0) thread_ = std::thread([this] { run(); });
+	}
+
+	void stop() {
+		done_.store(true, std::memory_order_relaxed);
+		if (thread_.joinable()) thread_.join();
+	}
+
+	bool enabled() const { return intervalUs_ > 0; }
+	long capacity() const { return capacity_; }
+	int intervalUs() const { return intervalUs_; }
+
+	// Drops the samples taken so far (the warmup boundary).
+	void reset() { resetRequested_.store(true, std::memory_order_relaxed); }
+
+	// Call after stop().
+	OccupancyStats stats() const {
+		OccupancyStats st;
+		double sum = 0.0;
+		for (size_t level = 0; level < counts_.size(); ++level) {
+			st.samples += counts_[level];
+			sum += static_cast<double>(level) * static_cast<double>(counts_[level]);
+			if (counts_[level]) st.max = static_cast<long>(level);
+		}
+		if (st.samples == 0) return st;
+		st.mean = sum / static_cast<double>(st.samples);
+		st.fullPct = 100.0 * static_cast<double>(counts_.back()) / static_cast<double>(st.samples);
+		st.emptyPct = 100.0 * static_cast<double>(counts_.front()) / static_cast<double>(st.samples);
+		uint64_t cumulative = 0;
+		uint64_t rank50 = (st.samples + 1) / 2;
+		uint64_t rank99 = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(0.99 * static_cast<double>(st.samples))));
+		bool have50 = false;
+		for (size_t level = 0; level < counts_.size(); ++level) {
+			cumulative += counts_[level];
+			if (!have50 && cumulative >= rank50) { st.p50 = static_cast<long>(level); have50 = true; }
+			if (cumulative >= rank99) { st.p99 = static_cast<long>(level); break; }
+		}
+		return st;
+	}
+
+private:
+	void run() {
+		while (!done_.load(std::memory_order_relaxed)) {
+			if (resetRequested_.exchange(false, std::memory_order_relaxed)) std::fill(counts_.begin(), counts_.end(), 0);
+			for (int g = 0; g < gauges_; ++g) {
+				long level = read_(g);
+				if (level >= 0) counts_[static_cast<size_t>(std::min(level, capacity_))]++;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(intervalUs_));
+		}
+	}
+
+	long capacity_;
+	int gauges_;
+	int intervalUs_;
+	std::function<long(int)> read_;
+	std::vector<uint64_t> counts_;
+	std::atomic<bool> done_{false};
+	std::atomic<bool> resetRequested_{false};
+	std::thread thread_;
+};
+
+// ru_maxrss of this process, or of the largest reaped child, in KiB.
+inline long peakRssKiB(bool children = false) {
+	rusage ru{};
+	getrusage(children ? RUSAGE_CHILDREN : RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+	return static_cast<long>(ru.ru_maxrss / 1024);
+#else
+	return static_cast<long>(ru.ru_maxrss);
+#endif
+}
+
+// Summary lines every backend prints, in this order after its own heading.
+inline void printThroughputSummary(double elapsedSec, uint64_t sent, uint64_t recv, uint64_t sbytes, uint64_t rbytes) {
+	std::cout << "  elapsed-sec:         " << std::fixed << std::setprecision(3) << elapsedSec << "\n";
+	std::cout << "  messages-sent:       " << sent << "\n";
+	std::cout << "  messages-recv:       " << recv << "\n";
+	std::cout << "  bytes-sent:          " << sbytes << "\n";
+	std::cout << "  bytes-recv:          " << rbytes << "\n";
+	std::cout << "  throughput-msg/s:    " << std::fixed << std::setprecision(2) << recv / elapsedSec << "\n";
+	std::cout << "  throughput-MiB/s:    " << std::fixed << std::setprecision(2)
+	          << (rbytes / (1024.0 * 1024.0)) / elapsedSec << "\n";
+}
+
+inline void printOfferedRate(const BenchConfig& cfg, uint64_t sent, double elapsedSec) {
+	if (cfg.rate <= 0.0) return;
+	std::cout << "  offered-rate:        target=" << std::fixed << std::setprecision(2) << cfg.rate
+	          << " sent=" << sent / elapsedSec << " msg/s (latency from intended send time)\n";
+}
+
+// recvPerSec turns the mean level into Little's-law time in queue (all
+// gauges together hold mean x gauges messages).
+inline void printOccupancySummary(const OccupancySampler& sampler, int gauges, const char* what, double recvPerSec) {
+	if (!sampler.enabled()) return;
+	OccupancyStats st = sampler.stats();
+	std::cout << "  occupancy:           " << what << " mean=" << std::fixed << std::setprecision(2) << st.mean
+	          << "/" << sampler.capacity() << " p50=" << st.p50 << " p99=" << st.p99 << " max=" << st.max
+	          << " full=" << std::setprecision(1) << st.fullPct << "% empty=" << st.emptyPct << "%";
+	if (recvPerSec > 0.0) {
+		std::cout << " little-us=" << std::setprecision(2) << st.mean * gauges / recvPerSec * 1e6;
+	}
+	std::cout << " (" << st.samples << " samples every " << sampler.intervalUs() << " us)\n";
+}
+
+inline void appendOccupancyExtras(std::string& extra, const OccupancySampler& sampler, int gauges, double recvPerSec) {
+	if (!sampler.enabled()) return;
+	OccupancyStats st = sampler.stats();
+	appendExtra(extra, "occMean", formatDouble(st.mean));
+	appendExtra(extra, "occP50", std::to_string(st.p50));
+	appendExtra(extra, "occP99", std::to_string(st.p99));
+	appendExtra(extra, "occMax", std::to_string(st.max));
+	appendExtra(extra, "occFullPct", formatDouble(st.fullPct, 1));
+	appendExtra(extra, "occEmptyPct", formatDouble(st.emptyPct, 1));
+	if (recvPerSec > 0.0) appendExtra(extra, "occLittleUs", formatDouble(st.mean * gauges / recvPerSec * 1e6));
+}
+
+// workNs is the kernel time summed over all consumers and servers the number
+// of consumers working in parallel: service time S = workNs / recv, capacity
+// servers / S, utilisation the share of the servers' wall time spent in it.
+inline void printWorkSummary(const BenchConfig& cfg, uint64_t workNs, uint64_t recv, double elapsedSec, int servers) {
+	if (!cfg.workKernel.enabled()) return;
+	const double serviceNs = recv ? static_cast<double>(workNs) / static_cast<double>(recv) : 0.0;
+	std::cout << "  work:                " << cfg.workKernel.describe() << " service=" << std::fixed
+	          << std::setprecision(2) << serviceNs << " ns/msg";
+	if (serviceNs > 0.0) std::cout << " capacity=" << servers * 1e9 / serviceNs << " msg/s";
+	std::cout << " utilisation=" << std::setprecision(1)
+	          << 100.0 * static_cast<double>(workNs) / (servers * elapsedSec * 1e9) << "% (" << servers
+	          << " consumers)\n";
+}
+
+// Each latency sample is the difference of two nowNs() reads, so it carries
+// about one read's cost; subtract it when comparing sub-microsecond results.
+inline void printTimerSummary() {
+	std::cout << "  timer:               " << tickClock.source;
+	if (tickClock.ticks) std::cout << " " << std::fixed << std::setprecision(3) << 1.0 / tickClock.nsPerTick << " GHz";
+	std::cout << " read=" << std::fixed << std::setprecision(2) << tickClock.readNs
+	          << "ns (clock_gettime=" << tickClock.clockGettimeNs << "ns)\n";
+}
+
+inline void printLatencySummary(const std::vector<std::pair<double, double>>& pctUs) {
+	if (pctUs.empty()) {
+		std::cout << "  latency-us:          not available (message-size < header)\n";
+		return;
+	}
+	std::cout << "  latency-us (p50,p90,p95,p99,p99.9,p99.99,max):";
+	for (auto& p : pctUs) {
+		if (p.first >= 1.0) std::cout << " max";
+		else std::cout << " p" << std::fixed << std::setprecision(3) << (p.first * 100.0);
+		std::cout << "=" << std::fixed << std::setprecision(2) << p.second;
+	}
+	std::cout << "\n";
+	printTimerSummary();
+}
+
+// One row of the --csv results file; the columns match the header written by
+// scripts/run_matrix.sh. depth is max-messages for queue backends and
+// max-inflight for the dispatch ones. With --results the same row, plus the
+// full histogram and the interval series, is also appended as a binary record.
+struct ResultRow {
+	std::string backend;
+	std::string queueName;
+	long depth = 0;
+	bool nonBlocking = false;
+	double elapsedSec = 0.0;
+	uint64_t recvMessages = 0;
+	uint64_t recvBytes = 0;
+	std::vector<std::pair<double, double>> pctUs;
+	std::string extra;
+	uint64_t workNs = 0; // --work kernel time, see printWorkSummary
+	int servers = 0;     // consumers running the kernel; 0 = cfg.consumers
+	const LatencyHistogram* hist = nullptr; // the histogram pctUs came from
+	std::vector<IntervalSample> intervals;  // one per print interval
+};
+
+// The interval series of a run, built from the cumulative sent/recv counts
+// the progress loop reads at each print interval.
+struct IntervalSeries {
+	std::vector<IntervalSample> samples;
+	uint64_t sent = 0; // cumulative counts at the last add()
+	uint64_t recv = 0;
+
+	void add(double tSec, uint64_t sentNow, uint64_t recvNow) {
+		IntervalSample s;
+		s.tSec = tSec;
+		s.sent = sentNow - sent;
+		s.recv = recvNow - recv;
+		samples.push_back(s);
+		sent = sentNow;
+		recv = recvNow;
+	}
+};
+
+// The --results record for row: the CSV columns as numeric fields under the
+// same names, then each extra, the environment and the non-empty buckets of
+// row.hist. Runs without a runId extra get one of the form time-pid.N.
+inline RunRecord makeRunRecord(const BenchConfig& cfg, const ResultRow& row, const std::string& extra) {
+	RunRecord rec;
+	const double elapsed = row.elapsedSec > 0.0 ? row.elapsedSec : NAN;
+	rec.set("backend", row.backend);
+	rec.set("queueName", row.queueName);
+	rec.set("duration", static_cast<double>(cfg.durationSeconds));
+	rec.set("messageSize", static_cast<double>(cfg.messageSize));
+	rec.set("maxMessages", static_cast<double>(row.depth));
+	rec.set("producers", static_cast<double>(cfg.producers));
+	rec.set("consumers", static_cast<double>(cfg.consumers));
+	rec.set("nonBlocking", row.nonBlocking ? 1.0 : 0.0);
+	rec.set("randomPayload", cfg.randomPayload ? 1.0 : 0.0);
+	rec.set("latencySample", cfg.latencySample ? 1.0 : 0.0);
+	rec.set("elapsedSec", row.elapsedSec);
+	rec.set("recv", static_cast<double>(row.recvMessages));
+	rec.set("bytesRecv", static_cast<double>(row.recvBytes));
+	rec.set("msgPerSec", row.recvMessages / elapsed);
+	rec.set("MiBps", (row.recvBytes / (1024.0 * 1024.0)) / elapsed);
+	static const char* const pctKeys[7] = {"p50us", "p90us", "p95us", "p99us", "p999us", "p9999us", "maxus"};
+	for (size_t i = 0; i < 7; ++i) rec.set(pctKeys[i], i < row.pctUs.size() ? row.pctUs[i].second : NAN);
+	rec.set("time", static_cast<double>(time(nullptr)));
+	bool haveRunId = false;
+	std::istringstream in(extra);
+	std::string item;
+	while (std::getline(in, item, ';')) {
+		size_t eq = item.find('=');
+		if (eq == std::string::npos) continue;
+		rec.set(item.substr(0, eq), item.substr(eq + 1));
+		if (item.compare(0, eq, "runId") == 0) haveRunId = true;
+	}
+	if (!haveRunId) {
+		static int seq = 0;
+		rec.set("runId", std::to_string(static_cast<long long>(time(nullptr))) + "-" + std::to_string(getpid()) + "." +
+		                     std::to_string(seq++));
+	}
+	addEnvironment(rec);
+	rec.intervals = row.intervals;
+	rec.histSubBits = LatencyHistogram::kSubBits;
+	if (row.hist) {
+		rec.histMaxNs = row.hist->maxNs;
+		for (size_t i = 0; i < LatencyHistogram::kBuckets; ++i) {
+			if (row.hist->counts[i]) rec.buckets.push_back({static_cast<uint32_t>(i), row.hist->counts[i]});
+		}
+	}
+	return rec;
+}
+
+inline void appendResultRow(const BenchConfig& cfg, const ResultRow& row) {
+	if (cfg.csvPath.empty() && cfg.resultsPath.empty()) return;
+	double p50 = NAN, p90 = NAN, p95 = NAN, p99 = NAN, p999 = NAN, p9999 = NAN, pmax = NAN;
+	const std::vector<std::pair<double, double>>& pctUs = row.pctUs;
+	std::string extra = row.extra;
+	appendExtra(extra, "clock", tickClock.source);
+	appendExtra(extra, "timerNs", formatDouble(tickClock.readNs));
+	if (cfg.workKernel.enabled()) {
+		const int servers = row.servers > 0 ? row.servers : cfg.consumers;
+		const double serviceNs = row.recvMessages ? static_cast<double>(row.workNs) / static_cast<double>(row.recvMessages) : 0.0;
+		appendExtra(extra, "work", cfg.workKernel.describe());
+		appendExtra(extra, "serviceNs", formatDouble(serviceNs));
+		if (serviceNs > 0.0) appendExtra(extra, "workCapacity", formatDouble(servers * 1e9 / serviceNs));
+		appendExtra(extra, "workUtilPct", formatDouble(100.0 * static_cast<double>(row.workNs) / (servers * row.elapsedSec * 1e9), 1));
+	}
+	if (!cfg.resultsPath.empty()) appendRunRecord(cfg.resultsPath, makeRunRecord(cfg, row, extra));
+	if (cfg.csvPath.empty()) return;
+	FILE* f = fopen(cfg.csvPath.c_str(), "a");
+	if (!f) {
+		perror("fopen csv");
+		return;
+	}
+	if (pctUs.size() >= 7) {
+		p50 = pctUs[0].second; p90 = pctUs[1].second; p95 = pctUs[2].second; p99 = pctUs[3].second; p999 = pctUs[4].second;
+		p9999 = pctUs[5].second; pmax = pctUs[6].second;
+	}
+	fprintf(f,
+	        "%s,%s,%d,%zu,%ld,%d,%d,%d,%d,%d,%.6f,%llu,%llu,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%s\n",
+	        row.backend.c_str(),
+	        row.queueName.c_str(),
+	        cfg.durationSeconds,
+	        cfg.messageSize,
+	        row.depth,
+	        cfg.producers,
+	        cfg.consumers,
+	        row.nonBlocking ? 1 : 0,
+	        cfg.randomPayload ? 1 : 0,
+	        cfg.latencySample ? 1 : 0,
+	        row.elapsedSec,
+	        static_cast<unsigned long long>(row.recvMessages),
+	        static_cast<unsigned long long>(row.recvBytes),
+	        row.recvMessages / row.elapsedSec,
+	        (row.recvBytes / (1024.0 * 1024.0)) / row.elapsedSec,
+	        p50, p90, p95, p99, p999, p9999, pmax,
+	        extra.c_str());
+	fclose(f);
+}
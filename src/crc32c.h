@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+// CRC32C (Castagnoli) for --verify. Uses the SSE4.2 crc32 instruction (picked
+// at runtime, so the binary still runs on CPUs without it) or the ARMv8 CRC
+// extension when the target has it, 8 bytes per instruction; otherwise a
+// byte-wise table. crc32cUpdate chains: pass the previous return value to
+// continue a checksum over several ranges.
+namespace crc32c_detail {
+
+inline const uint32_t* table() {
+	static uint32_t t[256];
+	static bool ready = [] {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1u)));
+			t[i] = c;
+		}
+		return true;
+	}();
+	(void)ready;
+	return t;
+}
+
+inline uint32_t software(uint32_t crc, const uint8_t* p, size_t n) {
+	const uint32_t* t = table();
+	while (n--) crc = t[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline uint32_t hardware(uint32_t crc, const uint8_t* p, size_t n) {
+	uint64_t c = crc;
+	for (; n >= 8; p += 8, n -= 8) {
+		uint64_t w;
+		memcpy(&w, p, sizeof(w));
+		c = _mm_crc32_u64(c, w);
+	}
+	uint32_t c32 = static_cast<uint32_t>(c);
+	for (; n > 0; --n) c32 = _mm_crc32_u8(c32, *p++);
+	return c32;
+}
+
+inline bool hasHardware() {
+	static const bool has = __builtin_cpu_supports("sse4.2");
+	return has;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+inline uint32_t hardware(uint32_t crc, const uint8_t* p, size_t n) {
+	for (; n >= 8; p += 8, n -= 8) {
+		uint64_t w;
+		memcpy(&w, p, sizeof(w));
+		crc = __crc32cd(crc, w);
+	}
+	for (; n > 0; --n) crc = __crc32cb(crc, *p++);
+	return crc;
+}
+
+inline bool hasHardware() { return true; }
+#else
+inline uint32_t hardware(uint32_t crc, const uint8_t* p, size_t n) { return software(crc, p, n); }
+inline bool hasHardware() { return false; }
+#endif
+
+} // namespace crc32c_detail
+
+inline const char* crc32cImplementation() {
+	return crc32c_detail::hasHardware() ? "hardware" : "software";
+}
+
+// Start with crc = 0; the standard pre/post inversion is applied internally.
+inline uint32_t crc32cUpdate(uint32_t crc, const void* data, size_t len) {
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	crc = ~crc;
+	crc = crc32c_detail::hasHardware() ? crc32c_detail::hardware(crc, p, len) : crc32c_detail::software(crc, p, len);
+	return ~crc;
+}
@@ -1,6 +1,7 @@
 #include <atomic>
 #include <chrono>
 #include <csignal>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -9,107 +10,29 @@
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
-#include <mutex>
-#include <random>
+#include <memory>
 #include <string>
 #include <thread>
 #include <vector>
 #include <dispatch/dispatch.h>
 #include <unistd.h>
 
+#include "bench_core.h"
+#include "payload_fill.h"
+#include "slot_pool.h"
+
 using namespace std;
 
-struct Config {
-	int durationSeconds = 5;
-	size_t messageSize = 256;
+struct Config : BenchConfig {
 	long maxInFlight = 1024;
-	int producers = 1;
-	int consumers = 1;
-	bool randomPayload = false;
-	size_t latencySample = 100000;
-	int printIntervalSeconds = 1;
-	string csvPath = "";
+	bool zeroCopy = false;
+	int occupancyIntervalUs = 1000;
 };
 
-static atomic<bool> stopFlag{false};
-
-static inline uint64_t nowNs() {
-	timespec ts;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
-}
-
 static void onSignal(int) {
 	stopFlag.store(true, memory_order_relaxed);
 }
 
-struct MsgHeader {
-	uint64_t sequence;
-	uint64_t sendTimeNs;
-};
-
-struct Stats {
-	atomic<uint64_t> sentMessages{0};
-	atomic<uint64_t> sentBytes{0};
-	atomic<uint64_t> recvMessages{0};
-	atomic<uint64_t> recvBytes{0};
-};
-
-struct LatencyRecorder {
-	vector<uint64_t> samplesNs;
-	size_t capacity;
-	mutex mtx;
-	mt19937_64 rng;
-	atomic<uint64_t> seen{0};
-
-	explicit LatencyRecorder(size_t cap)
-	    : capacity(cap), rng(random_device{}()) {
-		samplesNs.reserve(capacity);
-	}
-
-	void record(uint64_t valueNs) {
-		uint64_t index = seen.fetch_add(1, memory_order_relaxed);
-		if (capacity == 0) return;
-		if (index < capacity) {
-			lock_guard<mutex> lock(mtx);
-			if (samplesNs.size() < capacity) {
-				samplesNs.push_back(valueNs);
-			}
-			return;
-		}
-		uniform_int_distribution<uint64_t> dist(0, index);
-		uint64_t pos = dist(rng);
-		if (pos < capacity) {
-			lock_guard<mutex> lock(mtx);
-			if (pos < samplesNs.size()) {
-				samplesNs[pos] = valueNs;
-			}
-		}
-	}
-};
-
-static void computePercentiles(vector<uint64_t>& dataNs, vector<pair<double, double>>& outPctToUs) {
-	if (dataNs.empty()) return;
-	sort(dataNs.begin(), dataNs.end());
-	auto at = [&](double pct) -> double {
-		if (dataNs.empty()) return 0.0;
-		double pos = pct * (dataNs.size() - 1);
-		size_t idx = static_cast<size_t>(pos);
-		size_t idx2 = min(idx + 1, dataNs.size() - 1);
-		double frac = pos - idx;
-		double vNs = static_cast<double>(dataNs[idx]) * (1.0 - frac) + static_cast<double>(dataNs[idx2]) * frac;
-		return vNs / 1000.0;
-	};
-	const double pcts[] = {0.5, 0.90, 0.95, 0.99, 0.999};
-	for (double p : pcts) {
-		outPctToUs.push_back({p, at(p)});
-	}
-}
-
-static bool parseBool(const string& s) {
-	return s == "1" || s == "true" || s == "True" || s == "TRUE" || s == "yes" || s == "on";
-}
-
 static void usage(const char* argv0) {
 	cerr << "Usage: " << argv0 << " [options]\n";
 	cerr << "Options:\n";
@@ -119,9 +42,15 @@ static void usage(const char* argv0) {
 	cerr << "  --producers N              Default 1\n";
 	cerr << "  --consumers N              Default 1 (parallel serial queues)\n";
 	cerr << "  --random-payload true|false Default false\n";
-	cerr << "  --latency-sample N         Default 100000\n";
+	cerr << "  --rate MSGS_PER_SEC        Default 0 (closed loop); total open-loop rate split across producers\n";
+	cerr << "  --zero-copy true|false     Default false (true: preallocated slab of max-inflight buffers, block captures a pointer)\n";
+	cerr << "  --occupancy-interval-us N  Default 1000; sample the in-flight count this often (0 disables)\n";
+	cerr << "  --latency-sample 0|1       Default 1 (record every message's latency; 0 disables the histograms)\n";
+	cerr << "  --clock SOURCE             auto|tsc|monotonic, default auto (calibrated TSC/cntvct when invariant)\n";
+	cerr << "  --work KERNEL              none|memcpy[:PASSES]|hash[:PASSES]|spin:NS per message, default none\n";
 	cerr << "  --print-interval N         Default 1 (seconds)\n";
 	cerr << "  --csv PATH                 Append CSV results to PATH\n";
+	cerr << "  --results PATH             Append a binary run record (histogram, intervals) for mq_report\n";
 }
 
 static Config parseArgs(int argc, char** argv) {
@@ -135,15 +64,11 @@ static Config parseArgs(int argc, char** argv) {
 				exit(1);
 			}
 		};
-		if (arg == "--duration-seconds") { need(arg); cfg.durationSeconds = stoi(argv[++i]); }
-		else if (arg == "--message-size") { need(arg); cfg.messageSize = static_cast<size_t>(stoll(argv[++i])); }
-		else if (arg == "--max-inflight") { need(arg); cfg.maxInFlight = stol(argv[++i]); }
-		else if (arg == "--producers") { need(arg); cfg.producers = stoi(argv[++i]); }
-		else if (arg == "--consumers") { need(arg); cfg.consumers = stoi(argv[++i]); }
-		else if (arg == "--random-payload") { need(arg); cfg.randomPayload = parseBool(argv[++i]); }
-		else if (arg == "--latency-sample") { need(arg); cfg.latencySample = static_cast<size_t>(stoll(argv[++i])); }
-		else if (arg == "--print-interval") { need(arg); cfg.printIntervalSeconds = stoi(argv[++i]); }
-		else if (arg == "--csv") { need(arg); cfg.csvPath = argv[++i]; }
+		auto value = [&]() -> const char* { need(arg); return argv[++i]; };
+		if (parseCommonOption(cfg, arg, value)) continue;
+		if (arg == "--max-inflight") { need(arg); cfg.maxInFlight = stol(argv[++i]); }
+		else if (arg == "--zero-copy") { need(arg); cfg.zeroCopy = parseBool(argv[++i]); }
+		else if (arg == "--occupancy-interval-us") { need(arg); cfg.occupancyIntervalUs = stoi(argv[++i]); }
 		else if (arg == "--help" || arg == "-h") { usage(argv[0]); exit(0); }
 		else {
 			cerr << "Unknown option: " << arg << "\n";
@@ -161,13 +86,30 @@ int main(int argc, char** argv) {
 	Config cfg = parseArgs(argc, argv);
 
 	if (cfg.messageSize == 0 || cfg.producers <= 0 || cfg.consumers <= 0 ||
-	    cfg.durationSeconds <= 0 || cfg.maxInFlight <= 0) {
+	    cfg.durationSeconds <= 0 || cfg.printIntervalSeconds <= 0 || cfg.maxInFlight <= 0 || cfg.rate < 0.0 || cfg.occupancyIntervalUs < 0) {
 		cerr << "Invalid config\n";
 		return 1;
 	}
+	if (!setupClock(cfg.clock)) {
+		cerr << "clock must be auto, tsc or monotonic\n";
+		return 1;
+	}
+	if (!setupWork(cfg)) {
+		cerr << "work must be none, memcpy[:PASSES], hash[:PASSES] or spin:NS\n";
+		return 1;
+	}
+	if (cfg.zeroCopy && cfg.maxInFlight >= 0xFFFFFFFFl) {
+		cerr << "--zero-copy requires max-inflight < 2^32\n";
+		return 1;
+	}
 
-	Stats stats;
-	LatencyRecorder latRecorder(cfg.latencySample);
+	// Counters per producer and, like the histograms, per serial worker queue:
+	// blocks on a serial queue never run concurrently, so each slot and each
+	// histogram has a single writer at a time.
+	vector<ThreadCounters> producerSlots(static_cast<size_t>(cfg.producers));
+	vector<ThreadCounters> queueSlots(static_cast<size_t>(cfg.consumers));
+	vector<LatencyHistogram> latHists(static_cast<size_t>(cfg.consumers));
+	vector<WorkSink> sinks(static_cast<size_t>(cfg.consumers));
 
 	dispatch_semaphore_t spaceSem = dispatch_semaphore_create(cfg.maxInFlight);
 	vector<dispatch_queue_t> workerQueues;
@@ -178,50 +120,91 @@ int main(int argc, char** argv) {
 		workerQueues.push_back(q);
 	}
 	atomic<uint64_t> rr{0};
+	// --zero-copy: one slot per in-flight message. spaceSem counts free slots,
+	// so a producer past dispatch_semaphore_wait always finds one; the block
+	// returns its slot before signalling the semaphore.
+	unique_ptr<SlotPool> pool;
+	if (cfg.zeroCopy) pool = make_unique<SlotPool>(static_cast<size_t>(cfg.maxInFlight), cfg.messageSize);
+	SlotPool* slots = pool.get();
+
+	// Runs on worker queue qIndex: count the message, run the --work kernel
+	// and record its latency.
+	auto consume = [&](const uint8_t* data, size_t len, size_t qIndex) {
+		ThreadCounters& counters = queueSlots[qIndex];
+		ThreadCounters::bump(counters.messages);
+		ThreadCounters::bump(counters.bytes, len);
+		if (cfg.workKernel.enabled()) {
+			ThreadCounters::bump(counters.workNs, runWork(cfg.workKernel, sinks[qIndex], data, len));
+		}
+		if (cfg.latencySample && len >= sizeof(MsgHeader)) {
+			LatencyHistogram* latHist = &latHists[qIndex];
+			const MsgHeader* h = reinterpret_cast<const MsgHeader*>(data);
+			uint64_t recvNs = nowNs();
+			uint64_t sendNs = h->intendedTimeNs;
+			if (recvNs >= sendNs) {
+				latHist->record(recvNs - sendNs);
+			}
+		}
+	};
 
 	auto produceFunc = [&](int producerId) {
-		vector<uint8_t> buffer(cfg.messageSize, 0);
-		MsgHeader* header = nullptr;
-		if (cfg.messageSize >= sizeof(MsgHeader)) {
-			header = reinterpret_cast<MsgHeader*>(buffer.data());
-		}
-		mt19937_64 rng(static_cast<uint64_t>(producerId) ^ 0x9e3779b97f4a7c15ull);
-		uniform_int_distribution<uint32_t> dist(0, 0xFFFFFFFFu);
+		ThreadCounters& counters = producerSlots[static_cast<size_t>(producerId)];
+		vector<uint8_t> buffer(slots ? 0 : cfg.messageSize, 0);
+		const bool hasHeader = cfg.messageSize >= sizeof(MsgHeader);
+		PayloadFill filler(static_cast<uint64_t>(producerId));
+		Pacer pacer(cfg.rate, cfg.producers, producerId);
 		uint64_t seq = 0;
-		while (!stopFlag.load(memory_order_relaxed)) {
-			if (header) {
+		// Writes header and payload into dst (the producer's scratch buffer, or a slab slot).
+		auto fill = [&](uint8_t* dst, uint64_t sendNs, uint64_t intended) {
+			if (hasHeader) {
+				MsgHeader* header = reinterpret_cast<MsgHeader*>(dst);
 				header->sequence = seq++;
-				header->sendTimeNs = nowNs();
+				header->sendTimeNs = sendNs;
+				header->intendedTimeNs = pacer.enabled() ? intended : sendNs;
+				header->producerId = static_cast<uint32_t>(producerId);
 			}
-		if (cfg.randomPayload) {
-			size_t start = header ? sizeof(MsgHeader) : 0;
-			for (size_t i = start; i + sizeof(uint32_t) <= cfg.messageSize; i += sizeof(uint32_t)) {
-				uint32_t r = dist(rng);
-				memcpy(buffer.data() + i, &r, sizeof(uint32_t));
+			if (cfg.randomPayload) {
+				size_t start = hasHeader ? sizeof(MsgHeader) : 0;
+				filler.fill(dst + start, cfg.messageSize - start);
 			}
-		}
+		};
+		while (!stopFlag.load(memory_order_relaxed)) {
+			uint64_t intended = 0;
+			if (pacer.enabled()) {
+				intended = pacer.next();
+				Pacer::waitUntil(intended);
+			}
+			// Stamped before waiting for space so both payload modes charge the
+			// semaphore wait to latency.
+			uint64_t sendNs = nowNs();
+			if (!slots) fill(buffer.data(), sendNs, intended);
 			dispatch_semaphore_wait(spaceSem, DISPATCH_TIME_FOREVER);
 
 			uint64_t idx = rr.fetch_add(1, memory_order_relaxed);
-			dispatch_queue_t q = workerQueues[static_cast<size_t>(idx % workerQueues.size())];
-
-			vector<uint8_t> payload = buffer;
-			dispatch_async(q, ^{
-				stats.recvMessages.fetch_add(1, memory_order_relaxed);
-				stats.recvBytes.fetch_add(payload.size(), memory_order_relaxed);
-				if (payload.size() >= sizeof(MsgHeader)) {
-					const MsgHeader* h = reinterpret_cast<const MsgHeader*>(payload.data());
-					uint64_t recvNs = nowNs();
-					uint64_t sendNs = h->sendTimeNs;
-					if (recvNs >= sendNs) {
-						latRecorder.record(recvNs - sendNs);
-					}
-				}
-				dispatch_semaphore_signal(spaceSem);
-			});
+			size_t qIndex = static_cast<size_t>(idx % workerQueues.size());
+			dispatch_queue_t q = workerQueues[qIndex];
+
+			if (slots) {
+				long slot = slots->acquire();
+				if (slot < 0) break;
+				uint8_t* msg = slots->at(static_cast<uint32_t>(slot));
+				fill(msg, sendNs, intended);
+				const size_t len = cfg.messageSize;
+				dispatch_async(q, ^{
+					consume(msg, len, qIndex);
+					slots->release(static_cast<uint32_t>(slot));
+					dispatch_semaphore_signal(spaceSem);
+				});
+			} else {
+				vector<uint8_t> payload = buffer;
+				dispatch_async(q, ^{
+					consume(payload.data(), payload.size(), qIndex);
+					dispatch_semaphore_signal(spaceSem);
+				});
+			}
 
-			stats.sentMessages.fetch_add(1, memory_order_relaxed);
-			stats.sentBytes.fetch_add(cfg.messageSize, memory_order_relaxed);
+			ThreadCounters::bump(counters.messages);
+			ThreadCounters::bump(counters.bytes, cfg.messageSize);
 		}
 	};
 
@@ -230,14 +213,28 @@ int main(int argc, char** argv) {
 		producers.emplace_back(produceFunc, i);
 	}
 
+	// Messages dispatched but not yet picked up by a worker block: the GCD
+	// counterpart of mq_curmsgs, bounded by spaceSem at max-inflight.
+	auto sum = [&] {
+		return sumCounters(producerSlots.data(), cfg.producers, queueSlots.data(), cfg.consumers);
+	};
+	OccupancySampler occupancy(cfg.maxInFlight, 1, cfg.occupancyIntervalUs, [&sum](int) -> long {
+		Stats s = sum();
+		return s.sentMessages > s.recvMessages ? static_cast<long>(s.sentMessages - s.recvMessages) : 0;
+	});
+	occupancy.start();
+
 	const auto start = chrono::steady_clock::now();
 	const auto endTime = start + chrono::seconds(cfg.durationSeconds);
+	IntervalSeries intervals;
 	while (chrono::steady_clock::now() < endTime && !stopFlag.load(memory_order_relaxed)) {
 		this_thread::sleep_for(chrono::seconds(cfg.printIntervalSeconds));
-		uint64_t sent = stats.sentMessages.load(memory_order_relaxed);
-		uint64_t recv = stats.recvMessages.load(memory_order_relaxed);
-		uint64_t sbytes = stats.sentBytes.load(memory_order_relaxed);
-		uint64_t rbytes = stats.recvBytes.load(memory_order_relaxed);
+		Stats s = sum();
+		uint64_t sent = s.sentMessages;
+		uint64_t recv = s.recvMessages;
+		intervals.add(chrono::duration<double>(chrono::steady_clock::now() - start).count(), sent, recv);
+		uint64_t sbytes = s.sentBytes;
+		uint64_t rbytes = s.recvBytes;
 		cout << "GCD Progress: sent=" << sent << " recv=" << recv
 		     << " sentMiB=" << fixed << setprecision(2) << (double)sbytes / (1024.0 * 1024.0)
 		     << " recvMiB=" << fixed << setprecision(2) << (double)rbytes / (1024.0 * 1024.0)
@@ -245,6 +242,7 @@ int main(int argc, char** argv) {
 		cout.flush();
 	}
 	stopFlag.store(true, memory_order_relaxed);
+	occupancy.stop();
 	for (auto& t : producers) t.join();
 
 	for (long i = 0; i < cfg.maxInFlight; ++i) dispatch_semaphore_signal(spaceSem);
@@ -253,69 +251,51 @@ int main(int argc, char** argv) {
 	const auto end = chrono::steady_clock::now();
 	double elapsedSec = chrono::duration<double>(end - start).count();
 	if (elapsedSec <= 0) elapsedSec = static_cast<double>(cfg.durationSeconds);
-	uint64_t sent = stats.sentMessages.load(memory_order_relaxed);
-	uint64_t recv = stats.recvMessages.load(memory_order_relaxed);
-	uint64_t sbytes = stats.sentBytes.load(memory_order_relaxed);
-	uint64_t rbytes = stats.recvBytes.load(memory_order_relaxed);
-	double recvMsgPerSec = recv / elapsedSec;
-	double recvMBps = (rbytes / (1024.0 * 1024.0)) / elapsedSec;
-
-	vector<uint64_t> latCopyNs;
-	{
-		lock_guard<mutex> lock(latRecorder.mtx);
-		latCopyNs = latRecorder.samplesNs;
-	}
+	Stats totals = sum();
+	uint64_t sent = totals.sentMessages;
+	uint64_t recv = totals.recvMessages;
+	uint64_t sbytes = totals.sentBytes;
+	uint64_t rbytes = totals.recvBytes;
+	uint64_t workNs = totals.workNs;
+
+	// Drain every worker queue so all histogram writes are visible before merging.
+	for (dispatch_queue_t q : workerQueues) dispatch_sync(q, ^{});
+	auto merged = make_unique<LatencyHistogram>();
+	for (const LatencyHistogram& h : latHists) merged->merge(h);
 	vector<pair<double, double>> pctUs;
-	computePercentiles(latCopyNs, pctUs);
+	computePercentiles(*merged, pctUs);
 
 	cout << "\nGCD Summary:\n";
-	cout << "  elapsed-sec:         " << fixed << setprecision(3) << elapsedSec << "\n";
-	cout << "  messages-sent:       " << sent << "\n";
-	cout << "  messages-recv:       " << recv << "\n";
-	cout << "  bytes-sent:          " << sbytes << "\n";
-	cout << "  bytes-recv:          " << rbytes << "\n";
-	cout << "  throughput-msg/s:    " << fixed << setprecision(2) << recvMsgPerSec << "\n";
-	cout << "  throughput-MiB/s:    " << fixed << setprecision(2) << recvMBps << "\n";
-	if (!pctUs.empty()) {
-		cout << "  latency-us (p50,p90,p95,p99,p99.9):";
-		for (auto& p : pctUs) {
-			cout << " p" << fixed << setprecision(3) << (p.first * 100.0) << "=" << fixed << setprecision(2) << p.second;
-		}
-		cout << "\n";
+	printThroughputSummary(elapsedSec, sent, recv, sbytes, rbytes);
+	if (slots) {
+		cout << "  payload:             slab " << cfg.maxInFlight << " x " << slots->stride
+		     << " B (block captures a slot pointer, no per-message copy)\n";
 	} else {
-		cout << "  latency-us:          not available (message-size < header)\n";
-	}
-
-	if (!cfg.csvPath.empty()) {
-		FILE* f = fopen(cfg.csvPath.c_str(), "a");
-		if (!f) {
-			perror("fopen csv");
-		} else {
-			double p50 = NAN, p90 = NAN, p95 = NAN, p99 = NAN, p999 = NAN;
-			if (pctUs.size() >= 5) {
-				p50 = pctUs[0].second; p90 = pctUs[1].second; p95 = pctUs[2].second; p99 = pctUs[3].second; p999 = pctUs[4].second;
-			}
-			fprintf(f,
-			        "%s,%s,%d,%zu,%ld,%d,%d,%d,%d,%zu,%.6f,%llu,%llu,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
-			        "gcd",
-			        "gcd_queue",
-			        cfg.durationSeconds,
-			        cfg.messageSize,
-			        cfg.maxInFlight,
-			        cfg.producers,
-			        cfg.consumers,
-			        0,
-			        cfg.randomPayload ? 1 : 0,
-			        cfg.latencySample,
-			        elapsedSec,
-			        static_cast<unsigned long long>(recv),
-			        static_cast<unsigned long long>(rbytes),
-			        recvMsgPerSec,
-			        recvMBps,
-			        p50, p90, p95, p99, p999);
-			fclose(f);
-		}
+		cout << "  payload:             copy (vector per message captured by the block)\n";
 	}
+	printOfferedRate(cfg, sent, elapsedSec);
+	printWorkSummary(cfg, workNs, recv, elapsedSec, cfg.consumers);
+	printLatencySummary(pctUs);
+	printOccupancySummary(occupancy, 1, "in-flight", recv / elapsedSec);
+	const long peakRss = peakRssKiB();
+	cout << "  memory:              peak-rss=" << peakRss << " KiB\n";
+
+	ResultRow row;
+	row.backend = "gcd";
+	row.queueName = "gcd_queue";
+	row.depth = cfg.maxInFlight;
+	row.elapsedSec = elapsedSec;
+	row.recvMessages = recv;
+	row.recvBytes = rbytes;
+	row.pctUs = pctUs;
+	row.workNs = workNs;
+	row.hist = merged.get();
+	row.intervals = move(intervals.samples);
+	appendExtra(row.extra, "payload", slots ? "slab" : "copy");
+	if (cfg.rate > 0.0) appendExtra(row.extra, "rate", formatDouble(cfg.rate));
+	appendOccupancyExtras(row.extra, occupancy, 1, recv / elapsedSec);
+	appendExtra(row.extra, "peakRssKiB", to_string(peakRss));
+	appendResultRow(cfg, row);
 
 	return 0;
 }
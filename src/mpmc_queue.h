@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "bench_core.h"
+
+// Lock-free hand-off pieces shared by the Linux shm ring (shm_benchmark) and
+// the work-stealing pool (steal_benchmark): Vyukov's bounded MPMC protocol,
+// a heap-backed queue built on it, and a futex event to park on.
+
+// Vyukov's bounded MPMC protocol. Positions only grow (cell = pos % capacity)
+// and each cell's seq says whose turn it is: pos when the cell is free for the
+// producer at pos, pos + 1 when it holds that producer's value. claim
+// reserves a position (false when the queue is full / empty); the caller then
+// moves the value and releases the cell with seq = pos + 1 after a push, or
+// pos + capacity after a pop. seqAt(pos) returns the seq of pos's cell, so the
+// cells can live anywhere (a shared segment with variable-size slots, or an
+// array).
+template <typename SeqAt>
+inline bool vyukovClaimPush(std::atomic<uint64_t>& tail, SeqAt seqAt, uint64_t& pos) {
+	pos = tail.load(std::memory_order_relaxed);
+	for (;;) {
+		uint64_t seq = seqAt(pos).load(std::memory_order_acquire);
+		int64_t diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+		if (diff == 0) {
+			if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return true;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = tail.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+template <typename SeqAt>
+inline bool vyukovClaimPop(std::atomic<uint64_t>& head, SeqAt seqAt, uint64_t& pos) {
+	pos = head.load(std::memory_order_relaxed);
+	for (;;) {
+		uint64_t seq = seqAt(pos).load(std::memory_order_acquire);
+		int64_t diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos + 1);
+		if (diff == 0) {
+			if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return true;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = head.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+// Bounded lock-free MPMC queue of T on the protocol above, capacity rounded
+// up to a power of two. Everyone takes from the head, so the oldest value
+// goes first.
+template <typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t capacity) {
+		size_t n = 1;
+		while (n < capacity) n <<= 1;
+		mask_ = n - 1;
+		cells_.reset(new Cell[n]);
+		for (size_t i = 0; i < n; ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	bool push(const T& value) {
+		uint64_t pos = 0;
+		if (!vyukovClaimPush(tail_, [&](uint64_t p) -> std::atomic<uint64_t>& { return cells_[p & mask_].seq; }, pos))
+			return false;
+		Cell& cell = cells_[pos & mask_];
+		cell.value = value;
+		cell.seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& out) {
+		uint64_t pos = 0;
+		if (!vyukovClaimPop(head_, [&](uint64_t p) -> std::atomic<uint64_t>& { return cells_[p & mask_].seq; }, pos))
+			return false;
+		Cell& cell = cells_[pos & mask_];
+		out = cell.value;
+		cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const {
+		return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire);
+	}
+
+	size_t size() const {
+		uint64_t head = head_.load(std::memory_order_acquire);
+		uint64_t tail = tail_.load(std::memory_order_acquire);
+		return tail > head ? static_cast<size_t>(tail - head) : 0;
+	}
+
+private:
+	struct Cell {
+		std::atomic<uint64_t> seq{0};
+		T value{};
+	};
+
+	size_t mask_ = 0;
+	std::unique_ptr<Cell[]> cells_;
+	alignas(64) std::atomic<uint64_t> head_{0};
+	alignas(64) std::atomic<uint64_t> tail_{0};
+};
+
+// Futex-backed event. Waiters register before re-checking their condition and
+// notifiers only pay for a syscall when someone is registered; the seq_cst
+// fence on both sides closes the lost-wakeup window. processShared selects
+// the plain futex ops (an event in a segment several processes map) over the
+// cheaper FUTEX_*_PRIVATE ones.
+struct alignas(64) FutexEvent {
+	std::atomic<uint32_t> seq{0};
+	std::atomic<uint32_t> waiters{0};
+	bool processShared = true;
+
+	explicit FutexEvent(bool shared = true) : processShared(shared) {}
+};
+
+// Spins up to spins times on ready(), then sleeps on ev until notified or
+// timeoutNs passes. Returns false if the wait timed out.
+template <typename Ready>
+inline bool eventWait(FutexEvent& ev, uint64_t timeoutNs, int spins, Ready ready) {
+	for (int i = 0; i < spins; ++i) {
+		if (ready()) return true;
+		cpuRelax();
+	}
+	ev.waiters.fetch_add(1, std::memory_order_seq_cst);
+	uint32_t seen = ev.seq.load(std::memory_order_seq_cst);
+	bool ok = true;
+	if (!ready()) {
+		timespec timeout{static_cast<time_t>(timeoutNs / 1000000000ull), static_cast<long>(timeoutNs % 1000000000ull)};
+		long ret = syscall(SYS_futex, reinterpret_cast<uint32_t*>(&ev.seq), ev.processShared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE,
+		                   seen, &timeout, nullptr, 0);
+		ok = !(ret == -1 && errno == ETIMEDOUT);
+	}
+	ev.waiters.fetch_sub(1, std::memory_order_relaxed);
+	return ok;
+}
+
+inline void eventNotify(FutexEvent& ev) {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (ev.waiters.load(std::memory_order_relaxed) == 0) return;
+	ev.seq.fetch_add(1, std::memory_order_seq_cst);
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(&ev.seq), ev.processShared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, INT_MAX,
+	        nullptr, nullptr, 0);
+}
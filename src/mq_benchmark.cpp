@@ -1,7 +1,9 @@
 #include <atomic>
 #include <chrono>
 #include <csignal>
+#include <cmath>
 #include <cstdint>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -10,98 +12,485 @@
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <random>
 #include <string>
 #include <thread>
 #include <vector>
+#include <condition_variable>
+#include <deque>
+#include <sstream>
 #include <mqueue.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
 #include <fstream>
-#include <sstream>
+
+#include "bench_core.h"
+#include "crc32c.h"
+#include "payload_fill.h"
+#include "placement.h"
 
 using namespace std;
 
-struct Config {
+// --priority-mix PRIO:PCT[,PRIO:PCT...]: each listed mq priority gets PCT percent
+// of the messages and the remainder goes out at priority 0. Class 0 is always
+// the priority-0 bulk traffic; consumers map a received prio back to its class
+// so latency can be kept per class.
+struct PriorityMix {
+	vector<unsigned> prios{0};
+	vector<double> shares{1.0};
+
+	size_t classes() const { return prios.size(); }
+
+	// u uniform in [0,1): listed classes first, bulk takes what is left.
+	size_t pick(double u) const {
+		for (size_t k = 1; k < prios.size(); ++k) {
+			if (u < shares[k]) return k;
+			u -= shares[k];
+		}
+		return 0;
+	}
+
+	size_t classFor(unsigned prio) const {
+		for (size_t k = 1; k < prios.size(); ++k) {
+			if (prios[k] == prio) return k;
+		}
+		return 0;
+	}
+
+	static bool parse(const string& spec, PriorityMix& out) {
+		out = PriorityMix();
+		stringstream ss(spec);
+		string item;
+		double listed = 0.0;
+		while (getline(ss, item, ',')) {
+			size_t colon = item.find(':');
+			if (colon == string::npos) return false;
+			char* end = nullptr;
+			long prio = strtol(item.c_str(), &end, 10);
+			if (end != item.c_str() + colon || prio <= 0) return false;
+			double pct = strtod(item.c_str() + colon + 1, &end);
+			if (*end != '\0' || pct <= 0.0) return false;
+			if (find(out.prios.begin(), out.prios.end(), static_cast<unsigned>(prio)) != out.prios.end()) return false;
+			out.prios.push_back(static_cast<unsigned>(prio));
+			out.shares.push_back(pct / 100.0);
+			listed += pct / 100.0;
+		}
+		if (out.prios.size() < 2 || listed > 1.0) return false;
+		out.shares[0] = 1.0 - listed;
+		return true;
+	}
+};
+
+// --size-dist: per-message payload size, with --message-size as the maximum
+// (and the mq_msgsize the consumer receives into).
+//   fixed                      every message is message-size bytes
+//   uniform:MIN-MAX            uniform in [MIN, MAX]
+//   bimodal:MIN-MAX,MIN-MAX,P  second range with probability P percent
+//   lognormal:MEDIAN,SIGMA     exp(N(ln MEDIAN, SIGMA)), clamped to [1, max]
+//   file:PATH                  "SIZE WEIGHT" lines, '#' starts a comment
+struct SizeDist {
+	string kind = "fixed";
+	size_t lo[2] = {0, 0};
+	size_t hi[2] = {0, 0};
+	double second = 0.0;
+	double median = 0.0;
+	double sigma = 0.0;
+	vector<size_t> sizes;
+	vector<double> cumulative;
+
+	bool variable() const { return kind != "fixed"; }
+
+	size_t sample(mt19937_64& rng, size_t maxSize) const {
+		if (kind == "uniform" || kind == "bimodal") {
+			int r = (kind == "bimodal" && uniform_real_distribution<double>(0.0, 1.0)(rng) < second) ? 1 : 0;
+			return uniform_int_distribution<size_t>(lo[r], hi[r])(rng);
+		}
+		if (kind == "lognormal") {
+			double v = lognormal_distribution<double>(log(median), sigma)(rng);
+			return static_cast<size_t>(min(max(v, 1.0), static_cast<double>(maxSize)));
+		}
+		if (kind == "file") {
+			double u = uniform_real_distribution<double>(0.0, cumulative.back())(rng);
+			size_t k = static_cast<size_t>(upper_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin());
+			return sizes[min(k, sizes.size() - 1)];
+		}
+		return maxSize;
+	}
+
+	// Every size the distribution can produce must lie in [1, maxSize].
+	static bool parse(const string& spec, size_t maxSize, SizeDist& out, string& error) {
+		out = SizeDist();
+		size_t colon = spec.find(':');
+		out.kind = spec.substr(0, colon);
+		string args = colon == string::npos ? "" : spec.substr(colon + 1);
+		auto range = [&](const string& r, size_t& a, size_t& b) {
+			return sscanf(r.c_str(), "%zu-%zu", &a, &b) == 2 && a >= 1 && a <= b && b <= maxSize;
+		};
+		if (out.kind == "fixed") return true;
+		if (out.kind == "uniform") {
+			if (range(args, out.lo[0], out.hi[0])) return true;
+			error = "uniform:MIN-MAX with 1 <= MIN <= MAX <= message-size";
+			return false;
+		}
+		if (out.kind == "bimodal") {
+			stringstream ss(args);
+			string a, b, pct;
+			getline(ss, a, ',');
+			getline(ss, b, ',');
+			getline(ss, pct);
+			out.second = atof(pct.c_str()) / 100.0;
+			if (range(a, out.lo[0], out.hi[0]) && range(b, out.lo[1], out.hi[1]) && out.second > 0.0 && out.second < 1.0) return true;
+			error = "bimodal:MIN-MAX,MIN-MAX,PCT with ranges within message-size and 0 < PCT < 100";
+			return false;
+		}
+		if (out.kind == "lognormal") {
+			if (sscanf(args.c_str(), "%lf,%lf", &out.median, &out.sigma) == 2 && out.median >= 1.0 &&
+			    out.median <= static_cast<double>(maxSize) && out.sigma > 0.0) return true;
+			error = "lognormal:MEDIAN,SIGMA with 1 <= MEDIAN <= message-size and SIGMA > 0";
+			return false;
+		}
+		if (out.kind == "file") {
+			ifstream in(args);
+			if (!in.good()) {
+				error = "cannot read size histogram " + args;
+				return false;
+			}
+			string line;
+			double total = 0.0;
+			while (getline(in, line)) {
+				line = line.substr(0, line.find('#'));
+				size_t size = 0;
+				double weight = 0.0;
+				int fields = sscanf(line.c_str(), "%zu %lf", &size, &weight);
+				if (fields <= 0) continue;
+				if (fields != 2 || size < 1 || size > maxSize || weight < 0.0) {
+					error = "bad size histogram line '" + line + "' (SIZE WEIGHT, SIZE <= message-size)";
+					return false;
+				}
+				total += weight;
+				out.sizes.push_back(size);
+				out.cumulative.push_back(total);
+			}
+			if (total > 0.0) return true;
+			error = "size histogram " + args + " has no positive weights";
+			return false;
+		}
+		error = "size-dist must be fixed, uniform:, bimodal:, lognormal: or file:";
+		return false;
+	}
+};
+
+// Power-of-two size buckets for per-size reporting: bucket b holds sizes in
+// [2^b, 2^(b+1)).
+static size_t sizeBucketFor(size_t len) {
+	return len ? static_cast<size_t>(63 - __builtin_clzll(len)) : 0;
+}
+
+struct Config : BenchConfig {
 	string queueName = "/mq_bench";
-	int durationSeconds = 5;
-	size_t messageSize = 256;
+	int queues = 1;
+	string routing = "round-robin";
 	long maxMessages = 1024;
-	int producers = 1;
-	int consumers = 1;
 	bool unlinkAtStart = true;
 	bool unlinkAtEnd = true;
 	bool nonBlocking = false;
-	bool randomPayload = false;
-	size_t latencySample = 100000;
-	int printIntervalSeconds = 1;
-	string csvPath = "";
+	bool processMode = false;
+	int batch = 1;
+	int pingPong = 0;
+	int stages = 1;
+	string stageConsumers = "";
+	vector<long> stageReaders; // parsed from stageConsumers, one count per stage
+	string consumerWait = "timed";
+	string backoff = "sleep";
+	int spinLimit = 1000;
+	bool verify = false;
+	bool perf = false;
+	string placement = "none";
+	string producerCpus = "";
+	string consumerCpus = "";
+	string priorityMix = "";
+	PriorityMix priorities;
+	string sizeDist = "fixed";
+	SizeDist sizes;
+	int warmupSeconds = 0;
+	string intervalCsvPath = "";
+	int occupancyIntervalUs = 1000;
+	bool sweep = false;
+	string sweepMaxMessages = "";
+	string sweepSizes = "";
+	string sweepProducers = "";
+	string sweepConsumers = "";
+	double sweepTolerance = 2.0;
+	int sweepWindow = 4;
+	bool autotune = false;
+	int repeat = 1;
+	int repeatIndex = 0; // set per run, not an option
+	string comparePath = "";
+	double regressThresholdPct = 5.0;
 };
 
-static atomic<bool> stopFlag{false};
-
-static inline uint64_t nowNs() {
-	timespec ts;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
-}
+// Set by SIGINT/SIGTERM only; --sweep resets stopFlag between points.
+static atomic<bool> interrupted{false};
 
 static void onSignal(int) {
+	interrupted.store(true, memory_order_relaxed);
 	stopFlag.store(true, memory_order_relaxed);
 }
 
-struct MsgHeader {
-	uint64_t sequence;
-	uint64_t sendTimeNs;
+// Checksum of one record: the header up to the checksum field, then the payload.
+static uint32_t recordChecksum(const uint8_t* record, size_t len) {
+	uint32_t crc = crc32cUpdate(0, record, offsetof(MsgHeader, checksum));
+	return crc32cUpdate(crc, record + sizeof(MsgHeader), len - sizeof(MsgHeader));
+}
+
+// What one consumer saw from one producer under --verify. Each consumer takes
+// messages in queue order, so within its share a producer's sequence only
+// rises (priorities aside); summed over consumers, count versus highest
+// sequence gives messages lost below that point.
+struct VerifyState {
+	uint64_t count = 0;
+	uint64_t maxSeq = 0;
+	uint64_t reordered = 0;
 };
 
-struct Stats {
-	atomic<uint64_t> sentMessages{0};
-	atomic<uint64_t> sentBytes{0};
-	atomic<uint64_t> recvMessages{0};
-	atomic<uint64_t> recvBytes{0};
-	atomic<uint64_t> sendErrors{0};
-	atomic<uint64_t> recvErrors{0};
-	atomic<uint64_t> sendEagain{0};
-	atomic<uint64_t> recvEagain{0};
+// The shared ThreadCounters plus the mqueue backend's syscall, wakeup, backoff,
+// --verify, --ping-pong and --perf counts, under the same owner-writes rule.
+struct alignas(64) MqCounters : ThreadCounters {
+	atomic<uint64_t> syscalls{0};
+	atomic<uint64_t> wakeups{0};
+	atomic<uint64_t> spins{0};
+	atomic<uint64_t> yields{0};
+	atomic<uint64_t> sleeps{0};
+	atomic<uint64_t> corrupt{0};
+	atomic<uint64_t> replies{0}; // --ping-pong clients: round trips completed
+	// --perf: this thread's hardware/software event counts, stored once when
+	// it exits. perfMissing has bit e set when event e could not be opened;
+	// perfUserOnly when it had to fall back to exclude_kernel.
+	atomic<uint64_t> perfEvents[5] = {};
+	atomic<uint64_t> perfMissing{0};
+	atomic<uint64_t> perfUserOnly{0};
+
+	// Applies f(mine, theirs) to every counter pair (snapshots and deltas).
+	template <typename F>
+	void forEach(const MqCounters& other, F f) {
+		f(messages, other.messages);
+		f(bytes, other.bytes);
+		f(errors, other.errors);
+		f(eagain, other.eagain);
+		f(syscalls, other.syscalls);
+		f(wakeups, other.wakeups);
+		f(spins, other.spins);
+		f(yields, other.yields);
+		f(sleeps, other.sleeps);
+		f(corrupt, other.corrupt);
+		f(replies, other.replies);
+		f(workNs, other.workNs);
+		for (int e = 0; e < 5; ++e) f(perfEvents[e], other.perfEvents[e]);
+		f(perfMissing, other.perfMissing);
+		f(perfUserOnly, other.perfUserOnly);
+	}
 };
 
-struct LatencyRecorder {
-	vector<uint64_t> samplesNs;
-	size_t capacity;
-	mutex mtx;
-	mt19937_64 rng;
-	atomic<uint64_t> seen{0};
+static vector<MqCounters> snapshotSlots(const MqCounters* slots, int n) {
+	vector<MqCounters> out(static_cast<size_t>(n));
+	for (int i = 0; i < n; ++i) {
+		out[static_cast<size_t>(i)].forEach(slots[i], [](atomic<uint64_t>& mine, const atomic<uint64_t>& theirs) {
+			mine.store(theirs.load(memory_order_relaxed), memory_order_relaxed);
+		});
+	}
+	return out;
+}
+
+// Turns a snapshot of slots into "slots minus base". The perf flag words are
+// bitmasks, not counts, and are kept as they are.
+static void subtractSlots(vector<MqCounters>& slots, const vector<MqCounters>& base) {
+	for (size_t i = 0; i < slots.size(); ++i) {
+		uint64_t missing = slots[i].perfMissing.load(memory_order_relaxed);
+		uint64_t userOnly = slots[i].perfUserOnly.load(memory_order_relaxed);
+		slots[i].forEach(base[i], [](atomic<uint64_t>& mine, const atomic<uint64_t>& theirs) {
+			mine.store(mine.load(memory_order_relaxed) - theirs.load(memory_order_relaxed), memory_order_relaxed);
+		});
+		slots[i].perfMissing.store(missing, memory_order_relaxed);
+		slots[i].perfUserOnly.store(userOnly, memory_order_relaxed);
+	}
+}
+
+// Stats plus the sums of the MqCounters-only fields.
+struct MqStats : Stats {
+	uint64_t sendSyscalls = 0;
+	uint64_t recvSyscalls = 0;
+	uint64_t recvWakeups = 0;
+	uint64_t spins = 0;
+	uint64_t yields = 0;
+	uint64_t sleeps = 0;
+	uint64_t corrupt = 0;
+	uint64_t roundTrips = 0;
+	uint64_t perfEvents[5] = {};
+	uint64_t perfMissing = 0;
+	uint64_t perfUserOnly = 0;
+};
+
+static MqStats sumMqCounters(const MqCounters* producerSlots, int producers,
+                             const MqCounters* consumerSlots, int consumers) {
+	MqStats s;
+	addCounters(s, producerSlots, producers, consumerSlots, consumers);
+	for (int i = 0; i < producers; ++i) {
+		s.sendSyscalls += producerSlots[i].syscalls.load(memory_order_relaxed);
+		s.roundTrips += producerSlots[i].replies.load(memory_order_relaxed);
+	}
+	auto addBackoff = [&](const MqCounters& c) {
+		s.spins += c.spins.load(memory_order_relaxed);
+		s.yields += c.yields.load(memory_order_relaxed);
+		s.sleeps += c.sleeps.load(memory_order_relaxed);
+	};
+	auto addPerf = [&](const MqCounters& c) {
+		for (int e = 0; e < 5; ++e) s.perfEvents[e] += c.perfEvents[e].load(memory_order_relaxed);
+		s.perfMissing |= c.perfMissing.load(memory_order_relaxed);
+		s.perfUserOnly |= c.perfUserOnly.load(memory_order_relaxed);
+	};
+	for (int i = 0; i < producers; ++i) addPerf(producerSlots[i]);
+	for (int i = 0; i < consumers; ++i) addPerf(consumerSlots[i]);
+	for (int i = 0; i < producers; ++i) addBackoff(producerSlots[i]);
+	for (int i = 0; i < consumers; ++i) addBackoff(consumerSlots[i]);
+	for (int i = 0; i < consumers; ++i) {
+		s.recvSyscalls += consumerSlots[i].syscalls.load(memory_order_relaxed);
+		s.recvWakeups += consumerSlots[i].wakeups.load(memory_order_relaxed);
+		s.corrupt += consumerSlots[i].corrupt.load(memory_order_relaxed);
+	}
+	return s;
+}
+
+// What a producer or consumer does after EAGAIN/ETIMEDOUT before retrying.
+// sleep:  fixed 50 us sleep (the original behaviour)
+// spin:   one pause instruction, then retry
+// exp:    2^attempt pause instructions, capped at 2^12
+// hybrid: spin-limit pause retries, then up to 100 yields, then 50 us sleeps
+// Every successful call resets the attempt counter.
+struct Backoff {
+	enum class Policy { Sleep, Spin, Exponential, Hybrid };
+	static constexpr unsigned kMaxShift = 12;
+	static constexpr unsigned kYields = 100;
+
+	Policy policy;
+	unsigned spinLimit;
+	MqCounters& counters;
+	unsigned attempt = 0;
 
-	explicit LatencyRecorder(size_t cap)
-	    : capacity(cap), rng(random_device{}()) {
-		samplesNs.reserve(capacity);
+	Backoff(const string& name, int limit, MqCounters& c)
+	    : policy(parse(name)), spinLimit(static_cast<unsigned>(limit)), counters(c) {}
+
+	static bool valid(const string& name) {
+		return name == "sleep" || name == "spin" || name == "exp" || name == "hybrid";
 	}
 
-	void record(uint64_t valueNs) {
-		uint64_t index = seen.fetch_add(1, memory_order_relaxed);
-		if (capacity == 0) return;
-		if (index < capacity) {
-			lock_guard<mutex> lock(mtx);
-			if (samplesNs.size() < capacity) {
-				samplesNs.push_back(valueNs);
+	static Policy parse(const string& name) {
+		if (name == "spin") return Policy::Spin;
+		if (name == "exp") return Policy::Exponential;
+		if (name == "hybrid") return Policy::Hybrid;
+		return Policy::Sleep;
+	}
+
+	void reset() { attempt = 0; }
+
+	void wait() {
+		unsigned n = attempt++;
+		switch (policy) {
+		case Policy::Sleep:
+			sleep();
+			break;
+		case Policy::Spin:
+			cpuRelax();
+			MqCounters::bump(counters.spins);
+			break;
+		case Policy::Exponential: {
+			unsigned pauses = 1u << min(n, kMaxShift);
+			for (unsigned i = 0; i < pauses; ++i) cpuRelax();
+			MqCounters::bump(counters.spins, pauses);
+			break;
+		}
+		case Policy::Hybrid:
+			if (n < spinLimit) {
+				cpuRelax();
+				MqCounters::bump(counters.spins);
+			} else if (n < spinLimit + kYields) {
+				this_thread::yield();
+				MqCounters::bump(counters.yields);
 			} else {
-				uniform_int_distribution<uint64_t> dist(0, index);
-				uint64_t pos = dist(rng);
-				if (pos < capacity) {
-					samplesNs[pos] = valueNs;
-				}
+				sleep();
 			}
-			return;
+			break;
 		}
-		uniform_int_distribution<uint64_t> dist(0, index);
-		uint64_t pos = dist(rng);
-		if (pos < capacity) {
-			lock_guard<mutex> lock(mtx);
-			if (pos < samplesNs.size()) {
-				samplesNs[pos] = valueNs;
+	}
+
+private:
+	void sleep() {
+		this_thread::sleep_for(chrono::microseconds(50));
+		MqCounters::bump(counters.sleeps);
+	}
+};
+
+// --perf: per-thread perf_event_open counters for the calling thread, opened
+// when a worker starts and stored into its slot when it returns. Counting
+// includes the kernel (the mq syscalls are most of the work) when
+// perf_event_paranoid allows it, otherwise user space only. Events a VM or
+// kernel does not expose are reported as n/a.
+static const char* const kPerfEventNames[5] = {"cycles", "instructions", "cache-misses", "ctx-switches", "migrations"};
+
+struct PerfScope {
+	MqCounters* counters = nullptr;
+	int fds[5] = {-1, -1, -1, -1, -1};
+
+	PerfScope(bool enabled, MqCounters& c) {
+		if (!enabled) return;
+		counters = &c;
+#ifdef __linux__
+		static const uint32_t types[5] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+		                                  PERF_TYPE_SOFTWARE, PERF_TYPE_SOFTWARE};
+		static const uint64_t configs[5] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+		                                    PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_CPU_MIGRATIONS};
+		uint64_t missing = 0;
+		uint64_t userOnly = 0;
+		for (int e = 0; e < 5; ++e) {
+			perf_event_attr attr{};
+			attr.size = sizeof(attr);
+			attr.type = types[e];
+			attr.config = configs[e];
+			attr.exclude_hv = 1;
+			fds[e] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+			if (fds[e] < 0 && (errno == EACCES || errno == EPERM)) {
+				attr.exclude_kernel = 1;
+				fds[e] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+				if (fds[e] >= 0) userOnly |= uint64_t(1) << e;
+			}
+			if (fds[e] < 0) missing |= uint64_t(1) << e;
+		}
+		c.perfMissing.store(missing, memory_order_relaxed);
+		c.perfUserOnly.store(userOnly, memory_order_relaxed);
+#else
+		c.perfMissing.store(0x1F, memory_order_relaxed);
+#endif
+	}
+
+	~PerfScope() {
+		for (int e = 0; e < 5; ++e) {
+			if (fds[e] < 0) continue;
+			uint64_t value = 0;
+			if (read(fds[e], &value, sizeof(value)) == static_cast<ssize_t>(sizeof(value))) {
+				counters->perfEvents[e].store(value, memory_order_relaxed);
 			}
+			close(fds[e]);
 		}
 	}
 };
@@ -109,6 +498,7 @@ struct LatencyRecorder {
 static void printConfig(const Config& cfg) {
 	cout << "Configuration:\n";
 	cout << "  queue-name:           " << cfg.queueName << "\n";
+	if (cfg.queues > 1) cout << "  queues:               " << cfg.queues << " (routing " << cfg.routing << ")\n";
 	cout << "  duration-seconds:     " << cfg.durationSeconds << "\n";
 	cout << "  message-size:         " << cfg.messageSize << "\n";
 	cout << "  max-messages:         " << cfg.maxMessages << "\n";
@@ -118,11 +508,51 @@ static void printConfig(const Config& cfg) {
 	cout << "  unlink-at-end:        " << (cfg.unlinkAtEnd ? "true" : "false") << "\n";
 	cout << "  non-blocking:         " << (cfg.nonBlocking ? "true" : "false") << "\n";
 	cout << "  random-payload:       " << (cfg.randomPayload ? "true" : "false") << "\n";
-	cout << "  latency-sample:       " << cfg.latencySample << "\n";
+	cout << "  process-mode:         " << (cfg.processMode ? "true" : "false") << "\n";
+	cout << "  batch:                " << cfg.batch << "\n";
+	if (cfg.pingPong > 0) cout << "  ping-pong:            " << cfg.pingPong << " in flight per client\n";
+	if (cfg.stages > 1) {
+		cout << "  stages:               " << cfg.stages << " (readers "
+		     << (cfg.stageConsumers.empty() ? to_string(cfg.consumers) + " each" : cfg.stageConsumers) << ")\n";
+	}
+	cout << "  consumer-wait:        " << cfg.consumerWait << "\n";
+	cout << "  backoff:              " << cfg.backoff << " (spin-limit " << cfg.spinLimit << ")\n";
+	cout << "  perf:                 " << (cfg.perf ? "true" : "false") << "\n";
+	cout << "  verify:               " << (cfg.verify ? string("crc32c (") + crc32cImplementation() + ")" : string("false")) << "\n";
+	cout << "  rate:                 " << (cfg.rate > 0.0 ? to_string(cfg.rate) : string("closed-loop")) << "\n";
+	cout << "  placement:            " << cfg.placement << "\n";
+	if (!cfg.producerCpus.empty()) cout << "  producer-cpus:        " << cfg.producerCpus << "\n";
+	if (!cfg.consumerCpus.empty()) cout << "  consumer-cpus:        " << cfg.consumerCpus << "\n";
+	cout << "  size-dist:            " << cfg.sizeDist << "\n";
+	if (!cfg.priorityMix.empty()) cout << "  priority-mix:         " << cfg.priorityMix << "\n";
+	cout << "  latency-sample:       " << (cfg.latencySample ? "every message" : "off") << "\n";
+	cout << "  clock:                " << cfg.clock << "\n";
+	cout << "  work:                 " << cfg.work << "\n";
 	cout << "  print-interval-s:     " << cfg.printIntervalSeconds << "\n";
+	cout << "  warmup-seconds:       " << cfg.warmupSeconds << "\n";
+	cout << "  occupancy-interval:   " << (cfg.occupancyIntervalUs > 0 ? to_string(cfg.occupancyIntervalUs) + " us" : string("off")) << "\n";
+	if (!cfg.intervalCsvPath.empty()) {
+		cout << "  interval-csv:         " << cfg.intervalCsvPath << "\n";
+	}
 	if (!cfg.csvPath.empty()) {
 		cout << "  csv-path:             " << cfg.csvPath << "\n";
 	}
+	if (!cfg.resultsPath.empty()) {
+		cout << "  results-path:         " << cfg.resultsPath << "\n";
+	}
+	if (cfg.autotune) cout << "  autotune:             true (depth x size from system limits)\n";
+	if (cfg.sweep && !cfg.autotune) {
+		auto axis = [](const string& list, long single) { return list.empty() ? to_string(single) : list; };
+		cout << "  sweep:                max-messages=" << axis(cfg.sweepMaxMessages, cfg.maxMessages)
+		     << " sizes=" << axis(cfg.sweepSizes, static_cast<long>(cfg.messageSize))
+		     << " producers=" << axis(cfg.sweepProducers, cfg.producers)
+		     << " consumers=" << axis(cfg.sweepConsumers, cfg.consumers)
+		     << " (tolerance " << cfg.sweepTolerance << "%, window " << cfg.sweepWindow << ")\n";
+	}
+	if (cfg.repeat > 1) cout << "  repeat:               " << cfg.repeat << "\n";
+	if (!cfg.comparePath.empty()) {
+		cout << "  compare:              " << cfg.comparePath << " (threshold " << cfg.regressThresholdPct << "%)\n";
+	}
 	cout.flush();
 }
 
@@ -130,6 +560,8 @@ static void usage(const char* argv0) {
 	cerr << "Usage: " << argv0 << " [options]\n";
 	cerr << "Options:\n";
 	cerr << "  --queue-name NAME          Default /mq_bench\n";
+	cerr << "  --queues K                 Default 1; shard over NAME.0..NAME.K-1, consumers own queues c, c+C, ...\n";
+	cerr << "  --routing POLICY           round-robin|hash|affinity, default round-robin (producer -> queue with --queues)\n";
 	cerr << "  --duration-seconds N       Default 5\n";
 	cerr << "  --message-size N           Default 256 (<= system msgsize_max)\n";
 	cerr << "  --max-messages N           Default 1024 (<= system msg_max)\n";
@@ -139,13 +571,45 @@ static void usage(const char* argv0) {
 	cerr << "  --unlink-end true|false    Default true\n";
 	cerr << "  --nonblocking true|false   Default false\n";
 	cerr << "  --random-payload true|false Default false\n";
-	cerr << "  --latency-sample N         Default 100000\n";
+	cerr << "  --process-mode true|false  Default false (fork producers/consumers as processes)\n";
+	cerr << "  --batch N                  Default 1 (records of message-size packed per mq message)\n";
+	cerr << "  --ping-pong K              Default 0 (off); producers are clients with K requests in flight, consumers\n";
+	cerr << "                             echo each to NAME.reply.<client>; latency is the round trip\n";
+	cerr << "  --stages S                 Default 1; chain NAME.stage0..NAME.stage<S-1>, stage k readers forward to k+1\n";
+	cerr << "  --stage-consumers LIST     Readers per stage, e.g. 2,1,4 (default --consumers for every stage)\n";
+	cerr << "  --consumer-wait MODE       timed|epoll|notify, default timed (mq_timedreceive loop)\n";
+	cerr << "  --backoff POLICY           sleep|spin|exp|hybrid after EAGAIN, default sleep (50us)\n";
+	cerr << "  --spin-limit N             Default 1000 (hybrid: pause retries before yielding)\n";
+	cerr << "  --perf true|false          Default false (perf_event_open cycles/instructions/cache-misses/ctx-switches/migrations per thread)\n";
+	cerr << "  --verify true|false        Default false (CRC32C per record, per-producer gap/reorder tracking)\n";
+	cerr << "  --rate MSGS_PER_SEC        Default 0 (closed loop); total open-loop rate split across producers\n";
+	cerr << "  --placement POLICY         none|smt|socket|cross-socket, default none (pin by sysfs topology)\n";
+	cerr << "  --producer-cpus LIST       e.g. 0,2,4-7; producer i runs on LIST[i % len] (overrides placement)\n";
+	cerr << "  --consumer-cpus LIST       Same for consumers\n";
+	cerr << "  --size-dist SPEC           fixed|uniform:MIN-MAX|bimodal:MIN-MAX,MIN-MAX,PCT|lognormal:MEDIAN,SIGMA|file:PATH\n";
+	cerr << "                             Default fixed; message-size is the maximum, results per size bucket\n";
+	cerr << "  --priority-mix SPEC        PRIO:PCT[,...], e.g. 31:5 sends 5% at prio 31, rest at 0 (latency per prio)\n";
+	cerr << "  --latency-sample 0|1       Default 1 (record every message's latency; 0 disables the histograms)\n";
+	cerr << "  --clock SOURCE             auto|tsc|monotonic, default auto (calibrated TSC/cntvct when invariant)\n";
+	cerr << "  --work KERNEL              none|memcpy[:PASSES]|hash[:PASSES]|spin:NS per message, default none\n";
 	cerr << "  --print-interval N         Default 1 (seconds)\n";
+	cerr << "  --warmup-seconds N         Default 0; run N extra seconds first and drop them from the final stats\n";
+	cerr << "  --interval-csv PATH        Append one row per print interval (delta rates, EAGAIN, p50/p99) to PATH\n";
+	cerr << "  --occupancy-interval-us N  Default 1000; sample mq_curmsgs of every queue this often (0 disables)\n";
 	cerr << "  --csv PATH                 Append CSV results to PATH\n";
-}
-
-static bool parseBool(const string& s) {
-	return s == "1" || s == "true" || s == "True" || s == "TRUE" || s == "yes" || s == "on";
+	cerr << "  --results PATH             Append a binary run record (histogram, intervals) for mq_report\n";
+	cerr << "  --sweep true|false         Default false; run every point of the --sweep-* lists in one process (threads)\n";
+	cerr << "  --sweep-max-messages LIST  e.g. 10,64; default --max-messages (likewise for the lists below)\n";
+	cerr << "  --sweep-sizes LIST         e.g. 64,256,1024,4096,8192\n";
+	cerr << "  --sweep-producers LIST     e.g. 1,2,4\n";
+	cerr << "  --sweep-consumers LIST     e.g. 1,2,4\n";
+	cerr << "  --sweep-tolerance PCT      Default 2; a point ends once the last window samples are within PCT of their mean\n";
+	cerr << "  --sweep-window N           Default 4 (samples of 250 ms); duration-seconds caps each point\n";
+	cerr << "  --autotune true|false      Default false; sweep max-messages x message-size within msg_max, msgsize_max\n";
+	cerr << "                             and RLIMIT_MSGQUEUE and print the msg/s-vs-p99 Pareto frontier per size\n";
+	cerr << "  --repeat N                 Default 1; run each configuration N times, report mean/stddev/bootstrap CI\n";
+	cerr << "  --compare PATH             Compare msg/s and p99 against matching rows of a baseline CSV; exit 3 on regression\n";
+	cerr << "  --regress-threshold PCT    Default 5; smallest significant change that counts as a regression\n";
 }
 
 static Config parseArgs(int argc, char** argv) {
@@ -159,19 +623,44 @@ static Config parseArgs(int argc, char** argv) {
 				exit(1);
 			}
 		};
+		auto value = [&]() -> const char* { need(arg); return argv[++i]; };
+		if (parseCommonOption(cfg, arg, value)) continue;
 		if (arg == "--queue-name") { need(arg); cfg.queueName = argv[++i]; }
-		else if (arg == "--duration-seconds") { need(arg); cfg.durationSeconds = stoi(argv[++i]); }
-		else if (arg == "--message-size") { need(arg); cfg.messageSize = static_cast<size_t>(stoll(argv[++i])); }
+		else if (arg == "--queues") { need(arg); cfg.queues = stoi(argv[++i]); }
+		else if (arg == "--routing") { need(arg); cfg.routing = argv[++i]; }
 		else if (arg == "--max-messages") { need(arg); cfg.maxMessages = stol(argv[++i]); }
-		else if (arg == "--producers") { need(arg); cfg.producers = stoi(argv[++i]); }
-		else if (arg == "--consumers") { need(arg); cfg.consumers = stoi(argv[++i]); }
 		else if (arg == "--unlink-start") { need(arg); cfg.unlinkAtStart = parseBool(argv[++i]); }
 		else if (arg == "--unlink-end") { need(arg); cfg.unlinkAtEnd = parseBool(argv[++i]); }
 		else if (arg == "--nonblocking") { need(arg); cfg.nonBlocking = parseBool(argv[++i]); }
-		else if (arg == "--random-payload") { need(arg); cfg.randomPayload = parseBool(argv[++i]); }
-		else if (arg == "--latency-sample") { need(arg); cfg.latencySample = static_cast<size_t>(stoll(argv[++i])); }
-		else if (arg == "--print-interval") { need(arg); cfg.printIntervalSeconds = stoi(argv[++i]); }
-		else if (arg == "--csv") { need(arg); cfg.csvPath = argv[++i]; }
+		else if (arg == "--process-mode") { need(arg); cfg.processMode = parseBool(argv[++i]); }
+		else if (arg == "--batch") { need(arg); cfg.batch = stoi(argv[++i]); }
+		else if (arg == "--ping-pong") { need(arg); cfg.pingPong = stoi(argv[++i]); }
+		else if (arg == "--stages") { need(arg); cfg.stages = stoi(argv[++i]); }
+		else if (arg == "--stage-consumers") { need(arg); cfg.stageConsumers = argv[++i]; }
+		else if (arg == "--consumer-wait") { need(arg); cfg.consumerWait = argv[++i]; }
+		else if (arg == "--backoff") { need(arg); cfg.backoff = argv[++i]; }
+		else if (arg == "--spin-limit") { need(arg); cfg.spinLimit = stoi(argv[++i]); }
+		else if (arg == "--verify") { need(arg); cfg.verify = parseBool(argv[++i]); }
+		else if (arg == "--perf") { need(arg); cfg.perf = parseBool(argv[++i]); }
+		else if (arg == "--placement") { need(arg); cfg.placement = argv[++i]; }
+		else if (arg == "--producer-cpus") { need(arg); cfg.producerCpus = argv[++i]; }
+		else if (arg == "--consumer-cpus") { need(arg); cfg.consumerCpus = argv[++i]; }
+		else if (arg == "--size-dist") { need(arg); cfg.sizeDist = argv[++i]; }
+		else if (arg == "--priority-mix") { need(arg); cfg.priorityMix = argv[++i]; }
+		else if (arg == "--warmup-seconds") { need(arg); cfg.warmupSeconds = stoi(argv[++i]); }
+		else if (arg == "--interval-csv") { need(arg); cfg.intervalCsvPath = argv[++i]; }
+		else if (arg == "--occupancy-interval-us") { need(arg); cfg.occupancyIntervalUs = stoi(argv[++i]); }
+		else if (arg == "--sweep") { need(arg); cfg.sweep = parseBool(argv[++i]); }
+		else if (arg == "--autotune") { need(arg); cfg.autotune = parseBool(argv[++i]); }
+		else if (arg == "--sweep-max-messages") { need(arg); cfg.sweepMaxMessages = argv[++i]; }
+		else if (arg == "--sweep-sizes") { need(arg); cfg.sweepSizes = argv[++i]; }
+		else if (arg == "--sweep-producers") { need(arg); cfg.sweepProducers = argv[++i]; }
+		else if (arg == "--sweep-consumers") { need(arg); cfg.sweepConsumers = argv[++i]; }
+		else if (arg == "--sweep-tolerance") { need(arg); cfg.sweepTolerance = stod(argv[++i]); }
+		else if (arg == "--sweep-window") { need(arg); cfg.sweepWindow = stoi(argv[++i]); }
+		else if (arg == "--repeat") { need(arg); cfg.repeat = stoi(argv[++i]); }
+		else if (arg == "--compare") { need(arg); cfg.comparePath = argv[++i]; }
+		else if (arg == "--regress-threshold") { need(arg); cfg.regressThresholdPct = stod(argv[++i]); }
 		else if (arg == "--help" || arg == "-h") { usage(argv[0]); exit(0); }
 		else {
 			cerr << "Unknown option: " << arg << "\n";
@@ -182,294 +671,2254 @@ static Config parseArgs(int argc, char** argv) {
 	return cfg;
 }
 
-static long readLongFromFile(const char* path, long fallback) {
-	ifstream in(path);
-	if (!in.good()) return fallback;
-	long v = fallback;
-	in >> v;
-	return in.fail() ? fallback : v;
+// Queue attributes for cfg, capped to the system limits (with a note unless
+// quiet). Lowers cfg.batch when batch x message-size does not fit msgsize_max,
+// and --ping-pong K to the depth of the reply queues.
+static void queueAttrFor(Config& cfg, mq_attr& attr, bool quiet = false) {
+	attr = mq_attr{};
+	attr.mq_flags = cfg.nonBlocking ? O_NONBLOCK : 0;
+#ifdef __linux__
+	long sys_maxmsg = readLongFromFile("/proc/sys/fs/mqueue/msg_max", 10);
+	long sys_msgsize = readLongFromFile("/proc/sys/fs/mqueue/msgsize_max", 8192);
+	long requested_maxmsg = cfg.maxMessages;
+	long requested_msgsize = static_cast<long>(cfg.messageSize) * cfg.batch;
+	if (requested_maxmsg > sys_maxmsg) {
+		if (!quiet) cerr << "Note: requested max-messages=" << requested_maxmsg
+		     << " exceeds system msg_max=" << sys_maxmsg << ", capping.\n";
+		requested_maxmsg = sys_maxmsg;
+	}
+	if (requested_msgsize > sys_msgsize) {
+		if (!quiet) cerr << "Note: requested message-size=" << requested_msgsize
+		     << " exceeds system msgsize_max=" << sys_msgsize << ", capping.\n";
+		requested_msgsize = sys_msgsize;
+	}
+	if (cfg.batch > 1 && requested_msgsize < static_cast<long>(cfg.messageSize) * cfg.batch) {
+		int fit = max(1, static_cast<int>(requested_msgsize / static_cast<long>(cfg.messageSize)));
+		if (!quiet) cerr << "Note: batch=" << cfg.batch << " x message-size=" << cfg.messageSize
+		     << " does not fit msgsize_max=" << sys_msgsize << ", using batch=" << fit << ".\n";
+		cfg.batch = fit;
+		requested_msgsize = static_cast<long>(cfg.messageSize) * fit;
+	}
+	if (requested_maxmsg < 1) requested_maxmsg = 1;
+	if (requested_msgsize < 1) requested_msgsize = 1;
+	attr.mq_maxmsg = requested_maxmsg;
+	attr.mq_msgsize = requested_msgsize;
+#else
+	attr.mq_maxmsg = cfg.maxMessages;
+	attr.mq_msgsize = static_cast<long>(cfg.messageSize) * cfg.batch;
+#endif
+	// A client never has more replies outstanding than requests in flight, so
+	// with K <= depth a server's reply send never waits on a client.
+	if (cfg.pingPong > attr.mq_maxmsg) {
+		if (!quiet) cerr << "Note: ping-pong=" << cfg.pingPong << " exceeds the reply queue depth "
+		     << attr.mq_maxmsg << ", using ping-pong=" << attr.mq_maxmsg << ".\n";
+		cfg.pingPong = static_cast<int>(attr.mq_maxmsg);
+	}
+}
+
+// --queues K: the shards are NAME.0 .. NAME.K-1 (plain NAME when K is 1).
+// Queues 0..K-1 are the request shards; with --ping-pong they are followed by
+// one reply queue per client, NAME.reply.N.
+static int queueCount(const Config& cfg) {
+	return cfg.queues + (cfg.pingPong > 0 ? cfg.producers : 0);
+}
+
+static string queueNameFor(const Config& cfg, int queue) {
+	if (queue >= cfg.queues) return cfg.queueName + ".reply." + to_string(queue - cfg.queues);
+	return cfg.queues > 1 ? cfg.queueName + "." + to_string(queue) : cfg.queueName;
+}
+
+// Consumer c owns queues c, c+C, c+2C, ...; with more consumers than queues,
+// consumer c shares queue c % K with the others mapped to it.
+static vector<int> queuesOwnedBy(const Config& cfg, int consumer) {
+	vector<int> owned;
+	if (cfg.consumers >= cfg.queues) {
+		owned.push_back(consumer % cfg.queues);
+	} else {
+		for (int q = consumer; q < cfg.queues; q += cfg.consumers) owned.push_back(q);
+	}
+	return owned;
+}
+
+// Picks the shard for a producer's next message: round-robin starts each
+// producer at its own offset, hash spreads (producer, sequence) keys with a
+// splitmix64 finalizer, affinity pins producer i to queue i % K.
+static int routeMessage(const Config& cfg, int producerId, uint64_t seq, uint64_t& rr) {
+	if (cfg.queues == 1) return 0;
+	if (cfg.routing == "affinity") return producerId % cfg.queues;
+	if (cfg.routing == "hash") {
+		uint64_t z = (static_cast<uint64_t>(producerId) << 40) ^ seq;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return static_cast<int>((z ^ (z >> 31)) % static_cast<uint64_t>(cfg.queues));
+	}
+	return static_cast<int>(rr++ % static_cast<uint64_t>(cfg.queues));
 }
 
-static void producerThread(mqd_t mq, const Config& cfg, Stats& stats, int producerId) {
-	vector<uint8_t> buffer(cfg.messageSize, 0);
-	MsgHeader* header = nullptr;
-	if (cfg.messageSize >= sizeof(MsgHeader)) {
-		header = reinterpret_cast<MsgHeader*>(buffer.data());
+// How long a blocking send or receive waits before the loop re-checks stopFlag.
+static constexpr uint64_t kWaitNs = 100 * 1000 * 1000;
+
+// One mq descriptor as a Transport. mq_timedsend/mq_timedreceive only take an
+// absolute CLOCK_REALTIME deadline, so there is no monotonic variant to switch
+// to; instead the deadline is cached and rebuilt once half the timeout has
+// passed on nowNs(), which keeps clock_gettime(CLOCK_REALTIME) off the
+// per-message path and bounds a REALTIME step to one refresh period. Each wait
+// therefore lasts between half and all of timeoutNs. A zero timeout turns into
+// an already expired deadline (ETIMEDOUT at once) and an O_NONBLOCK descriptor
+// reports EAGAIN.
+class MqTransport final : public Transport {
+public:
+	explicit MqTransport(mqd_t mq) : mq_(mq) {
+		mq_attr attr{};
+		if (mq_getattr(mq, &attr) == 0) msgsize_ = static_cast<size_t>(attr.mq_msgsize);
+	}
+
+	int send(const uint8_t* data, size_t len, unsigned prio, uint64_t timeoutNs) override {
+		const timespec& ts = deadline(timeoutNs);
+		return mq_timedsend(mq_, reinterpret_cast<const char*>(data), len, prio, &ts);
+	}
+
+	ssize_t recv(uint8_t* buf, size_t cap, unsigned* prio, uint64_t timeoutNs) override {
+		const timespec& ts = deadline(timeoutNs);
+		return mq_timedreceive(mq_, reinterpret_cast<char*>(buf), cap, prio, &ts);
+	}
+
+	size_t batch(size_t recordSize) const override {
+		return recordSize ? msgsize_ / recordSize : 0;
+	}
+
+private:
+	const timespec& deadline(uint64_t timeoutNs) {
+		static const timespec expired{};
+		if (timeoutNs == 0) return expired;
+		uint64_t now = nowNs();
+		if (timeoutNs != cachedTimeoutNs_ || now >= refreshAtNs_) {
+			clock_gettime(CLOCK_REALTIME, &cached_);
+			cached_.tv_sec += static_cast<time_t>(timeoutNs / 1000000000ull);
+			cached_.tv_nsec += static_cast<long>(timeoutNs % 1000000000ull);
+			if (cached_.tv_nsec >= 1000000000L) { cached_.tv_sec += 1; cached_.tv_nsec -= 1000000000L; }
+			cachedTimeoutNs_ = timeoutNs;
+			refreshAtNs_ = now + timeoutNs / 2;
+		}
+		return cached_;
 	}
+
+	mqd_t mq_;
+	size_t msgsize_ = 0;
+	timespec cached_{};
+	uint64_t cachedTimeoutNs_ = 0;
+	uint64_t refreshAtNs_ = 0;
+};
+
+// With --batch N every mq message carries N records of message-size bytes,
+// each with its own MsgHeader, so one syscall moves N logical messages. With
+// --size-dist (batch 1) each message draws its own size up to message-size.
+static void producerThread(const vector<mqd_t>& mqs, const Config& cfg, MqCounters& counters, int producerId) {
+	vector<MqTransport> out;
+	out.reserve(mqs.size());
+	for (mqd_t d : mqs) out.emplace_back(d);
+	size_t recordSize = cfg.messageSize;
+	// A queue kept from an earlier run (--unlink-start false) may have a smaller
+	// msgsize than this run's batch.
+	const size_t records = max<size_t>(1, min<size_t>(static_cast<size_t>(cfg.batch), out.front().batch(recordSize)));
+	size_t sendSize = recordSize * records;
+	vector<uint8_t> buffer(sendSize, 0);
+	bool hasHeader = recordSize >= sizeof(MsgHeader);
 	mt19937_64 rng(static_cast<uint64_t>(producerId) ^ 0x9e3779b97f4a7c15ull);
-	uniform_int_distribution<uint32_t> dist(0, 0xFFFFFFFFu);
+	PayloadFill filler(static_cast<uint64_t>(producerId));
+	uniform_real_distribution<double> classDist(0.0, 1.0);
+	const bool mixed = cfg.priorities.classes() > 1;
+	unsigned prio = 0;
+	Backoff backoff(cfg.backoff, cfg.spinLimit, counters);
+	Pacer pacer(cfg.rate, cfg.producers, producerId);
+	// In open-loop mode a failed send is retried with the same records, so the
+	// time spent blocked is charged to them rather than lost.
+	bool pending = false;
 	uint64_t seq = 0;
+	uint64_t rr = static_cast<uint64_t>(producerId);
+	int target = 0;
 	while (!stopFlag.load(memory_order_relaxed)) {
-		if (header) {
-			header->sequence = seq++;
-			header->sendTimeNs = nowNs();
+		if (!pending) target = routeMessage(cfg, producerId, seq, rr);
+		if (cfg.sizes.variable() && !pending) {
+			recordSize = sendSize = cfg.sizes.sample(rng, cfg.messageSize);
+			// --verify needs room for the header that carries the checksum.
+			if (cfg.verify) recordSize = sendSize = max(recordSize, sizeof(MsgHeader));
+			hasHeader = recordSize >= sizeof(MsgHeader);
 		}
-		if (cfg.randomPayload) {
-			size_t start = header ? sizeof(MsgHeader) : 0;
-			for (size_t i = start; i + sizeof(uint32_t) <= cfg.messageSize; i += sizeof(uint32_t)) {
-				uint32_t r = dist(rng);
-				memcpy(buffer.data() + i, &r, sizeof(uint32_t));
+		for (size_t r = 0; r < records && !pending; ++r) {
+			uint8_t* record = buffer.data() + r * recordSize;
+			uint64_t intended = pacer.enabled() ? pacer.next() : 0;
+			if (pacer.enabled() && r + 1 == records) Pacer::waitUntil(intended);
+			if (hasHeader) {
+				MsgHeader* header = reinterpret_cast<MsgHeader*>(record);
+				header->sequence = seq++;
+				header->sendTimeNs = nowNs();
+				header->intendedTimeNs = pacer.enabled() ? intended : header->sendTimeNs;
+				header->producerId = static_cast<uint32_t>(producerId);
+			}
+			if (cfg.randomPayload) {
+				size_t start = hasHeader ? sizeof(MsgHeader) : 0;
+				filler.fill(record + start, recordSize - start);
+			}
+			if (cfg.verify) {
+				reinterpret_cast<MsgHeader*>(record)->checksum = recordChecksum(record, recordSize);
 			}
 		}
-		timespec ts{};
-		clock_gettime(CLOCK_REALTIME, &ts);
-		ts.tv_nsec += 100 * 1000 * 1000; 
-		if (ts.tv_nsec >= 1000000000L) { ts.tv_sec += 1; ts.tv_nsec -= 1000000000L; }
-		int ret = mq_timedsend(mq, reinterpret_cast<const char*>(buffer.data()),
-		                       static_cast<unsigned>(cfg.messageSize), 0, &ts);
+		if (mixed && !pending) prio = cfg.priorities.prios[cfg.priorities.pick(classDist(rng))];
+		pending = pacer.enabled();
+		int ret = out[static_cast<size_t>(target)].send(buffer.data(), sendSize, prio, kWaitNs);
+		MqCounters::bump(counters.syscalls);
 		if (ret == 0) {
-			stats.sentMessages.fetch_add(1, memory_order_relaxed);
-			stats.sentBytes.fetch_add(cfg.messageSize, memory_order_relaxed);
+			MqCounters::bump(counters.messages, records);
+			MqCounters::bump(counters.bytes, sendSize);
+			backoff.reset();
+			pending = false;
 		} else {
 			if (errno == EAGAIN || errno == ETIMEDOUT) {
-				stats.sendEagain.fetch_add(1, memory_order_relaxed);
-				this_thread::sleep_for(chrono::microseconds(50));
+				MqCounters::bump(counters.eagain);
+				backoff.wait();
 			} else {
-				stats.sendErrors.fetch_add(1, memory_order_relaxed);
+				MqCounters::bump(counters.errors);
 				this_thread::sleep_for(chrono::microseconds(100));
 			}
 		}
 	}
 }
 
-static void consumerThread(mqd_t mq, const Config& cfg, Stats& stats, LatencyRecorder& latRecorder) {
-	vector<uint8_t> buffer(cfg.messageSize, 0);
-	MsgHeader* header = nullptr;
-	if (cfg.messageSize >= sizeof(MsgHeader)) {
-		header = reinterpret_cast<MsgHeader*>(buffer.data());
+// Receive buffer length for mq: mq_receive fails with EMSGSIZE below the
+// queue's mq_msgsize, which can exceed what cfg sends (an existing queue kept
+// by --unlink-start false), so the buffer is never smaller than that.
+static size_t recvBufferSize(mqd_t mq, size_t minimum) {
+	mq_attr attr{};
+	if (mq_getattr(mq, &attr) == 0 && attr.mq_msgsize > 0) minimum = max(minimum, static_cast<size_t>(attr.mq_msgsize));
+	return minimum;
+}
+
+// Accounts one received mq message: every record it carries and their latencies,
+// recorded in the histogram of the message's priority class.
+static void onReceived(const Config& cfg, const vector<uint8_t>& buffer, size_t len, unsigned prio,
+                       MqCounters& counters, LatencyHistogram* latHists, VerifyState* verify) {
+	const size_t recordSize = cfg.messageSize;
+	// Zero-length messages only wake consumers at the end of a --sweep point.
+	if (len == 0) return;
+	size_t records = max<size_t>(1, len / recordSize);
+	MqCounters::bump(counters.messages, records);
+	MqCounters::bump(counters.bytes, len);
+	if (cfg.workKernel.enabled()) {
+		thread_local WorkSink sink;
+		MqCounters::bump(counters.workNs, runWork(cfg.workKernel, sink, buffer.data(), len, records));
+	}
+	if (recordSize >= sizeof(MsgHeader) && cfg.latencySample) {
+		LatencyHistogram& latHist = latHists[cfg.priorities.classFor(prio)];
+		// With --size-dist the class histograms are followed by one per size bucket.
+		LatencyHistogram* sizeHist = cfg.sizes.variable() ? &latHists[cfg.priorities.classes() + sizeBucketFor(len)] : nullptr;
+		uint64_t recvNs = nowNs();
+		for (size_t off = 0; off + sizeof(MsgHeader) <= len; off += recordSize) {
+			const MsgHeader* header = reinterpret_cast<const MsgHeader*>(buffer.data() + off);
+			uint64_t sendNs = header->intendedTimeNs;
+			if (recvNs >= sendNs) {
+				latHist.record(recvNs - sendNs);
+				if (sizeHist) sizeHist->record(recvNs - sendNs);
+			}
+		}
+	}
+	if (cfg.verify) {
+		// Batched records have a fixed size, so a length that is not a multiple
+		// of it means the message was truncated.
+		const size_t recLen = cfg.sizes.variable() ? len : recordSize;
+		if (len % recLen != 0) MqCounters::bump(counters.corrupt);
+		for (size_t off = 0; off + recLen <= len; off += recLen) {
+			const uint8_t* record = buffer.data() + off;
+			const MsgHeader* header = reinterpret_cast<const MsgHeader*>(record);
+			if (header->producerId >= static_cast<uint32_t>(cfg.producers) ||
+			    recordChecksum(record, recLen) != header->checksum) {
+				MqCounters::bump(counters.corrupt);
+				continue;
+			}
+			VerifyState& v = verify[header->producerId];
+			if (v.count > 0 && header->sequence <= v.maxSeq) v.reordered++;
+			else v.maxSeq = header->sequence;
+			v.count++;
+		}
 	}
+}
+
+static void timedConsumer(mqd_t mq, const Config& cfg, MqCounters& counters, LatencyHistogram* latHists, VerifyState* verify) {
+	vector<uint8_t> buffer(recvBufferSize(mq, cfg.messageSize * static_cast<size_t>(cfg.batch)), 0);
+	Backoff backoff(cfg.backoff, cfg.spinLimit, counters);
+	MqTransport in(mq);
 	while (!stopFlag.load(memory_order_relaxed)) {
 		unsigned int prio = 0;
-		timespec ts{};
-		clock_gettime(CLOCK_REALTIME, &ts);
-		ts.tv_nsec += 100 * 1000 * 1000;
-		if (ts.tv_nsec >= 1000000000L) { ts.tv_sec += 1; ts.tv_nsec -= 1000000000L; }
-		ssize_t n = mq_timedreceive(mq, reinterpret_cast<char*>(buffer.data()),
-		                            static_cast<unsigned>(buffer.size()), &prio, &ts);
+		ssize_t n = in.recv(buffer.data(), buffer.size(), &prio, kWaitNs);
+		MqCounters::bump(counters.syscalls);
 		if (n >= 0) {
-			stats.recvMessages.fetch_add(1, memory_order_relaxed);
-			stats.recvBytes.fetch_add(static_cast<size_t>(n), memory_order_relaxed);
-			if (header && static_cast<size_t>(n) >= sizeof(MsgHeader)) {
-				uint64_t recvNs = nowNs();
-				uint64_t sendNs = header->sendTimeNs;
-				if (recvNs >= sendNs) {
-					latRecorder.record(recvNs - sendNs);
-				}
-			}
+			onReceived(cfg, buffer, static_cast<size_t>(n), prio, counters, latHists, verify);
+			backoff.reset();
 		} else {
 			if (errno == EAGAIN || errno == ETIMEDOUT) {
-				stats.recvEagain.fetch_add(1, memory_order_relaxed);
-				this_thread::sleep_for(chrono::microseconds(50));
+				MqCounters::bump(counters.eagain);
+				backoff.wait();
 			} else {
-				stats.recvErrors.fetch_add(1, memory_order_relaxed);
+				MqCounters::bump(counters.errors);
 				this_thread::sleep_for(chrono::microseconds(100));
 			}
 		}
 	}
 }
 
-static void computePercentiles(vector<uint64_t>& dataNs, vector<pair<double, double>>& outPctToUs) {
-	if (dataNs.empty()) return;
-	sort(dataNs.begin(), dataNs.end());
-	auto at = [&](double pct) -> double {
-		if (dataNs.empty()) return 0.0;
-		double pos = pct * (dataNs.size() - 1);
-		size_t idx = static_cast<size_t>(pos);
-		size_t idx2 = min(idx + 1, dataNs.size() - 1);
-		double frac = pos - idx;
-		double vNs = static_cast<double>(dataNs[idx]) * (1.0 - frac) + static_cast<double>(dataNs[idx2]) * frac;
-		return vNs / 1000.0;
-	};
-	const double pcts[] = {0.5, 0.90, 0.95, 0.99, 0.999};
-	for (double p : pcts) {
-		outPctToUs.push_back({p, at(p)});
+// Receives on a non-blocking descriptor until the queue is empty. Returns the
+// number of messages taken; an immediate EAGAIN counts as an empty wakeup.
+static size_t drainQueue(mqd_t mq, const Config& cfg, vector<uint8_t>& buffer,
+                         MqCounters& counters, LatencyHistogram* latHists, VerifyState* verify) {
+	size_t drained = 0;
+	while (!stopFlag.load(memory_order_relaxed)) {
+		unsigned int prio = 0;
+		ssize_t n = mq_receive(mq, reinterpret_cast<char*>(buffer.data()),
+		                       static_cast<unsigned>(buffer.size()), &prio);
+		MqCounters::bump(counters.syscalls);
+		if (n >= 0) {
+			onReceived(cfg, buffer, static_cast<size_t>(n), prio, counters, latHists, verify);
+			drained++;
+			continue;
+		}
+		if (errno == EAGAIN) {
+			if (drained == 0) MqCounters::bump(counters.eagain);
+		} else if (errno != EINTR) {
+			MqCounters::bump(counters.errors);
+			this_thread::sleep_for(chrono::microseconds(100));
+		}
+		break;
 	}
+	return drained;
 }
 
-int main(int argc, char** argv) {
-	signal(SIGINT, onSignal);
-	signal(SIGTERM, onSignal);
-
-	Config cfg = parseArgs(argc, argv);
-	printConfig(cfg);
-
-	if (cfg.messageSize == 0) {
-		cerr << "message-size must be > 0\n";
-		return 1;
+#ifdef __linux__
+// On Linux an mqd_t is a pollable fd, so one epoll set covers every queue the
+// consumer owns. EPOLLEXCLUSIVE keeps one message from waking every consumer
+// that shares a queue.
+static void epollConsumer(const vector<mqd_t>& mqs, const Config& cfg, MqCounters& counters, LatencyHistogram* latHists, VerifyState* verify) {
+	size_t bufferSize = cfg.messageSize * static_cast<size_t>(cfg.batch);
+	for (mqd_t mq : mqs) bufferSize = recvBufferSize(mq, bufferSize);
+	vector<uint8_t> buffer(bufferSize, 0);
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	if (ep < 0) {
+		perror("epoll_create1");
+		return;
 	}
-	if (cfg.producers <= 0 || cfg.consumers <= 0) {
-		cerr << "producers and consumers must be >= 1\n";
-		return 1;
+	for (size_t q = 0; q < mqs.size(); ++q) {
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		if (cfg.consumers > cfg.queues) ev.events |= EPOLLEXCLUSIVE;
+		ev.data.u32 = static_cast<uint32_t>(q);
+		if (epoll_ctl(ep, EPOLL_CTL_ADD, static_cast<int>(mqs[q]), &ev) != 0) {
+			perror("epoll_ctl");
+			close(ep);
+			return;
+		}
 	}
-	if (cfg.durationSeconds <= 0) {
-		cerr << "duration-seconds must be >= 1\n";
-		return 1;
+	vector<epoll_event> ready(mqs.size());
+	while (!stopFlag.load(memory_order_relaxed)) {
+		int r = epoll_wait(ep, ready.data(), static_cast<int>(ready.size()), 100);
+		if (r <= 0) continue;
+		MqCounters::bump(counters.wakeups);
+		for (int e = 0; e < r; ++e) drainQueue(mqs[ready[static_cast<size_t>(e)].data.u32], cfg, buffer, counters, latHists, verify);
 	}
-	if (cfg.maxMessages <= 0) {
-		cerr << "max-messages must be >= 1\n";
-		return 1;
+	close(ep);
+}
+#endif
+
+// mq_notify fires once when a message lands on an empty queue, on a helper
+// thread (SIGEV_THREAD); the consumer re-arms and drains again to close the
+// race with messages that arrived while it was not registered.
+struct NotifyState {
+	mutex mtx;
+	condition_variable cv;
+	bool pending = false;
+};
+
+static void onNotify(sigval value) {
+	NotifyState* state = static_cast<NotifyState*>(value.sival_ptr);
+	{
+		lock_guard<mutex> lock(state->mtx);
+		state->pending = true;
 	}
+	state->cv.notify_one();
+}
 
-	if (cfg.unlinkAtStart) {
-		mq_unlink(cfg.queueName.c_str());
+static void notifyConsumer(mqd_t mq, int queue, const Config& cfg, MqCounters& counters, LatencyHistogram* latHists, VerifyState* verify) {
+	vector<uint8_t> buffer(recvBufferSize(mq, cfg.messageSize * static_cast<size_t>(cfg.batch)), 0);
+	// Static: a late helper thread may still run onNotify after we deregister.
+	// Only one notify consumer is allowed per queue, so one instance per queue
+	// suffices; a deque keeps existing instances in place as it grows.
+	static mutex statesMtx;
+	static deque<NotifyState> states;
+	NotifyState* slot = nullptr;
+	{
+		lock_guard<mutex> lock(statesMtx);
+		while (states.size() <= static_cast<size_t>(queue)) states.emplace_back();
+		slot = &states[static_cast<size_t>(queue)];
+	}
+	NotifyState& state = *slot;
+	sigevent sev{};
+	sev.sigev_notify = SIGEV_THREAD;
+	sev.sigev_notify_function = onNotify;
+	sev.sigev_value.sival_ptr = &state;
+	while (!stopFlag.load(memory_order_relaxed)) {
+		drainQueue(mq, cfg, buffer, counters, latHists, verify);
+		if (mq_notify(mq, &sev) != 0) {
+			if (errno != EBUSY) {
+				perror("mq_notify");
+				return;
+			}
+		}
+		if (drainQueue(mq, cfg, buffer, counters, latHists, verify) > 0) continue;
+		unique_lock<mutex> lock(state.mtx);
+		if (state.cv.wait_for(lock, chrono::milliseconds(100), [&] { return state.pending; })) {
+			state.pending = false;
+			MqCounters::bump(counters.wakeups);
+		}
 	}
+	mq_notify(mq, nullptr);
+}
 
-	mq_attr attr{};
-	attr.mq_flags = cfg.nonBlocking ? O_NONBLOCK : 0;
-#ifdef __linux__
-	long sys_maxmsg = readLongFromFile("/proc/sys/fs/mqueue/msg_max", 10);
-	long sys_msgsize = readLongFromFile("/proc/sys/fs/mqueue/msgsize_max", 8192);
-	long requested_maxmsg = cfg.maxMessages;
-	long requested_msgsize = static_cast<long>(cfg.messageSize);
-	if (requested_maxmsg > sys_maxmsg) {
-		cerr << "Note: requested max-messages=" << requested_maxmsg
-		     << " exceeds system msg_max=" << sys_maxmsg << ", capping.\n";
-		requested_maxmsg = sys_maxmsg;
+// Consumer i on the queues it owns (mqs is indexed by queue). A timed consumer of
+// a single queue receives on the shared descriptor; everything else drains with
+// non-blocking receives on descriptors of its own, independent of
+// --nonblocking, and a consumer owning several queues always waits with epoll.
+static void consumerThread(const vector<mqd_t>& mqs, const Config& cfg, int consumer, MqCounters& counters,
+                           LatencyHistogram* latHists, VerifyState* verify) {
+	const vector<int> owned = queuesOwnedBy(cfg, consumer);
+	if (cfg.consumerWait == "timed" && owned.size() == 1) {
+		timedConsumer(mqs[static_cast<size_t>(owned[0])], cfg, counters, latHists, verify);
+		return;
 	}
-	if (requested_msgsize > sys_msgsize) {
-		cerr << "Note: requested message-size=" << requested_msgsize
-		     << " exceeds system msgsize_max=" << sys_msgsize << ", capping.\n";
-		requested_msgsize = sys_msgsize;
+	vector<mqd_t> own;
+	for (int q : owned) {
+		mqd_t d = mq_open(queueNameFor(cfg, q).c_str(), O_RDONLY | O_NONBLOCK);
+		if (d == (mqd_t)-1) {
+			perror("mq_open (consumer)");
+			for (mqd_t o : own) mq_close(o);
+			return;
+		}
+		own.push_back(d);
 	}
-	if (requested_maxmsg < 1) requested_maxmsg = 1;
-	if (requested_msgsize < 1) requested_msgsize = 1;
-	attr.mq_maxmsg = requested_maxmsg;
-	attr.mq_msgsize = requested_msgsize;
-#else
-	attr.mq_maxmsg = cfg.maxMessages;
-	attr.mq_msgsize = static_cast<long>(cfg.messageSize);
+	if (cfg.consumerWait == "notify" && own.size() == 1) notifyConsumer(own[0], owned[0], cfg, counters, latHists, verify);
+#ifdef __linux__
+	else epollConsumer(own, cfg, counters, latHists, verify);
 #endif
+	for (mqd_t d : own) mq_close(d);
+}
 
-	int oflags = O_CREAT | O_RDWR;
-	if (cfg.nonBlocking) oflags |= O_NONBLOCK;
-
-	mqd_t mq = mq_open(cfg.queueName.c_str(), oflags, 0600, &attr);
-	if (mq == (mqd_t)-1) {
-		perror("mq_open");
-		cerr << "Failed to open queue " << cfg.queueName << ". On Linux, you may need to adjust /proc/sys/fs/mqueue/msg_max or msgsize_max.\n";
-		return 2;
+// --ping-pong client (a producer): keeps K requests in flight on the request
+// queue and records the round trip of each reply on its own reply queue. While
+// replies are outstanding a send never waits, so a full request queue turns
+// into collecting a reply instead of blocking the client and its server.
+static void pingPongClient(const vector<mqd_t>& mqs, const Config& cfg, MqCounters& counters,
+                           LatencyHistogram* rttHist, int clientId) {
+	MqTransport request(mqs[0]);
+	MqTransport reply(mqs[static_cast<size_t>(cfg.queues + clientId)]);
+	vector<uint8_t> buffer(recvBufferSize(mqs[static_cast<size_t>(cfg.queues + clientId)], cfg.messageSize), 0);
+	MsgHeader* header = reinterpret_cast<MsgHeader*>(buffer.data());
+	PayloadFill filler(static_cast<uint64_t>(clientId));
+	Backoff backoff(cfg.backoff, cfg.spinLimit, counters);
+	uint64_t seq = 0;
+	int inFlight = 0;
+	while (!stopFlag.load(memory_order_relaxed)) {
+		if (inFlight < cfg.pingPong) {
+			if (cfg.randomPayload) filler.fill(buffer.data() + sizeof(MsgHeader), cfg.messageSize - sizeof(MsgHeader));
+			header->sequence = seq;
+			header->sendTimeNs = nowNs();
+			header->intendedTimeNs = header->sendTimeNs;
+			header->producerId = static_cast<uint32_t>(clientId);
+			int ret = request.send(buffer.data(), cfg.messageSize, 0, inFlight == 0 ? kWaitNs : 0);
+			MqCounters::bump(counters.syscalls);
+			if (ret == 0) {
+				seq++;
+				inFlight++;
+				MqCounters::bump(counters.messages);
+				MqCounters::bump(counters.bytes, cfg.messageSize);
+				backoff.reset();
+				continue;
+			}
+			if (errno != EAGAIN && errno != ETIMEDOUT) {
+				MqCounters::bump(counters.errors);
+				this_thread::sleep_for(chrono::microseconds(100));
+				continue;
+			}
+			MqCounters::bump(counters.eagain);
+			if (inFlight == 0) {
+				backoff.wait();
+				continue;
+			}
+		}
+		ssize_t n = reply.recv(buffer.data(), buffer.size(), nullptr, kWaitNs);
+		MqCounters::bump(counters.syscalls);
+		if (n >= 0) {
+			inFlight--;
+			MqCounters::bump(counters.replies);
+			if (rttHist && cfg.latencySample && static_cast<size_t>(n) >= sizeof(MsgHeader)) {
+				uint64_t recvNs = nowNs();
+				if (recvNs >= header->sendTimeNs) rttHist->record(recvNs - header->sendTimeNs);
+			}
+			backoff.reset();
+		} else if (errno == EAGAIN || errno == ETIMEDOUT) {
+			MqCounters::bump(counters.eagain);
+			backoff.wait();
+		} else {
+			MqCounters::bump(counters.errors);
+			this_thread::sleep_for(chrono::microseconds(100));
+		}
 	}
+}
 
-	mq_attr actual{};
-	if (mq_getattr(mq, &actual) == -1) {
-		perror("mq_getattr");
-		mq_close(mq);
-		if (cfg.unlinkAtEnd) mq_unlink(cfg.queueName.c_str());
-		return 2;
+// --ping-pong server (a consumer): takes requests from the request queue and
+// sends each one back unchanged to the reply queue of the client in its header.
+static void pingPongServer(const vector<mqd_t>& mqs, const Config& cfg, MqCounters& counters) {
+	MqTransport request(mqs[0]);
+	vector<MqTransport> replies;
+	for (size_t q = static_cast<size_t>(cfg.queues); q < mqs.size(); ++q) replies.emplace_back(mqs[q]);
+	vector<uint8_t> buffer(recvBufferSize(mqs[0], cfg.messageSize), 0);
+	const MsgHeader* header = reinterpret_cast<const MsgHeader*>(buffer.data());
+	Backoff backoff(cfg.backoff, cfg.spinLimit, counters);
+	WorkSink sink;
+	while (!stopFlag.load(memory_order_relaxed)) {
+		ssize_t n = request.recv(buffer.data(), buffer.size(), nullptr, kWaitNs);
+		MqCounters::bump(counters.syscalls);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == ETIMEDOUT) {
+				MqCounters::bump(counters.eagain);
+				backoff.wait();
+			} else {
+				MqCounters::bump(counters.errors);
+				this_thread::sleep_for(chrono::microseconds(100));
+			}
+			continue;
+		}
+		backoff.reset();
+		MqCounters::bump(counters.messages);
+		MqCounters::bump(counters.bytes, static_cast<uint64_t>(n));
+		if (static_cast<size_t>(n) < sizeof(MsgHeader) || header->producerId >= replies.size()) {
+			MqCounters::bump(counters.errors);
+			continue;
+		}
+		MqCounters::bump(counters.workNs, runWork(cfg.workKernel, sink, buffer.data(), static_cast<size_t>(n)));
+		MqTransport& out = replies[header->producerId];
+		while (!stopFlag.load(memory_order_relaxed)) {
+			int ret = out.send(buffer.data(), static_cast<size_t>(n), 0, kWaitNs);
+			MqCounters::bump(counters.syscalls);
+			if (ret == 0) break;
+			if (errno == EAGAIN || errno == ETIMEDOUT) {
+				MqCounters::bump(counters.eagain);
+				backoff.wait();
+			} else {
+				MqCounters::bump(counters.errors);
+				break;
+			}
+		}
+		backoff.reset();
 	}
+}
 
-	cout << "Effective mq attributes:\n";
-	cout << "  mq_flags:    " << actual.mq_flags << "\n";
+// --stages S: every record carries one hand-off stamp per forwarding stage
+// right after its MsgHeader. MsgHeader itself keeps its layout (every backend
+// and --verify rely on it), so the stamps need message-size >= this.
+static constexpr int kMaxStages = 16;
+
+static size_t pipelineRecordBytes(int stages) {
+	return sizeof(MsgHeader) + sizeof(uint64_t) * static_cast<size_t>(stages - 1);
+}
+
+// Reader of pipeline stage `stage`: receives from in, records the hop latency
+// (since the previous stage's hand-off, or the intended send time for stage
+// 0), runs the --work kernel and either stamps its own hand-off and forwards
+// to out, or, in the last stage (out == -1), records end-to-end latency.
+static void stageThread(mqd_t in, mqd_t out, int stage, const Config& cfg, MqCounters& counters,
+                        LatencyHistogram& hopHist, LatencyHistogram* e2eHist) {
+	const bool last = out == (mqd_t)-1;
+	MqTransport from(in);
+	MqTransport to(last ? in : out);
+	vector<uint8_t> buffer(recvBufferSize(in, cfg.messageSize), 0);
+	const MsgHeader* header = reinterpret_cast<const MsgHeader*>(buffer.data());
+	uint64_t* handOff = reinterpret_cast<uint64_t*>(buffer.data() + sizeof(MsgHeader));
+	Backoff backoff(cfg.backoff, cfg.spinLimit, counters);
+	WorkSink sink;
+	while (!stopFlag.load(memory_order_relaxed)) {
+		ssize_t n = from.recv(buffer.data(), buffer.size(), nullptr, kWaitNs);
+		MqCounters::bump(counters.syscalls);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == ETIMEDOUT) {
+				MqCounters::bump(counters.eagain);
+				backoff.wait();
+			} else {
+				MqCounters::bump(counters.errors);
+				this_thread::sleep_for(chrono::microseconds(100));
+			}
+			continue;
+		}
+		backoff.reset();
+		MqCounters::bump(counters.messages);
+		MqCounters::bump(counters.bytes, static_cast<uint64_t>(n));
+		if (static_cast<size_t>(n) < pipelineRecordBytes(cfg.stages)) {
+			MqCounters::bump(counters.errors);
+			continue;
+		}
+		const uint64_t recvNs = nowNs();
+		const uint64_t since = stage == 0 ? header->intendedTimeNs : handOff[stage - 1];
+		if (cfg.latencySample && recvNs >= since) hopHist.record(recvNs - since);
+		MqCounters::bump(counters.workNs, runWork(cfg.workKernel, sink, buffer.data(), static_cast<size_t>(n)));
+		if (last) {
+			const uint64_t doneNs = nowNs();
+			if (cfg.latencySample && doneNs >= header->intendedTimeNs) e2eHist->record(doneNs - header->intendedTimeNs);
+			continue;
+		}
+		handOff[stage] = nowNs();
+		while (!stopFlag.load(memory_order_relaxed)) {
+			int ret = to.send(buffer.data(), static_cast<size_t>(n), 0, kWaitNs);
+			MqCounters::bump(counters.syscalls);
+			if (ret == 0) break;
+			if (errno == EAGAIN || errno == ETIMEDOUT) {
+				MqCounters::bump(counters.eagain);
+				backoff.wait();
+			} else {
+				MqCounters::bump(counters.errors);
+				break;
+			}
+		}
+		backoff.reset();
+	}
+}
+
+// Body of a process-mode worker: drops the inherited descriptors, opens its
+// own on the named queues and runs body on them.
+template <typename Body>
+static int withChildQueues(const Config& cfg, const vector<mqd_t>& inherited, Body body) {
+	for (mqd_t d : inherited) mq_close(d);
+	int oflags = O_RDWR;
+	if (cfg.nonBlocking) oflags |= O_NONBLOCK;
+	vector<mqd_t> mqs;
+	for (int q = 0; q < queueCount(cfg); ++q) {
+		mqs.push_back(mq_open(queueNameFor(cfg, q).c_str(), oflags));
+		if (mqs.back() == (mqd_t)-1) {
+			perror("mq_open (child)");
+			return 2;
+		}
+	}
+	body(mqs);
+	for (mqd_t d : mqs) mq_close(d);
+	return 0;
+}
+
+// Appends one result row to --csv and, with hist and intervals, one record to
+// --results.
+static void appendCsvRow(const Config& cfg, const char* backendName, double elapsedSec, uint64_t recv, uint64_t rbytes,
+                         const vector<pair<double, double>>& pctUs, const string& extra, uint64_t workNs,
+                         int servers = 0, const LatencyHistogram* hist = nullptr,
+                         vector<IntervalSample> intervals = {}) {
+	ResultRow row;
+	row.backend = backendName;
+	row.queueName = cfg.queueName;
+	row.depth = cfg.maxMessages;
+	row.nonBlocking = cfg.nonBlocking;
+	row.elapsedSec = elapsedSec;
+	row.recvMessages = recv;
+	row.recvBytes = rbytes;
+	row.pctUs = pctUs;
+	row.extra = extra;
+	row.workNs = workNs;
+	row.servers = servers;
+	row.hist = hist;
+	row.intervals = move(intervals);
+	appendResultRow(cfg, row);
+}
+
+// --repeat / --compare. One RunResult per repetition of a configuration.
+struct RunResult {
+	double msgPerSec = 0.0;
+	double p99us = NAN;
+	string extra; // the row's extra column, matched against --compare rows
+};
+
+// Mean, sample stddev and a 95% percentile-bootstrap interval of the mean.
+struct SampleStats {
+	size_t n = 0;
+	double mean = NAN;
+	double stddev = NAN;
+	double ciLo = NAN;
+	double ciHi = NAN;
+};
+
+static constexpr int kBootstrapResamples = 2000;
+
+static double meanOf(const vector<double>& v) {
+	double sum = 0.0;
+	for (double x : v) sum += x;
+	return v.empty() ? NAN : sum / static_cast<double>(v.size());
+}
+
+// 2.5th/97.5th percentile of stat over kBootstrapResamples resamples. The seed
+// is fixed so the same samples always give the same interval.
+template <typename Stat>
+static pair<double, double> bootstrapCi(Stat stat) {
+	mt19937_64 rng(0x5eed);
+	vector<double> draws(kBootstrapResamples);
+	for (double& d : draws) d = stat(rng);
+	sort(draws.begin(), draws.end());
+	return {draws[kBootstrapResamples / 40], draws[kBootstrapResamples - 1 - kBootstrapResamples / 40]};
+}
+
+static double resampledMean(const vector<double>& v, mt19937_64& rng) {
+	uniform_int_distribution<size_t> pick(0, v.size() - 1);
+	double sum = 0.0;
+	for (size_t i = 0; i < v.size(); ++i) sum += v[pick(rng)];
+	return sum / static_cast<double>(v.size());
+}
+
+static SampleStats sampleStats(vector<double> v) {
+	v.erase(remove_if(v.begin(), v.end(), [](double x) { return isnan(x); }), v.end());
+	SampleStats s;
+	s.n = v.size();
+	if (v.empty()) return s;
+	s.mean = meanOf(v);
+	double sq = 0.0;
+	for (double x : v) sq += (x - s.mean) * (x - s.mean);
+	s.stddev = v.size() > 1 ? sqrt(sq / static_cast<double>(v.size() - 1)) : 0.0;
+	tie(s.ciLo, s.ciHi) = bootstrapCi([&](mt19937_64& rng) { return resampledMean(v, rng); });
+	return s;
+}
+
+// Rows of a results CSV (run_matrix.sh layout) that --compare can match.
+struct BaselineRow {
+	string backend;
+	size_t messageSize = 0;
+	long maxMessages = 0;
+	int producers = 0;
+	int consumers = 0;
+	bool nonBlocking = false;
+	bool randomPayload = false;
+	double msgPerSec = NAN;
+	double p99us = NAN;
+	string extra;
+};
+
+static bool loadBaseline(const string& path, vector<BaselineRow>& rows) {
+	ifstream in(path);
+	if (!in.good()) return false;
+	string line;
+	while (getline(in, line)) {
+		vector<string> f;
+		stringstream ss(line);
+		string field;
+		while (getline(ss, field, ',')) f.push_back(field);
+		// Rows of the original 20-column layout (no p99.99/max/extra) carry
+		// every field read here; their extra column counts as empty.
+		if (f.size() < 19 || f[0] == "backend") continue;
+		BaselineRow r;
+		r.backend = f[0];
+		r.messageSize = static_cast<size_t>(strtoull(f[3].c_str(), nullptr, 10));
+		r.maxMessages = strtol(f[4].c_str(), nullptr, 10);
+		r.producers = atoi(f[5].c_str());
+		r.consumers = atoi(f[6].c_str());
+		r.nonBlocking = f[7] == "1";
+		r.randomPayload = f[8] == "1";
+		r.msgPerSec = strtod(f[13].c_str(), nullptr);
+		r.p99us = strtod(f[18].c_str(), nullptr);
+		r.extra = f.size() > 22 ? f[22] : "";
+		rows.push_back(r);
+	}
+	return true;
+}
+
+// Value of key in an extra column, or fallback when absent.
+static string extraValue(const string& extra, const string& key, const string& fallback) {
+	stringstream ss(extra);
+	string item;
+	while (getline(ss, item, ';')) {
+		if (item.compare(0, key.size() + 1, key + "=") == 0) return item.substr(key.size() + 1);
+	}
+	return fallback;
+}
+
+// Extra-column knobs that change what is measured, with the value a row that
+// omits the key stands for. Both sides are read from written extra columns,
+// so values the run capped (batch) and defaults the writer leaves out match.
+static const pair<const char*, const char*> kMatchedExtras[] = {
+	{"consumerWait", "timed"}, {"batch", "1"}, {"sizeDist", "fixed"}, {"priorityMix", ""}, {"rate", "0"},
+	{"queues", "1"}, {"routing", ""}, {"placement", "none"}, {"backoff", "sleep"}, {"pingPong", "0"},
+	{"verify", ""}, {"warmupSec", "0"}, {"stages", "1"}, {"stageReaders", ""}};
+
+// Same backend and fixed columns, the same knobs in the extra column as this
+// run wrote, and the same --work kernel.
+static bool sameConfig(const BaselineRow& r, const Config& cfg, const char* backendName, const string& extra) {
+	if (r.backend != backendName || r.messageSize != cfg.messageSize || r.maxMessages != cfg.maxMessages ||
+	    r.producers != cfg.producers || r.consumers != cfg.consumers || r.nonBlocking != cfg.nonBlocking ||
+	    r.randomPayload != cfg.randomPayload) {
+		return false;
+	}
+	for (const auto& k : kMatchedExtras) {
+		if (extraValue(r.extra, k.first, k.second) != extraValue(extra, k.first, k.second)) return false;
+	}
+	return extraValue(r.extra, "work", "none") == (cfg.workKernel.enabled() ? cfg.workKernel.describe() : "none");
+}
+
+// Prints mean/stddev/CI for the repetitions of one configuration and, with a
+// baseline, compares them. A metric regresses when the bootstrap 95% interval
+// of (current - baseline) / baseline excludes zero on the bad side and the
+// change is at least threshold percent. Returns true on a regression.
+static bool reportRepeats(const Config& cfg, const char* backendName, const vector<RunResult>& runs,
+                          const vector<BaselineRow>* baseline) {
+	vector<double> rates, p99s;
+	for (const RunResult& r : runs) {
+		rates.push_back(r.msgPerSec);
+		p99s.push_back(r.p99us);
+	}
+	auto printStats = [](const string& key, const SampleStats& s) {
+		cout << key << string(key.size() < 23 ? 23 - key.size() : 1, ' ');
+		if (s.n == 0) {
+			cout << "n/a\n";
+			return;
+		}
+		cout << "mean=" << fixed << setprecision(2) << s.mean << " stddev=" << s.stddev
+		     << " cv=" << setprecision(1) << (s.mean != 0.0 ? 100.0 * s.stddev / s.mean : 0.0) << "%"
+		     << " ci95=[" << setprecision(2) << s.ciLo << "," << s.ciHi << "] (n=" << s.n << ")\n";
+	};
+	cout << "\nRepeat summary (" << runs.size() << " runs):\n";
+	printStats("  repeat-msg/s:", sampleStats(rates));
+	printStats("  repeat-p99-us:", sampleStats(p99s));
+	if (!baseline) return false;
+
+	vector<double> baseRates, baseP99s;
+	for (const BaselineRow& r : *baseline) {
+		if (runs.empty() || !sameConfig(r, cfg, backendName, runs.front().extra)) continue;
+		baseRates.push_back(r.msgPerSec);
+		baseP99s.push_back(r.p99us);
+	}
+	bool regressed = false;
+	// higherIsBetter: msg/s regresses downwards, p99 upwards.
+	auto compare = [&](const string& key, vector<double> cur, vector<double> base, bool higherIsBetter) {
+		auto dropNan = [](vector<double>& v) { v.erase(remove_if(v.begin(), v.end(), [](double x) { return isnan(x); }), v.end()); };
+		dropNan(cur);
+		dropNan(base);
+		cout << key << string(key.size() < 23 ? 23 - key.size() : 1, ' ');
+		if (cur.empty() || base.empty()) {
+			cout << "no matching baseline rows\n";
+			return;
+		}
+		double baseMean = meanOf(base);
+		double change = 100.0 * (meanOf(cur) - baseMean) / baseMean;
+		cout << "baseline=" << fixed << setprecision(2) << baseMean << " (n=" << base.size() << ") current="
+		     << meanOf(cur) << " (n=" << cur.size() << ") change=" << setprecision(1) << change << "%";
+		if (cur.size() < 2 || base.size() < 2) {
+			cout << " (need >= 2 samples on each side for a verdict)\n";
+			return;
+		}
+		pair<double, double> ci = bootstrapCi([&](mt19937_64& rng) {
+			double b = resampledMean(base, rng);
+			return 100.0 * (resampledMean(cur, rng) - b) / b;
+		});
+		bool worse = higherIsBetter ? (ci.second < 0.0 && -change >= cfg.regressThresholdPct)
+		                            : (ci.first > 0.0 && change >= cfg.regressThresholdPct);
+		bool better = higherIsBetter ? ci.first > 0.0 : ci.second < 0.0;
+		cout << " ci95=[" << ci.first << "%," << ci.second << "%] "
+		     << (worse ? "REGRESSION" : better ? "improved" : "no significant change") << "\n";
+		regressed = regressed || worse;
+	};
+	compare("  compare-msg/s:", rates, baseRates, true);
+	compare("  compare-p99-us:", p99s, baseP99s, false);
+	return regressed;
+}
+
+// Comma-separated positive integers for the --sweep-* axes.
+static bool parseCountList(const string& s, vector<long>& out) {
+	out.clear();
+	stringstream ss(s);
+	string item;
+	while (getline(ss, item, ',')) {
+		char* end = nullptr;
+		long v = strtol(item.c_str(), &end, 10);
+		if (item.empty() || *end != '\0' || v <= 0) return false;
+		out.push_back(v);
+	}
+	return !out.empty();
+}
+
+struct SweepPoint {
+	long maxMessages;
+	long messageSize;
+	int producers;
+	int consumers;
+	int repeat; // 0..--repeat-1; repetitions of a point are consecutive
+};
+
+// Bytes one queue charges against RLIMIT_MSGQUEUE (ipc/mqueue.c): a struct
+// msg_msg plus the payload per message, and a priority tree node per message
+// up to MQ_PRIO_MAX; both structs are 48 bytes on 64-bit kernels.
+static long long mqueueCharge(long maxmsg, long msgsize) {
+	const long long kMsgMsgBytes = 48;
+	const long long kTreeNodeBytes = 48;
+	return static_cast<long long>(maxmsg) * (kMsgMsgBytes + msgsize) + min<long long>(maxmsg, 32768) * kTreeNodeBytes;
+}
+
+// Soft RLIMIT_MSGQUEUE in bytes, or -1 when unlimited/unknown.
+static long long msgqueueLimit() {
+#ifdef RLIMIT_MSGQUEUE
+	rlimit rl{};
+	if (getrlimit(RLIMIT_MSGQUEUE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) return static_cast<long long>(rl.rlim_cur);
+#endif
+	return -1;
+}
+
+// --autotune: fills empty depth/size axes from the system limits. Depths are
+// powers of two up to msg_max (and msg_max itself), sizes powers of four from
+// 64 B up to msgsize_max (and msgsize_max itself).
+static void autotuneAxes(const Config& cfg, vector<long>& depths, vector<long>& sizes) {
+	long sysMaxmsg = readLongFromFile("/proc/sys/fs/mqueue/msg_max", 10);
+	long sysMsgsize = readLongFromFile("/proc/sys/fs/mqueue/msgsize_max", 8192);
+	long long limit = msgqueueLimit();
+	cout << "Autotune limits: msg_max=" << sysMaxmsg << " msgsize_max=" << sysMsgsize
+	     << " queues_max=" << readLongFromFile("/proc/sys/fs/mqueue/queues_max", -1)
+	     << " RLIMIT_MSGQUEUE=" << (limit < 0 ? string("unlimited") : to_string(limit) + " B") << "\n";
+	if (cfg.sweepMaxMessages.empty()) {
+		depths.clear();
+		for (long d = 1; d < sysMaxmsg; d *= 2) depths.push_back(d);
+		depths.push_back(sysMaxmsg);
+	}
+	if (cfg.sweepSizes.empty()) {
+		sizes.clear();
+		for (long s = 64; s < sysMsgsize; s *= 4) sizes.push_back(s);
+		sizes.push_back(sysMsgsize);
+	}
+}
+
+// Per (size, producers, consumers): the depths no other depth beats on both
+// mean msg/s and mean p99 (a missing p99 counts as worst), and the smallest
+// of those within 5% of the best throughput.
+static void printParetoFrontier(const vector<pair<SweepPoint, RunResult>>& results) {
+	struct Candidate {
+		long depth;
+		double msgPerSec;
+		double p99us;
+		int n;
+	};
+	vector<pair<SweepPoint, vector<Candidate>>> groups;
+	for (const auto& r : results) {
+		const SweepPoint& pt = r.first;
+		auto g = find_if(groups.begin(), groups.end(), [&](const pair<SweepPoint, vector<Candidate>>& e) {
+			return e.first.messageSize == pt.messageSize && e.first.producers == pt.producers && e.first.consumers == pt.consumers;
+		});
+		if (g == groups.end()) {
+			groups.push_back({pt, {}});
+			g = groups.end() - 1;
+		}
+		double p99 = isnan(r.second.p99us) ? INFINITY : r.second.p99us;
+		auto c = find_if(g->second.begin(), g->second.end(), [&](const Candidate& e) { return e.depth == pt.maxMessages; });
+		if (c == g->second.end()) {
+			g->second.push_back({pt.maxMessages, r.second.msgPerSec, p99, 1});
+		} else {
+			c->msgPerSec = (c->msgPerSec * c->n + r.second.msgPerSec) / (c->n + 1);
+			c->p99us = (c->p99us * c->n + p99) / (c->n + 1);
+			c->n++;
+		}
+	}
+	for (auto& g : groups) {
+		vector<Candidate>& cands = g.second;
+		sort(cands.begin(), cands.end(), [](const Candidate& a, const Candidate& b) { return a.depth < b.depth; });
+		double best = 0.0;
+		for (const Candidate& c : cands) best = max(best, c.msgPerSec);
+		cout << "\nPareto frontier (size=" << g.first.messageSize << " producers=" << g.first.producers
+		     << " consumers=" << g.first.consumers << "):\n";
+		const Candidate* pick = nullptr;
+		for (const Candidate& c : cands) {
+			bool dominated = any_of(cands.begin(), cands.end(), [&](const Candidate& o) {
+				return o.msgPerSec >= c.msgPerSec && o.p99us <= c.p99us && (o.msgPerSec > c.msgPerSec || o.p99us < c.p99us);
+			});
+			if (dominated) continue;
+			if (!pick && c.msgPerSec >= 0.95 * best) pick = &c;
+			string key = "  max-messages=" + to_string(c.depth) + ":";
+			cout << key << string(key.size() < 23 ? 23 - key.size() : 1, ' ') << "msg/s=" << fixed << setprecision(2)
+			     << c.msgPerSec << " p99=" << c.p99us << " us\n";
+		}
+		if (pick) {
+			cout << "  recommended:         max-messages=" << pick->depth << " (msg/s=" << fixed << setprecision(2)
+			     << pick->msgPerSec << ", " << setprecision(1) << 100.0 * pick->msgPerSec / best
+			     << "% of peak, p99=" << setprecision(2) << pick->p99us << " us)\n";
+		}
+	}
+}
+
+// --sweep: runs every point of the axis lists in this process. One thread per
+// producer and consumer slot lives for the whole sweep and is handed each
+// point's config through a generation counter; the queue is re-created only
+// when the capped mq attributes change and is drained between points. A point
+// ends once the last sweep-window throughput samples (250 ms each, the first
+// one skipped as ramp-up) are all within sweep-tolerance percent of their mean,
+// or after duration-seconds. Thread mode only; verify, per-class and per-size
+// results are not broken out. With --repeat the repetitions of each point are
+// summarised (and compared against the baseline) after its last one.
+static int runSweep(const Config& base, const vector<SweepPoint>& points, const vector<BaselineRow>* baseline,
+                    vector<pair<SweepPoint, RunResult>>* results = nullptr) {
+	constexpr int kSampleMs = 250;
+	int maxProducers = 1;
+	int maxConsumers = 1;
+	for (const SweepPoint& pt : points) {
+		maxProducers = max(maxProducers, pt.producers);
+		maxConsumers = max(maxConsumers, pt.consumers);
+	}
+	Config poolCfg = base;
+	poolCfg.producers = maxProducers;
+	poolCfg.consumers = maxConsumers;
+	vector<int> producerCpus;
+	vector<int> consumerCpus;
+	const string placement = resolvePlacement(poolCfg, producerCpus, consumerCpus);
+
+	const int classes = static_cast<int>(base.priorities.classes());
+	vector<MqCounters> producerSlots(static_cast<size_t>(maxProducers));
+	vector<MqCounters> consumerSlots(static_cast<size_t>(maxConsumers));
+	vector<LatencyHistogram> hists(static_cast<size_t>(maxConsumers * classes));
+	vector<VerifyState> verify(base.verify ? static_cast<size_t>(maxConsumers * maxProducers) : 0);
+
+	// Workers 0..maxConsumers-1 are consumers, the rest producers. Each waits
+	// for a new generation, runs its role if the point uses it, then checks in.
+	mutex mtx;
+	condition_variable cv;
+	uint64_t generation = 0;
+	int finished = 0;
+	bool shutdown = false;
+	Config point = base;
+	mqd_t mq = (mqd_t)-1;
+	const int workers = maxProducers + maxConsumers;
+	vector<thread> pool;
+	pool.reserve(static_cast<size_t>(workers));
+	for (int w = 0; w < workers; ++w) {
+		pool.emplace_back([&, w] {
+			const bool consumer = w < maxConsumers;
+			const int i = consumer ? w : w - maxConsumers;
+			pinCurrentThread(consumer ? consumerCpus : producerCpus, i);
+			uint64_t seen = 0;
+			for (;;) {
+				{
+					unique_lock<mutex> lock(mtx);
+					cv.wait(lock, [&] { return shutdown || generation != seen; });
+					if (shutdown) return;
+					seen = generation;
+				}
+				if (consumer && i < point.consumers) {
+					PerfScope perf(point.perf, consumerSlots[static_cast<size_t>(i)]);
+					consumerThread({mq}, point, i, consumerSlots[static_cast<size_t>(i)], &hists[static_cast<size_t>(i * classes)],
+					               point.verify ? &verify[static_cast<size_t>(i * maxProducers)] : nullptr);
+				} else if (!consumer && i < point.producers) {
+					PerfScope perf(point.perf, producerSlots[static_cast<size_t>(i)]);
+					producerThread({mq}, point, producerSlots[static_cast<size_t>(i)], i);
+				}
+				lock_guard<mutex> lock(mtx);
+				if (++finished == workers) cv.notify_all();
+			}
+		});
+	}
+	auto stopPool = [&] {
+		{
+			lock_guard<mutex> lock(mtx);
+			shutdown = true;
+		}
+		cv.notify_all();
+		for (auto& t : pool) t.join();
+	};
+
+	const timespec immediate{};
+	mq_attr current{};
+	int queuesCreated = 0;
+	size_t convergedPoints = 0;
+	size_t done = 0;
+	vector<RunResult> repeats;
+	bool regressed = false;
+	const auto sweepStart = chrono::steady_clock::now();
+	for (const SweepPoint& pt : points) {
+		if (interrupted.load()) break;
+		point = base;
+		point.maxMessages = pt.maxMessages;
+		point.messageSize = static_cast<size_t>(pt.messageSize);
+		point.producers = pt.producers;
+		point.consumers = pt.consumers;
+		point.repeatIndex = pt.repeat;
+		mq_attr attr{};
+		const bool sameAxes = &pt != &points.front() && pt.maxMessages == (&pt - 1)->maxMessages &&
+		                      pt.messageSize == (&pt - 1)->messageSize;
+		queueAttrFor(point, attr, sameAxes);
+		if (mq == (mqd_t)-1 || attr.mq_maxmsg != current.mq_maxmsg || attr.mq_msgsize != current.mq_msgsize) {
+			if (mq != (mqd_t)-1) {
+				mq_close(mq);
+				mq_unlink(base.queueName.c_str());
+			}
+			int oflags = O_CREAT | O_RDWR;
+			if (base.nonBlocking) oflags |= O_NONBLOCK;
+			mq = mq_open(base.queueName.c_str(), oflags, 0600, &attr);
+			if (mq == (mqd_t)-1 || mq_getattr(mq, &current) == -1) {
+				perror("mq_open");
+				cerr << "Failed to open queue " << base.queueName << " (maxmsg=" << attr.mq_maxmsg
+				     << " msgsize=" << attr.mq_msgsize << ")\n";
+				stopPool();
+				return 2;
+			}
+			// Compare against what was asked for, not what an existing queue had.
+			current.mq_maxmsg = attr.mq_maxmsg;
+			current.mq_msgsize = attr.mq_msgsize;
+			queuesCreated++;
+		}
+
+		for (auto& c : producerSlots) c.forEach(c, [](atomic<uint64_t>& v, const atomic<uint64_t>&) { v.store(0); });
+		for (auto& c : consumerSlots) c.forEach(c, [](atomic<uint64_t>& v, const atomic<uint64_t>&) { v.store(0); });
+		for (auto& h : hists) h = LatencyHistogram();
+		for (auto& v : verify) v = VerifyState();
+		stopFlag.store(false);
+		{
+			lock_guard<mutex> lock(mtx);
+			finished = 0;
+			generation++;
+		}
+		cv.notify_all();
+
+		const auto start = chrono::steady_clock::now();
+		const auto endTime = start + chrono::seconds(point.durationSeconds);
+		vector<double> window;
+		uint64_t prevRecv = 0;
+		auto prevTime = start;
+		int samples = 0;
+		bool converged = false;
+		double spreadPct = NAN;
+		double windowMean = 0.0;
+		while (chrono::steady_clock::now() < endTime && !stopFlag.load(memory_order_relaxed)) {
+			this_thread::sleep_for(chrono::milliseconds(kSampleMs));
+			uint64_t recvNow = sumMqCounters(producerSlots.data(), 0, consumerSlots.data(), point.consumers).recvMessages;
+			auto now = chrono::steady_clock::now();
+			double rate = (recvNow - prevRecv) / chrono::duration<double>(now - prevTime).count();
+			prevRecv = recvNow;
+			prevTime = now;
+			if (samples++ == 0) continue;
+			window.push_back(rate);
+			if (static_cast<int>(window.size()) > point.sweepWindow) window.erase(window.begin());
+			if (static_cast<int>(window.size()) < point.sweepWindow) continue;
+			double sum = 0.0;
+			for (double r : window) sum += r;
+			windowMean = sum / static_cast<double>(window.size());
+			double maxDev = 0.0;
+			for (double r : window) maxDev = max(maxDev, fabs(r - windowMean));
+			spreadPct = windowMean > 0.0 ? 100.0 * maxDev / windowMean : NAN;
+			if (windowMean > 0.0 && spreadPct <= point.sweepTolerance) {
+				converged = true;
+				break;
+			}
+		}
+		stopFlag.store(true, memory_order_relaxed);
+		// Consumers blocked on an empty queue would otherwise sit out their
+		// 100 ms receive timeout; a zero-length message releases each at once.
+		for (int i = 0; i < point.consumers; ++i) mq_timedsend(mq, "", 0, 0, &immediate);
+		{
+			unique_lock<mutex> lock(mtx);
+			cv.wait(lock, [&] { return finished == workers; });
+		}
+		const double elapsedSec = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		vector<char> scratch(static_cast<size_t>(current.mq_msgsize));
+		while (mq_timedreceive(mq, scratch.data(), scratch.size(), nullptr, &immediate) >= 0) {}
+		if (interrupted.load()) break;
+		done++;
+		if (converged) convergedPoints++;
+
+		MqStats stats = sumMqCounters(producerSlots.data(), point.producers, consumerSlots.data(), point.consumers);
+		auto merged = make_unique<LatencyHistogram>();
+		for (int i = 0; i < point.consumers; ++i) {
+			for (int k = 0; k < classes; ++k) merged->merge(hists[static_cast<size_t>(i * classes + k)]);
+		}
+		vector<pair<double, double>> pctUs;
+		computePercentiles(*merged, pctUs);
+		cout << "Sweep " << done << "/" << points.size() << ": max-messages=" << point.maxMessages
+		     << " size=" << point.messageSize << " producers=" << point.producers << " consumers=" << point.consumers
+		     << " msg/s=" << fixed << setprecision(2) << stats.recvMessages / elapsedSec
+		     << " MiB/s=" << (stats.recvBytes / (1024.0 * 1024.0)) / elapsedSec;
+		if (pctUs.size() >= 7) cout << " p50=" << pctUs[0].second << " p99=" << pctUs[3].second;
+		if (base.repeat > 1) cout << " repeat=" << pt.repeat + 1 << "/" << base.repeat;
+		cout << " elapsed=" << setprecision(2) << elapsedSec << "s ("
+		     << (converged ? "converged" : "not converged");
+		if (!isnan(spreadPct)) cout << ", spread " << setprecision(1) << spreadPct << "%";
+		cout << ")\n";
+		cout.flush();
+
+		string extra;
+		if (point.rate > 0.0) appendExtra(extra, "rate", formatDouble(point.rate));
+		appendExtra(extra, "consumerWait", point.consumerWait);
+		appendExtra(extra, "placement", placement);
+		appendExtra(extra, "sweepPoint", to_string(done));
+		appendExtra(extra, "converged", converged ? "1" : "0");
+		if (!isnan(spreadPct)) appendExtra(extra, "spreadPct", formatDouble(spreadPct));
+		if (windowMean > 0.0) appendExtra(extra, "windowMsgPerSec", formatDouble(windowMean));
+		appendExtra(extra, "queuesCreated", to_string(queuesCreated));
+		if (base.repeat > 1) {
+			appendExtra(extra, "repeat", to_string(pt.repeat));
+			appendExtra(extra, "repeatOf", to_string(base.repeat));
+		}
+		appendExtra(extra, "backoff", point.backoff);
+		if (point.verify) appendExtra(extra, "corrupt", to_string(stats.corrupt));
+		if (point.batch > 1) appendExtra(extra, "batch", to_string(point.batch));
+		appendCsvRow(point, "mqueue", elapsedSec, stats.recvMessages, stats.recvBytes, pctUs, extra, stats.workNs, 0,
+		             merged.get());
+
+		RunResult result;
+		result.msgPerSec = stats.recvMessages / elapsedSec;
+		if (pctUs.size() >= 7) result.p99us = pctUs[3].second;
+		result.extra = extra;
+		repeats.push_back(result);
+		if (results) results->push_back({pt, result});
+		if (pt.repeat + 1 == base.repeat) {
+			if (base.repeat > 1 || baseline) regressed = reportRepeats(point, "mqueue", repeats, baseline) || regressed;
+			repeats.clear();
+		}
+	}
+	stopPool();
+	cout << "\nSweep summary: " << done << "/" << points.size() << " points in " << fixed << setprecision(2)
+	     << chrono::duration<double>(chrono::steady_clock::now() - sweepStart).count() << " s, "
+	     << convergedPoints << " converged, " << queuesCreated << " queue(s) created\n";
+
+	if (mq != (mqd_t)-1) mq_close(mq);
+	if (base.unlinkAtEnd) mq_unlink(base.queueName.c_str());
+	return regressed ? 3 : 0;
+}
+
+// One measured run of cfg: queue setup, workers, summary and CSV row.
+// CSV backend column of a single run (sweeps always report "mqueue").
+static string backendNameFor(const Config& cfg) {
+	if (cfg.stages > 1) return "mqueue_pipeline";
+	return string(cfg.processMode ? "mqueue_process" : "mqueue") + (cfg.pingPong > 0 ? "_pingpong" : "");
+}
+
+static int runBenchmark(Config cfg, RunResult& result) {
+	if (cfg.unlinkAtStart) {
+		for (int q = 0; q < queueCount(cfg); ++q) mq_unlink(queueNameFor(cfg, q).c_str());
+	}
+
+	mq_attr attr{};
+	queueAttrFor(cfg, attr);
+
+	int oflags = O_CREAT | O_RDWR;
+	if (cfg.nonBlocking) oflags |= O_NONBLOCK;
+
+	vector<mqd_t> queues;
+	auto closeQueues = [&] {
+		for (mqd_t d : queues) mq_close(d);
+		if (cfg.unlinkAtEnd) {
+			for (int q = 0; q < queueCount(cfg); ++q) mq_unlink(queueNameFor(cfg, q).c_str());
+		}
+	};
+	for (int q = 0; q < queueCount(cfg); ++q) {
+		mqd_t d = mq_open(queueNameFor(cfg, q).c_str(), oflags, 0600, &attr);
+		if (d == (mqd_t)-1) {
+			perror("mq_open");
+			cerr << "Failed to open queue " << queueNameFor(cfg, q) << ". On Linux, you may need to adjust /proc/sys/fs/mqueue/msg_max, msgsize_max or queues_max.\n";
+			closeQueues();
+			return 2;
+		}
+		queues.push_back(d);
+	}
+
+	mq_attr actual{};
+	if (mq_getattr(queues[0], &actual) == -1) {
+		perror("mq_getattr");
+		closeQueues();
+		return 2;
+	}
+
+	cout << "Effective mq attributes:\n";
+	cout << "  mq_flags:    " << actual.mq_flags << "\n";
 	cout << "  mq_maxmsg:   " << actual.mq_maxmsg << "\n";
 	cout << "  mq_msgsize:  " << actual.mq_msgsize << "\n";
+	if (cfg.queues > 1) {
+		cout << "  queues:      " << cfg.queues << " x " << cfg.queueName << ".N (routing " << cfg.routing << ")\n";
+		for (int i = 0; i < cfg.consumers; ++i) {
+			string owned;
+			for (int q : queuesOwnedBy(cfg, i)) owned += (owned.empty() ? "" : "+") + to_string(q);
+			cout << "  consumer[" << i << "]: queues " << owned << "\n";
+		}
+	}
+	if (cfg.pingPong > 0) {
+		cout << "  ping-pong:   " << cfg.producers << " x " << cfg.queueName << ".reply.N, "
+		     << cfg.pingPong << " in flight per client\n";
+	}
 	cout.flush();
 
-	Stats stats;
-	LatencyRecorder latRecorder(cfg.latencySample);
+	const int classes = static_cast<int>(cfg.priorities.classes());
+	const int sizeBuckets = cfg.sizes.variable() ? static_cast<int>(sizeBucketFor(cfg.messageSize)) + 1 : 0;
+	const int histsPerConsumer = classes + sizeBuckets;
+	// Who records latency: consumers (one way), or clients (round trip).
+	const int recorders = cfg.pingPong > 0 ? cfg.producers : cfg.consumers;
+	// Process mode: counters, the recorders' histograms and, with --verify,
+	// one VerifyState per consumer and producer live in a shared mapping.
+	const size_t verifyCount = cfg.verify ? static_cast<size_t>(cfg.consumers) * static_cast<size_t>(cfg.producers) : 0;
+	SharedBlock<MqCounters>* shared = nullptr;
+	if (cfg.processMode) {
+		shared = SharedBlock<MqCounters>::create(cfg.producers, cfg.consumers, recorders * histsPerConsumer,
+		                                         verifyCount * sizeof(VerifyState));
+		if (!shared) {
+			perror("mmap shared stats");
+			closeQueues();
+			return 2;
+		}
+		for (size_t i = 0; i < verifyCount; ++i) new (static_cast<VerifyState*>(shared->extra()) + i) VerifyState();
+	}
+	vector<MqCounters> localProducerSlots(shared ? 0 : static_cast<size_t>(cfg.producers));
+	vector<MqCounters> localConsumerSlots(shared ? 0 : static_cast<size_t>(cfg.consumers));
+	vector<LatencyHistogram> localHists(shared ? 0 : static_cast<size_t>(recorders * histsPerConsumer));
+	// Recorder i owns histsPerConsumer histograms: one per priority class, then
+	// one per size bucket.
+	// After a warmup the summary reads measuredHists (declared below) instead.
+	vector<LatencyHistogram>* summaryHists = nullptr;
+	auto histogramsFor = [&](int recorder) {
+		if (summaryHists) return &(*summaryHists)[static_cast<size_t>(recorder * histsPerConsumer)];
+		return shared ? shared->histogram(recorder * histsPerConsumer)
+		              : &localHists[static_cast<size_t>(recorder * histsPerConsumer)];
+	};
+	vector<VerifyState> localVerify(shared || !cfg.verify ? 0 : static_cast<size_t>(cfg.consumers * cfg.producers));
+	auto verifyFor = [&](int consumer) -> VerifyState* {
+		if (!cfg.verify) return nullptr;
+		const size_t first = static_cast<size_t>(consumer * cfg.producers);
+		return shared ? static_cast<VerifyState*>(shared->extra()) + first : &localVerify[first];
+	};
+	MqCounters* producerSlots = shared ? shared->producerSlots() : localProducerSlots.data();
+	MqCounters* consumerSlots = shared ? shared->consumerSlots() : localConsumerSlots.data();
+
+	vector<int> producerCpus;
+	vector<int> consumerCpus;
+	const string placement = resolvePlacement(cfg, producerCpus, consumerCpus);
+	if (placement != "none") {
+		cout << "Placement: " << placement << " producers=" << formatCpuList(producerCpus)
+		     << " consumers=" << formatCpuList(consumerCpus) << "\n";
+	}
 
+	auto runConsumer = [&](const vector<mqd_t>& mqs, int i) {
+		pinCurrentThread(consumerCpus, i);
+		PerfScope perf(cfg.perf, consumerSlots[i]);
+		if (cfg.pingPong > 0) pingPongServer(mqs, cfg, consumerSlots[i]);
+		else consumerThread(mqs, cfg, i, consumerSlots[i], histogramsFor(i), verifyFor(i));
+	};
+	auto runProducer = [&](const vector<mqd_t>& mqs, int i) {
+		pinCurrentThread(producerCpus, i);
+		PerfScope perf(cfg.perf, producerSlots[i]);
+		if (cfg.pingPong > 0) pingPongClient(mqs, cfg, producerSlots[i], histogramsFor(i), i);
+		else producerThread(mqs, cfg, producerSlots[i], i);
+	};
 	vector<thread> threads;
-	threads.reserve(static_cast<size_t>(cfg.producers + cfg.consumers));
-	for (int i = 0; i < cfg.consumers; ++i) {
-		threads.emplace_back(consumerThread, mq, cref(cfg), ref(stats), ref(latRecorder));
+	vector<pid_t> children;
+	if (cfg.processMode) {
+		cout.flush();
+		for (int i = 0; i < cfg.consumers; ++i) {
+			pid_t pid = spawnWorker([&, i] {
+				return withChildQueues(cfg, queues, [&, i](const vector<mqd_t>& childMqs) { runConsumer(childMqs, i); });
+			});
+			if (pid < 0) { perror("fork"); stopFlag.store(true); break; }
+			children.push_back(pid);
+		}
+		for (int i = 0; i < cfg.producers && !stopFlag.load(); ++i) {
+			pid_t pid = spawnWorker([&, i] {
+				return withChildQueues(cfg, queues, [&, i](const vector<mqd_t>& childMqs) { runProducer(childMqs, i); });
+			});
+			if (pid < 0) { perror("fork"); stopFlag.store(true); break; }
+			children.push_back(pid);
+		}
+	} else {
+		threads.reserve(static_cast<size_t>(cfg.producers + cfg.consumers));
+		for (int i = 0; i < cfg.consumers; ++i) threads.emplace_back([&, i] { runConsumer(queues, i); });
+		for (int i = 0; i < cfg.producers; ++i) threads.emplace_back([&, i] { runProducer(queues, i); });
 	}
-	for (int i = 0; i < cfg.producers; ++i) {
-		threads.emplace_back(producerThread, mq, cref(cfg), ref(stats), i);
+
+	// Identifies this run's interval rows and its summary row.
+	string runId = to_string(static_cast<long long>(time(nullptr))) + "-" + to_string(getpid());
+	if (cfg.repeat > 1) runId += "." + to_string(cfg.repeatIndex);
+	const string backend = backendNameFor(cfg);
+	const char* backendName = backend.c_str();
+	FILE* intervalFile = nullptr;
+	if (!cfg.intervalCsvPath.empty()) {
+		intervalFile = fopen(cfg.intervalCsvPath.c_str(), "a");
+		if (!intervalFile) {
+			perror("fopen interval csv");
+		} else if (ftell(intervalFile) == 0) {
+			fprintf(intervalFile, "runId,backend,interval,tSec,warmup,sent,recv,sendMsgPerSec,recvMsgPerSec,recvMiBps,"
+			                      "sendEagain,recvEagain,samples,p50us,p99us,maxus\n");
+		}
 	}
+	// Merged priority-class histograms of all consumers (the cumulative view
+	// the interval deltas are taken from). The consumers are still recording,
+	// so each one is read through loadFrom().
+	auto liveCopy = make_unique<LatencyHistogram>();
+	auto mergedNow = [&]() {
+		auto h = make_unique<LatencyHistogram>();
+		for (int i = 0; i < recorders; ++i) {
+			for (int k = 0; k < classes; ++k) {
+				liveCopy->loadFrom(histogramsFor(i)[k]);
+				h->merge(*liveCopy);
+			}
+		}
+		return h;
+	};
+
+	// Request queues only; ping-pong reply queues never hold more than K.
+	OccupancySampler occupancy(actual.mq_maxmsg, cfg.queues, cfg.occupancyIntervalUs, [&](int q) -> long {
+		mq_attr now{};
+		return mq_getattr(queues[static_cast<size_t>(q)], &now) == 0 ? now.mq_curmsgs : -1;
+	});
+	occupancy.start();
 
+	rusage usageStart{};
+	getrusage(RUSAGE_SELF, &usageStart);
 	const auto start = chrono::steady_clock::now();
-	const auto endTime = start + chrono::seconds(cfg.durationSeconds);
+	const auto endTime = start + chrono::seconds(cfg.warmupSeconds + cfg.durationSeconds);
+	// --warmup-seconds: at the first interval boundary past the warmup, every
+	// counter and histogram is snapshotted; the summary reports the difference.
+	auto measureStart = start;
+	bool warmedUp = cfg.warmupSeconds == 0;
+	vector<MqCounters> warmupProducers;
+	vector<MqCounters> warmupConsumers;
+	vector<LatencyHistogram> warmupHists;
+	MqStats prevSnap;
+	unique_ptr<LatencyHistogram> prevHist = make_unique<LatencyHistogram>();
+	vector<IntervalSample> intervals;
+	const bool trackIntervals = intervalFile || !cfg.resultsPath.empty();
+	auto prevTime = start;
+	int interval = 0;
 	while (chrono::steady_clock::now() < endTime && !stopFlag.load(memory_order_relaxed)) {
 		this_thread::sleep_for(chrono::seconds(cfg.printIntervalSeconds));
-		uint64_t sent = stats.sentMessages.load(memory_order_relaxed);
-		uint64_t recv = stats.recvMessages.load(memory_order_relaxed);
-		uint64_t sbytes = stats.sentBytes.load(memory_order_relaxed);
-		uint64_t rbytes = stats.recvBytes.load(memory_order_relaxed);
-		cout << "Progress: sent=" << sent << " recv=" << recv
-		     << " sentMiB=" << fixed << setprecision(2) << (double)sbytes / (1024.0 * 1024.0)
-		     << " recvMiB=" << fixed << setprecision(2) << (double)rbytes / (1024.0 * 1024.0)
-		     << "\n";
+		MqStats snap = sumMqCounters(producerSlots, cfg.producers, consumerSlots, cfg.consumers);
+		auto now = chrono::steady_clock::now();
+		cout << "Progress: sent=" << snap.sentMessages << " recv=" << snap.recvMessages
+		     << " sentMiB=" << fixed << setprecision(2) << (double)snap.sentBytes / (1024.0 * 1024.0)
+		     << " recvMiB=" << fixed << setprecision(2) << (double)snap.recvBytes / (1024.0 * 1024.0)
+		     << (warmedUp ? "" : " (warmup)") << "\n";
 		cout.flush();
+		if (trackIntervals) {
+			double dt = chrono::duration<double>(now - prevTime).count();
+			unique_ptr<LatencyHistogram> cur = mergedNow();
+			auto delta = make_unique<LatencyHistogram>(*cur);
+			delta->subtract(*prevHist);
+			vector<pair<double, double>> pu;
+			computePercentiles(*delta, pu);
+			IntervalSample sample;
+			sample.tSec = chrono::duration<double>(now - start).count();
+			sample.warmup = !warmedUp;
+			sample.sent = snap.sentMessages - prevSnap.sentMessages;
+			sample.recv = snap.recvMessages - prevSnap.recvMessages;
+			if (pu.size() >= 7) {
+				sample.p50us = pu[0].second;
+				sample.p99us = pu[3].second;
+			}
+			intervals.push_back(sample);
+			if (intervalFile) {
+				fprintf(intervalFile, "%s,%s,%d,%.3f,%d,%llu,%llu,%.2f,%.2f,%.2f,%llu,%llu,%llu,%.2f,%.2f,%.2f\n",
+				        runId.c_str(), backendName, interval, sample.tSec, sample.warmup ? 1 : 0,
+				        static_cast<unsigned long long>(sample.sent), static_cast<unsigned long long>(sample.recv),
+				        sample.sent / dt, sample.recv / dt,
+				        ((snap.recvBytes - prevSnap.recvBytes) / (1024.0 * 1024.0)) / dt,
+				        static_cast<unsigned long long>(snap.sendEagain - prevSnap.sendEagain),
+				        static_cast<unsigned long long>(snap.recvEagain - prevSnap.recvEagain),
+				        static_cast<unsigned long long>(delta->total), sample.p50us, sample.p99us,
+				        pu.size() >= 7 ? pu[6].second : NAN);
+				fflush(intervalFile);
+			}
+			prevHist = move(cur);
+		}
+		prevSnap = snap;
+		prevTime = now;
+		interval++;
+		if (!warmedUp && now - start >= chrono::seconds(cfg.warmupSeconds)) {
+			warmupProducers = snapshotSlots(producerSlots, cfg.producers);
+			warmupConsumers = snapshotSlots(consumerSlots, cfg.consumers);
+			for (int i = 0; i < recorders; ++i) {
+				for (int k = 0; k < histsPerConsumer; ++k) {
+					warmupHists.emplace_back();
+					warmupHists.back().loadFrom(histogramsFor(i)[k]);
+				}
+			}
+			getrusage(RUSAGE_SELF, &usageStart);
+			occupancy.reset();
+			measureStart = now;
+			warmedUp = true;
+		}
 	}
 	stopFlag.store(true, memory_order_relaxed);
+	occupancy.stop();
+	if (intervalFile) fclose(intervalFile);
 
 	for (auto& t : threads) t.join();
+	stopWorkers(children);
 
 	const auto end = chrono::steady_clock::now();
-	double elapsedSec = chrono::duration<double>(end - start).count();
+	double elapsedSec = chrono::duration<double>(end - measureStart).count();
 	if (elapsedSec <= 0) elapsedSec = static_cast<double>(cfg.durationSeconds);
 
-	uint64_t sent = stats.sentMessages.load(memory_order_relaxed);
-	uint64_t recv = stats.recvMessages.load(memory_order_relaxed);
-	uint64_t sbytes = stats.sentBytes.load(memory_order_relaxed);
-	uint64_t rbytes = stats.recvBytes.load(memory_order_relaxed);
+	// Past the warmup, report only what happened after it: swap in per-slot
+	// and per-histogram deltas against the snapshot taken at the boundary.
+	vector<MqCounters> measuredProducers;
+	vector<MqCounters> measuredConsumers;
+	vector<LatencyHistogram> measuredHists;
+	// Whole-run receive count, for figures that cannot exclude the warmup
+	// (perf counters, and child rusage in process mode).
+	const uint64_t lifetimeRecv = sumMqCounters(producerSlots, cfg.producers, consumerSlots, cfg.consumers).recvMessages;
+	if (!warmupHists.empty() || !warmupProducers.empty()) {
+		measuredProducers = snapshotSlots(producerSlots, cfg.producers);
+		measuredConsumers = snapshotSlots(consumerSlots, cfg.consumers);
+		subtractSlots(measuredProducers, warmupProducers);
+		subtractSlots(measuredConsumers, warmupConsumers);
+		producerSlots = measuredProducers.data();
+		consumerSlots = measuredConsumers.data();
+		for (int i = 0; i < recorders; ++i) {
+			for (int k = 0; k < histsPerConsumer; ++k) {
+				measuredHists.push_back(histogramsFor(i)[k]);
+				measuredHists.back().subtract(warmupHists[measuredHists.size() - 1]);
+			}
+		}
+		summaryHists = &measuredHists;
+	}
+
+	// CPU spent by all producers and consumers: this process in thread mode
+	// (since the warmup), the reaped children in process mode (whole run, as
+	// RUSAGE_CHILDREN is only known after reaping).
+	auto tvSec = [](const timeval& tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+	rusage usageEnd{};
+	getrusage(cfg.processMode ? RUSAGE_CHILDREN : RUSAGE_SELF, &usageEnd);
+	double cpuUserSec = tvSec(usageEnd.ru_utime) - (cfg.processMode ? 0.0 : tvSec(usageStart.ru_utime));
+	double cpuSysSec = tvSec(usageEnd.ru_stime) - (cfg.processMode ? 0.0 : tvSec(usageStart.ru_stime));
+	double cpuWindowSec = cfg.processMode ? chrono::duration<double>(end - start).count() : elapsedSec;
+	double cpuUtilPct = 100.0 * (cpuUserSec + cpuSysSec) / cpuWindowSec;
+	uint64_t volCtxSw = static_cast<uint64_t>(usageEnd.ru_nvcsw - (cfg.processMode ? 0 : usageStart.ru_nvcsw));
+	uint64_t involCtxSw = static_cast<uint64_t>(usageEnd.ru_nivcsw - (cfg.processMode ? 0 : usageStart.ru_nivcsw));
+	// What the queues charge against RLIMIT_MSGQUEUE, and the resident set of
+	// this process (plus the largest worker in process mode).
+	const long long kernelCharge = mqueueCharge(actual.mq_maxmsg, actual.mq_msgsize) * queueCount(cfg);
+	const long long rlimitBytes = msgqueueLimit();
+	const long peakRss = peakRssKiB();
+	const long childPeakRss = cfg.processMode ? peakRssKiB(true) : 0;
+
+	MqStats stats = sumMqCounters(producerSlots, cfg.producers, consumerSlots, cfg.consumers);
+	uint64_t sent = stats.sentMessages;
+	uint64_t recv = stats.recvMessages;
+	uint64_t sbytes = stats.sentBytes;
+	uint64_t rbytes = stats.recvBytes;
 
 	double recvMsgPerSec = recv / elapsedSec;
-	double recvMBps = (rbytes / (1024.0 * 1024.0)) / elapsedSec;
+	double recvSyscallsPerSec = stats.recvSyscalls / elapsedSec;
+	double sendSyscallsPerSec = stats.sendSyscalls / elapsedSec;
 
-	vector<uint64_t> latCopyNs;
-	{
-		lock_guard<mutex> lock(latRecorder.mtx);
-		latCopyNs = latRecorder.samplesNs;
+	auto merged = make_unique<LatencyHistogram>();
+	vector<unique_ptr<LatencyHistogram>> byClass;
+	for (int k = 0; k < classes; ++k) {
+		byClass.push_back(make_unique<LatencyHistogram>());
+		for (int i = 0; i < recorders; ++i) byClass.back()->merge(histogramsFor(i)[k]);
+		merged->merge(*byClass.back());
 	}
 	vector<pair<double, double>> pctUs;
-	computePercentiles(latCopyNs, pctUs);
+	computePercentiles(*merged, pctUs);
 
 	cout << "\nSummary:\n";
-	cout << "  elapsed-sec:         " << fixed << setprecision(3) << elapsedSec << "\n";
-	cout << "  messages-sent:       " << sent << "\n";
-	cout << "  messages-recv:       " << recv << "\n";
-	cout << "  bytes-sent:          " << sbytes << "\n";
-	cout << "  bytes-recv:          " << rbytes << "\n";
-	cout << "  throughput-msg/s:    " << fixed << setprecision(2) << recvMsgPerSec << "\n";
-	cout << "  throughput-MiB/s:    " << fixed << setprecision(2) << recvMBps << "\n";
-	cout << "  send-errors:         " << stats.sendErrors.load() << " (EAGAIN " << stats.sendEagain.load() << ")\n";
-	cout << "  recv-errors:         " << stats.recvErrors.load() << " (EAGAIN " << stats.recvEagain.load() << ")\n";
-	if (!pctUs.empty()) {
-		cout << "  latency-us (p50,p90,p95,p99,p99.9):";
-		for (auto& p : pctUs) {
-			cout << " p" << fixed << setprecision(3) << (p.first * 100.0) << "=" << fixed << setprecision(2) << p.second;
+	printThroughputSummary(elapsedSec, sent, recv, sbytes, rbytes);
+	cout << "  syscall-msg/s:       recv=" << fixed << setprecision(2) << recvSyscallsPerSec
+	     << " send=" << sendSyscallsPerSec << " (batch " << cfg.batch << ")\n";
+	if (cfg.pingPong > 0) {
+		cout << "  ping-pong:           round-trips=" << stats.roundTrips << " (" << fixed << setprecision(2)
+		     << stats.roundTrips / elapsedSec << "/s) in-flight=" << cfg.pingPong << " x " << cfg.producers
+		     << " clients; latency-us below is the round trip\n";
+	}
+	printOfferedRate(cfg, sent, elapsedSec);
+	printWorkSummary(cfg, stats.workNs, recv, elapsedSec, cfg.consumers);
+	cout << "  cpu-sec:             user=" << fixed << setprecision(3) << cpuUserSec << " sys=" << cpuSysSec
+	     << " util=" << fixed << setprecision(1) << cpuUtilPct << "%\n";
+	const uint64_t cpuWindowRecv = cfg.processMode ? lifetimeRecv : recv;
+	auto perMsg = [](uint64_t v, uint64_t msgs) { return msgs ? static_cast<double>(v) / static_cast<double>(msgs) : 0.0; };
+	cout << "  ctx-switches:        voluntary=" << volCtxSw << " involuntary=" << involCtxSw
+	     << " per-msg=" << fixed << setprecision(4) << perMsg(volCtxSw, cpuWindowRecv)
+	     << "/" << perMsg(involCtxSw, cpuWindowRecv) << " (getrusage)\n";
+	if (cfg.perf) {
+		cout << "  perf-per-msg:       ";
+		for (int e = 0; e < 5; ++e) {
+			cout << " " << kPerfEventNames[e] << "=";
+			if (stats.perfMissing & (uint64_t(1) << e)) cout << "n/a";
+			else cout << fixed << setprecision(e < 3 ? 1 : 4) << perMsg(stats.perfEvents[e], lifetimeRecv);
+		}
+		if (!(stats.perfMissing & 3) && stats.perfEvents[0]) {
+			cout << " ipc=" << fixed << setprecision(2)
+			     << static_cast<double>(stats.perfEvents[1]) / static_cast<double>(stats.perfEvents[0]);
+		}
+		cout << (stats.perfUserOnly ? " (user space only)" : "") << "\n";
+	}
+	if (cfg.consumerWait != "timed") {
+		double perWakeup = stats.recvWakeups ? static_cast<double>(stats.recvSyscalls) / static_cast<double>(stats.recvWakeups) : 0.0;
+		cout << "  consumer-wakeups:    " << stats.recvWakeups << " (" << cfg.consumerWait
+		     << ", receives/wakeup=" << fixed << setprecision(2) << perWakeup << ")\n";
+	}
+	cout << "  backoff:             " << cfg.backoff << " spins=" << stats.spins
+	     << " yields=" << stats.yields << " sleeps=" << stats.sleeps << "\n";
+	cout << "  send-errors:         " << stats.sendErrors << " (EAGAIN " << stats.sendEagain << ")\n";
+	cout << "  recv-errors:         " << stats.recvErrors << " (EAGAIN " << stats.recvEagain << ")\n";
+	// Per producer: records that passed the checksum across all consumers,
+	// and how many below the highest sequence seen never arrived.
+	uint64_t verifyMissing = 0;
+	uint64_t verifyDuplicated = 0;
+	uint64_t verifyReordered = 0;
+	if (cfg.verify) {
+		vector<string> perProducer;
+		for (int p = 0; p < cfg.producers; ++p) {
+			uint64_t count = 0, highest = 0, reordered = 0;
+			for (int i = 0; i < cfg.consumers; ++i) {
+				const VerifyState& v = verifyFor(i)[p];
+				if (v.count == 0) continue;
+				highest = count == 0 ? v.maxSeq : max(highest, v.maxSeq);
+				count += v.count;
+				reordered += v.reordered;
+			}
+			uint64_t expected = count ? highest + 1 : 0;
+			uint64_t missing = expected > count ? expected - count : 0;
+			uint64_t duplicated = count > expected ? count - expected : 0;
+			verifyMissing += missing;
+			verifyDuplicated += duplicated;
+			verifyReordered += reordered;
+			perProducer.push_back("  verify[" + to_string(p) + "]:");
+			perProducer.back() += string(perProducer.back().size() < 23 ? 23 - perProducer.back().size() : 1, ' ') +
+			                      "ok=" + to_string(count) + " highest-seq=" + to_string(highest) +
+			                      " missing=" + to_string(missing) + " duplicated=" + to_string(duplicated) +
+			                      " reordered=" + to_string(reordered);
+		}
+		cout << "  verify:              crc32c/" << crc32cImplementation() << " corrupt=" << stats.corrupt
+		     << " missing=" << verifyMissing << " duplicated=" << verifyDuplicated
+		     << " reordered=" << verifyReordered << "\n";
+		for (const string& line : perProducer) cout << line << "\n";
+	}
+	for (int i = 0; i < cfg.producers; ++i) {
+		const MqCounters& c = producerSlots[i];
+		cout << "  producer[" << i << "]:         sent=" << c.messages.load()
+		     << " msg/s=" << fixed << setprecision(2) << c.messages.load() / elapsedSec
+		     << " errors=" << c.errors.load() << " eagain=" << c.eagain.load() << "\n";
+	}
+	for (int i = 0; i < cfg.consumers; ++i) {
+		const MqCounters& c = consumerSlots[i];
+		double share = recv ? 100.0 * static_cast<double>(c.messages.load()) / static_cast<double>(recv) : 0.0;
+		cout << "  consumer[" << i << "]:         recv=" << c.messages.load()
+		     << " msg/s=" << fixed << setprecision(2) << c.messages.load() / elapsedSec
+		     << " share=" << fixed << setprecision(1) << share << "%"
+		     << " errors=" << c.errors.load() << " eagain=" << c.eagain.load() << "\n";
+	}
+	printLatencySummary(pctUs);
+	printOccupancySummary(occupancy, cfg.queues, cfg.queues > 1 ? "mq_curmsgs per queue" : "mq_curmsgs", recvMsgPerSec);
+	cout << "  memory:              kernel-charge=" << kernelCharge << " B (" << queueCount(cfg) << " x "
+	     << actual.mq_maxmsg << " x (" << actual.mq_msgsize << " + 48) + tree nodes, RLIMIT_MSGQUEUE="
+	     << (rlimitBytes < 0 ? string("unlimited") : to_string(rlimitBytes)) << ") peak-rss=" << peakRss << " KiB";
+	if (cfg.processMode) cout << " (largest worker " << childPeakRss << " KiB)";
+	cout << "\n";
+	// Per priority class: share of the latency samples and p50/p99/p99.9/max.
+	vector<vector<pair<double, double>>> classPctUs(static_cast<size_t>(classes));
+	if (classes > 1 && merged->total > 0) {
+		for (int k = 0; k < classes; ++k) {
+			const LatencyHistogram& h = *byClass[static_cast<size_t>(k)];
+			computePercentiles(h, classPctUs[static_cast<size_t>(k)]);
+			string key = "  latency-prio-" + to_string(cfg.priorities.prios[static_cast<size_t>(k)]) + ":";
+			cout << key << string(key.size() < 23 ? 23 - key.size() : 1, ' ')
+			     << "n=" << h.total << " (" << fixed << setprecision(1)
+			     << 100.0 * static_cast<double>(h.total) / static_cast<double>(merged->total) << "%)";
+			const vector<pair<double, double>>& pu = classPctUs[static_cast<size_t>(k)];
+			if (pu.size() >= 7) {
+				cout << fixed << setprecision(2) << " p50=" << pu[0].second << " p99=" << pu[3].second
+				     << " p99.9=" << pu[4].second << " max=" << pu[6].second;
+			}
+			cout << "\n";
+		}
+	}
+	// Per size bucket: share of messages, throughput and latency.
+	vector<pair<size_t, vector<pair<double, double>>>> sizePctUs;
+	uint64_t sizeTotal = 0;
+	vector<unique_ptr<LatencyHistogram>> bySize;
+	for (int b = 0; b < sizeBuckets; ++b) {
+		bySize.push_back(make_unique<LatencyHistogram>());
+		for (int i = 0; i < recorders; ++i) bySize.back()->merge(histogramsFor(i)[classes + b]);
+		sizeTotal += bySize.back()->total;
+	}
+	if (cfg.sizes.variable()) {
+		cout << "  mean-size:           " << fixed << setprecision(1)
+		     << (recv ? static_cast<double>(rbytes) / static_cast<double>(recv) : 0.0) << " B (" << cfg.sizes.kind << ")\n";
+	}
+	for (int b = 0; b < sizeBuckets; ++b) {
+		const LatencyHistogram& h = *bySize[static_cast<size_t>(b)];
+		if (h.total == 0) continue;
+		sizePctUs.push_back({size_t(1) << b, {}});
+		computePercentiles(h, sizePctUs.back().second);
+		const vector<pair<double, double>>& pu = sizePctUs.back().second;
+		string key = "  size-" + to_string(size_t(1) << b) + "-" + to_string((size_t(2) << b) - 1) + "B:";
+		cout << key << string(key.size() < 23 ? 23 - key.size() : 1, ' ')
+		     << "n=" << h.total << " (" << fixed << setprecision(1)
+		     << 100.0 * static_cast<double>(h.total) / static_cast<double>(sizeTotal) << "%)"
+		     << fixed << setprecision(2) << " msg/s=" << h.total / elapsedSec
+		     << " p50=" << pu[0].second << " p99=" << pu[3].second << " max=" << pu[6].second << "\n";
+	}
+
+	string extra;
+	if (cfg.rate > 0.0) appendExtra(extra, "rate", formatDouble(cfg.rate));
+	appendExtra(extra, "consumerWait", cfg.consumerWait);
+	appendExtra(extra, "placement", placement);
+	if (cfg.queues > 1) {
+		appendExtra(extra, "queues", to_string(cfg.queues));
+		appendExtra(extra, "routing", cfg.routing);
+	}
+	if (cfg.pingPong > 0) {
+		appendExtra(extra, "pingPong", to_string(cfg.pingPong));
+		appendExtra(extra, "roundTrips", to_string(stats.roundTrips));
+		appendExtra(extra, "roundTripsPerSec", formatDouble(stats.roundTrips / elapsedSec));
+	}
+	if (cfg.warmupSeconds > 0) appendExtra(extra, "warmupSec", to_string(cfg.warmupSeconds));
+	if (trackIntervals) appendExtra(extra, "runId", runId);
+	if (cfg.repeat > 1) {
+		appendExtra(extra, "repeat", to_string(cfg.repeatIndex));
+		appendExtra(extra, "repeatOf", to_string(cfg.repeat));
+	}
+	if (cfg.verify) {
+		appendExtra(extra, "verify", crc32cImplementation());
+		appendExtra(extra, "corrupt", to_string(stats.corrupt));
+		appendExtra(extra, "missing", to_string(verifyMissing));
+		appendExtra(extra, "duplicated", to_string(verifyDuplicated));
+		appendExtra(extra, "reordered", to_string(verifyReordered));
+	}
+	if (cfg.sizes.variable()) {
+		appendExtra(extra, "sizeDist", extraSpec(cfg.sizeDist));
+		appendExtra(extra, "meanSize", formatDouble(recv ? static_cast<double>(rbytes) / static_cast<double>(recv) : 0.0, 1));
+		for (const auto& sp : sizePctUs) {
+			string tag = "size" + to_string(sp.first);
+			appendExtra(extra, tag + "N", to_string(bySize[sizeBucketFor(sp.first)]->total));
+			appendExtra(extra, tag + "P50us", formatDouble(sp.second[0].second));
+			appendExtra(extra, tag + "P99us", formatDouble(sp.second[3].second));
+		}
+	}
+	if (!cfg.priorityMix.empty()) appendExtra(extra, "priorityMix", extraSpec(cfg.priorityMix));
+	for (int k = 0; k < classes && classes > 1; ++k) {
+		const vector<pair<double, double>>& pu = classPctUs[static_cast<size_t>(k)];
+		if (pu.size() < 7) continue;
+		string tag = "prio" + to_string(cfg.priorities.prios[static_cast<size_t>(k)]);
+		appendExtra(extra, tag + "N", to_string(byClass[static_cast<size_t>(k)]->total));
+		appendExtra(extra, tag + "P50us", formatDouble(pu[0].second));
+		appendExtra(extra, tag + "P99us", formatDouble(pu[3].second));
+		appendExtra(extra, tag + "P999us", formatDouble(pu[4].second));
+		appendExtra(extra, tag + "Maxus", formatDouble(pu[6].second));
+	}
+	if (placement == "none" && cfg.placement != "none") appendExtra(extra, "requestedPlacement", cfg.placement);
+	if (placement != "none") {
+		appendExtra(extra, "producerCpus", formatCpuList(producerCpus));
+		appendExtra(extra, "consumerCpus", formatCpuList(consumerCpus));
+	}
+	appendExtra(extra, "cpuUtilPct", formatDouble(cpuUtilPct, 1));
+	appendOccupancyExtras(extra, occupancy, cfg.queues, recvMsgPerSec);
+	appendExtra(extra, "kernelChargeBytes", to_string(kernelCharge));
+	appendExtra(extra, "peakRssKiB", to_string(peakRss));
+	if (cfg.processMode) appendExtra(extra, "childPeakRssKiB", to_string(childPeakRss));
+	appendExtra(extra, "volCsPerMsg", formatDouble(perMsg(volCtxSw, cpuWindowRecv), 4));
+	appendExtra(extra, "involCsPerMsg", formatDouble(perMsg(involCtxSw, cpuWindowRecv), 4));
+	if (cfg.perf) {
+		static const char* const keys[5] = {"cyclesPerMsg", "instrPerMsg", "cacheMissPerMsg", "ctxSwPerMsg", "migrationsPerMsg"};
+		for (int e = 0; e < 5; ++e) {
+			if (stats.perfMissing & (uint64_t(1) << e)) continue;
+			appendExtra(extra, keys[e], formatDouble(perMsg(stats.perfEvents[e], lifetimeRecv), e < 3 ? 1 : 4));
+		}
+		if (stats.perfUserOnly) appendExtra(extra, "perfScope", "user");
+	}
+	if (cfg.consumerWait != "timed") appendExtra(extra, "wakeups", to_string(stats.recvWakeups));
+	appendExtra(extra, "backoff", cfg.backoff);
+	appendExtra(extra, "spins", to_string(stats.spins));
+	appendExtra(extra, "yields", to_string(stats.yields));
+	appendExtra(extra, "sleeps", to_string(stats.sleeps));
+	if (cfg.batch > 1) {
+		appendExtra(extra, "batch", to_string(cfg.batch));
+		appendExtra(extra, "recvSyscallsPerSec", formatDouble(recvSyscallsPerSec));
+	}
+
+	appendCsvRow(cfg, backendName, elapsedSec, recv, rbytes, pctUs, extra, stats.workNs, 0, merged.get(), move(intervals));
+	result.msgPerSec = recvMsgPerSec;
+	if (pctUs.size() >= 7) result.p99us = pctUs[3].second;
+	result.extra = extra;
+
+	if (shared) shared->destroy();
+	closeQueues();
+	return 0;
+}
+
+// --stages S: producers feed NAME.stage0 and the readers of stage k forward
+// to NAME.stage<k+1>, each stage with its own reader count. Every stage
+// reports its throughput, the occupancy of its input queue and the latency of
+// the hop into it; the last stage also records end-to-end latency. The
+// bottleneck is the stage in front of which messages pile up: the one whose
+// input queue has the highest mean occupancy (with sampling off, the stage
+// with the lowest throughput). Its throughput bounds the whole pipeline.
+static int runPipeline(Config cfg, RunResult& result) {
+	const int stages = cfg.stages;
+	auto stageName = [&](int k) { return cfg.queueName + ".stage" + to_string(k); };
+	if (cfg.unlinkAtStart) {
+		for (int k = 0; k < stages; ++k) mq_unlink(stageName(k).c_str());
+	}
+
+	mq_attr attr{};
+	queueAttrFor(cfg, attr);
+	int oflags = O_CREAT | O_RDWR;
+	if (cfg.nonBlocking) oflags |= O_NONBLOCK;
+
+	vector<mqd_t> queues;
+	auto closeQueues = [&] {
+		for (mqd_t d : queues) mq_close(d);
+		if (cfg.unlinkAtEnd) {
+			for (int k = 0; k < stages; ++k) mq_unlink(stageName(k).c_str());
+		}
+	};
+	for (int k = 0; k < stages; ++k) {
+		mqd_t d = mq_open(stageName(k).c_str(), oflags, 0600, &attr);
+		if (d == (mqd_t)-1) {
+			perror("mq_open");
+			cerr << "Failed to open queue " << stageName(k) << ". On Linux, you may need to adjust /proc/sys/fs/mqueue/msg_max, msgsize_max or queues_max.\n";
+			closeQueues();
+			return 2;
+		}
+		queues.push_back(d);
+	}
+	mq_attr actual{};
+	if (mq_getattr(queues[0], &actual) == -1) {
+		perror("mq_getattr");
+		closeQueues();
+		return 2;
+	}
+
+	cout << "Effective mq attributes:\n";
+	cout << "  mq_flags:    " << actual.mq_flags << "\n";
+	cout << "  mq_maxmsg:   " << actual.mq_maxmsg << "\n";
+	cout << "  mq_msgsize:  " << actual.mq_msgsize << "\n";
+	cout << "  pipeline:    " << stages << " x " << cfg.queueName << ".stageN, readers";
+	for (long r : cfg.stageReaders) cout << " " << r;
+	cout << "\n";
+	cout.flush();
+
+	// Readers of all stages in order; firstReader[k] is stage k's first slot.
+	vector<int> firstReader(static_cast<size_t>(stages) + 1, 0);
+	for (int k = 0; k < stages; ++k) firstReader[static_cast<size_t>(k) + 1] = firstReader[static_cast<size_t>(k)] + static_cast<int>(cfg.stageReaders[static_cast<size_t>(k)]);
+	const int readers = firstReader.back();
+	const int lastReaders = static_cast<int>(cfg.stageReaders.back());
+	vector<MqCounters> producerSlots(static_cast<size_t>(cfg.producers));
+	vector<MqCounters> readerSlots(static_cast<size_t>(readers));
+	vector<LatencyHistogram> hopHists(static_cast<size_t>(readers));
+	vector<LatencyHistogram> e2eHists(static_cast<size_t>(lastReaders));
+
+	vector<unique_ptr<OccupancySampler>> occupancy;
+	for (int k = 0; k < stages; ++k) {
+		mqd_t q = queues[static_cast<size_t>(k)];
+		occupancy.push_back(make_unique<OccupancySampler>(actual.mq_maxmsg, 1, cfg.occupancyIntervalUs, [q](int) -> long {
+			mq_attr now{};
+			return mq_getattr(q, &now) == 0 ? now.mq_curmsgs : -1;
+		}));
+		occupancy.back()->start();
+	}
+
+	vector<thread> threads;
+	threads.reserve(static_cast<size_t>(cfg.producers + readers));
+	for (int k = 0; k < stages; ++k) {
+		for (int r = firstReader[static_cast<size_t>(k)]; r < firstReader[static_cast<size_t>(k) + 1]; ++r) {
+			mqd_t in = queues[static_cast<size_t>(k)];
+			mqd_t out = k + 1 < stages ? queues[static_cast<size_t>(k) + 1] : (mqd_t)-1;
+			LatencyHistogram* e2e = k + 1 < stages ? nullptr : &e2eHists[static_cast<size_t>(r - firstReader[static_cast<size_t>(k)])];
+			threads.emplace_back([&, in, out, k, r, e2e] {
+				stageThread(in, out, k, cfg, readerSlots[static_cast<size_t>(r)], hopHists[static_cast<size_t>(r)], e2e);
+			});
+		}
+	}
+	const vector<mqd_t> firstQueue{queues[0]};
+	for (int i = 0; i < cfg.producers; ++i) {
+		threads.emplace_back([&, i] { producerThread(firstQueue, cfg, producerSlots[static_cast<size_t>(i)], i); });
+	}
+
+	auto sumSlots = [](const MqCounters* slots, int from, int to, atomic<uint64_t> MqCounters::* field) {
+		uint64_t n = 0;
+		for (int i = from; i < to; ++i) n += (slots[i].*field).load(memory_order_relaxed);
+		return n;
+	};
+	auto stageSum = [&](int k, atomic<uint64_t> MqCounters::* field) {
+		return sumSlots(readerSlots.data(), firstReader[static_cast<size_t>(k)], firstReader[static_cast<size_t>(k) + 1], field);
+	};
+
+	const auto start = chrono::steady_clock::now();
+	const auto endTime = start + chrono::seconds(cfg.durationSeconds);
+	IntervalSeries intervals;
+	while (chrono::steady_clock::now() < endTime && !stopFlag.load(memory_order_relaxed)) {
+		this_thread::sleep_for(chrono::seconds(cfg.printIntervalSeconds));
+		const uint64_t sentNow = sumSlots(producerSlots.data(), 0, cfg.producers, &MqCounters::messages);
+		intervals.add(chrono::duration<double>(chrono::steady_clock::now() - start).count(), sentNow,
+		              stageSum(stages - 1, &MqCounters::messages));
+		cout << "Progress: sent=" << sentNow;
+		for (int k = 0; k < stages; ++k) cout << " stage" << k << "=" << stageSum(k, &MqCounters::messages);
+		cout << "\n";
+		cout.flush();
+	}
+	stopFlag.store(true, memory_order_relaxed);
+	for (auto& o : occupancy) o->stop();
+	for (auto& t : threads) t.join();
+
+	const auto end = chrono::steady_clock::now();
+	double elapsedSec = chrono::duration<double>(end - start).count();
+	if (elapsedSec <= 0) elapsedSec = static_cast<double>(cfg.durationSeconds);
+
+	const uint64_t sent = sumSlots(producerSlots.data(), 0, cfg.producers, &MqCounters::messages);
+	const uint64_t sbytes = sumSlots(producerSlots.data(), 0, cfg.producers, &MqCounters::bytes);
+	const uint64_t recv = stageSum(stages - 1, &MqCounters::messages);
+	const uint64_t rbytes = stageSum(stages - 1, &MqCounters::bytes);
+	const uint64_t workNs = sumSlots(readerSlots.data(), 0, readers, &MqCounters::workNs);
+
+	auto e2e = make_unique<LatencyHistogram>();
+	for (const LatencyHistogram& h : e2eHists) e2e->merge(h);
+	vector<pair<double, double>> pctUs;
+	computePercentiles(*e2e, pctUs);
+
+	struct StageResult {
+		uint64_t recv = 0;
+		double msgPerSec = 0.0;
+		OccupancyStats occ;
+		vector<pair<double, double>> hopPctUs;
+	};
+	vector<StageResult> stageResults(static_cast<size_t>(stages));
+	int bottleneck = 0;
+	for (int k = 0; k < stages; ++k) {
+		StageResult& sr = stageResults[static_cast<size_t>(k)];
+		sr.recv = stageSum(k, &MqCounters::messages);
+		sr.msgPerSec = sr.recv / elapsedSec;
+		sr.occ = occupancy[static_cast<size_t>(k)]->stats();
+		auto hop = make_unique<LatencyHistogram>();
+		for (int r = firstReader[static_cast<size_t>(k)]; r < firstReader[static_cast<size_t>(k) + 1]; ++r) hop->merge(hopHists[static_cast<size_t>(r)]);
+		computePercentiles(*hop, sr.hopPctUs);
+		const StageResult& best = stageResults[static_cast<size_t>(bottleneck)];
+		if (cfg.occupancyIntervalUs > 0 ? sr.occ.mean > best.occ.mean : sr.msgPerSec < best.msgPerSec) bottleneck = k;
+	}
+
+	cout << "\nPipeline Summary:\n";
+	printThroughputSummary(elapsedSec, sent, recv, sbytes, rbytes);
+	printOfferedRate(cfg, sent, elapsedSec);
+	printWorkSummary(cfg, workNs, recv, elapsedSec, readers);
+	for (int k = 0; k < stages; ++k) {
+		const StageResult& sr = stageResults[static_cast<size_t>(k)];
+		string key = "  stage[" + to_string(k) + "]:";
+		cout << key << string(key.size() < 23 ? 23 - key.size() : 1, ' ')
+		     << "readers=" << cfg.stageReaders[static_cast<size_t>(k)] << " recv=" << sr.recv
+		     << " msg/s=" << fixed << setprecision(2) << sr.msgPerSec
+		     << " errors=" << stageSum(k, &MqCounters::errors) << " eagain=" << stageSum(k, &MqCounters::eagain);
+		if (cfg.occupancyIntervalUs > 0) {
+			cout << " queue-mean=" << setprecision(2) << sr.occ.mean << "/" << actual.mq_maxmsg
+			     << " full=" << setprecision(1) << sr.occ.fullPct << "%";
+		}
+		const vector<pair<double, double>>& pu = sr.hopPctUs;
+		if (pu.size() >= 7) {
+			cout << fixed << setprecision(2) << " hop-us p50=" << pu[0].second << " p99=" << pu[3].second
+			     << " p99.9=" << pu[4].second << " max=" << pu[6].second;
 		}
 		cout << "\n";
+	}
+	const StageResult& slowest = stageResults[static_cast<size_t>(bottleneck)];
+	cout << "  bottleneck:          stage " << bottleneck << " msg/s=" << fixed << setprecision(2) << slowest.msgPerSec;
+	if (cfg.occupancyIntervalUs > 0) {
+		cout << " (fullest input queue, mean=" << slowest.occ.mean << "/" << actual.mq_maxmsg << ")\n";
 	} else {
-		cout << "  latency-us:          not available (message-size < header)\n";
+		cout << " (lowest throughput; occupancy sampling is off)\n";
 	}
+	cout << "  end-to-end:          producer intended send to last-stage completion, below\n";
+	printLatencySummary(pctUs);
 
-	if (!cfg.csvPath.empty()) {
-		FILE* f = fopen(cfg.csvPath.c_str(), "a");
-		if (!f) {
-			perror("fopen csv");
-		} else {
-			double p50 = NAN, p90 = NAN, p95 = NAN, p99 = NAN, p999 = NAN;
-			if (pctUs.size() >= 5) {
-				p50 = pctUs[0].second; p90 = pctUs[1].second; p95 = pctUs[2].second; p99 = pctUs[3].second; p999 = pctUs[4].second;
-			}
-			fprintf(f,
-			        "%s,%s,%d,%zu,%ld,%d,%d,%d,%d,%zu,%.6f,%llu,%llu,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
-			        "mqueue",
-			        cfg.queueName.c_str(),
-			        cfg.durationSeconds,
-			        cfg.messageSize,
-			        cfg.maxMessages,
-			        cfg.producers,
-			        cfg.consumers,
-			        cfg.nonBlocking ? 1 : 0,
-			        cfg.randomPayload ? 1 : 0,
-			        cfg.latencySample,
-			        elapsedSec,
-			        static_cast<unsigned long long>(recv),
-			        static_cast<unsigned long long>(rbytes),
-			        recvMsgPerSec,
-			        recvMBps,
-			        p50, p90, p95, p99, p999);
-			fclose(f);
-		}
-	}
-
-	if (cfg.unlinkAtEnd) {
-		mq_unlink(cfg.queueName.c_str());
-	}
-	mq_close(mq);
+	string extra;
+	string readerList;
+	for (long r : cfg.stageReaders) readerList += (readerList.empty() ? "" : "/") + to_string(r);
+	appendExtra(extra, "stages", to_string(stages));
+	appendExtra(extra, "stageReaders", readerList);
+	if (cfg.rate > 0.0) appendExtra(extra, "rate", formatDouble(cfg.rate));
+	if (cfg.repeat > 1) {
+		appendExtra(extra, "repeat", to_string(cfg.repeatIndex));
+		appendExtra(extra, "repeatOf", to_string(cfg.repeat));
+	}
+	for (int k = 0; k < stages; ++k) {
+		const StageResult& sr = stageResults[static_cast<size_t>(k)];
+		string tag = "stage" + to_string(k);
+		appendExtra(extra, tag + "MsgPerSec", formatDouble(sr.msgPerSec));
+		if (cfg.occupancyIntervalUs > 0) appendExtra(extra, tag + "OccMean", formatDouble(sr.occ.mean));
+		if (sr.hopPctUs.size() >= 7) {
+			appendExtra(extra, tag + "HopP50us", formatDouble(sr.hopPctUs[0].second));
+			appendExtra(extra, tag + "HopP99us", formatDouble(sr.hopPctUs[3].second));
+		}
+	}
+	appendExtra(extra, "bottleneckStage", to_string(bottleneck));
+	appendExtra(extra, "bottleneckMsgPerSec", formatDouble(slowest.msgPerSec));
+	appendExtra(extra, "backoff", cfg.backoff);
+	appendCsvRow(cfg, backendNameFor(cfg).c_str(), elapsedSec, recv, rbytes, pctUs, extra, workNs, readers, e2e.get(),
+	             move(intervals.samples));
+	result.msgPerSec = recv / elapsedSec;
+	if (pctUs.size() >= 7) result.p99us = pctUs[3].second;
+	result.extra = extra;
+
+	closeQueues();
 	return 0;
 }
 
+int main(int argc, char** argv) {
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	Config cfg = parseArgs(argc, argv);
+	printConfig(cfg);
+
+	if (cfg.messageSize == 0) {
+		cerr << "message-size must be > 0\n";
+		return 1;
+	}
+	if (cfg.producers <= 0 || cfg.consumers <= 0) {
+		cerr << "producers and consumers must be >= 1\n";
+		return 1;
+	}
+	if (cfg.durationSeconds <= 0) {
+		cerr << "duration-seconds must be >= 1\n";
+		return 1;
+	}
+	if (!setupClock(cfg.clock)) {
+		cerr << "clock must be auto, tsc or monotonic\n";
+		return 1;
+	}
+	if (!setupWork(cfg)) {
+		cerr << "work must be none, memcpy[:PASSES], hash[:PASSES] or spin:NS\n";
+		return 1;
+	}
+	if (cfg.printIntervalSeconds <= 0 || cfg.warmupSeconds < 0) {
+		cerr << "print-interval must be >= 1 and warmup-seconds >= 0\n";
+		return 1;
+	}
+	if (cfg.occupancyIntervalUs < 0) {
+		cerr << "occupancy-interval-us must be >= 0\n";
+		return 1;
+	}
+	if (cfg.maxMessages <= 0) {
+		cerr << "max-messages must be >= 1\n";
+		return 1;
+	}
+	if (cfg.batch <= 0) {
+		cerr << "batch must be >= 1\n";
+		return 1;
+	}
+#ifdef __linux__
+	if (cfg.consumerWait != "timed" && cfg.consumerWait != "epoll" && cfg.consumerWait != "notify") {
+		cerr << "consumer-wait must be timed, epoll or notify\n";
+		return 1;
+	}
+#else
+	if (cfg.consumerWait != "timed" && cfg.consumerWait != "notify") {
+		cerr << "consumer-wait must be timed or notify (epoll is Linux-only)\n";
+		return 1;
+	}
+#endif
+	if (cfg.rate < 0.0) {
+		cerr << "rate must be >= 0\n";
+		return 1;
+	}
+	{
+		string error;
+		if (!SizeDist::parse(cfg.sizeDist, cfg.messageSize, cfg.sizes, error)) {
+			cerr << "invalid size-dist '" << cfg.sizeDist << "': " << error << "\n";
+			return 1;
+		}
+		if (cfg.sizes.variable() && cfg.batch > 1) {
+			cerr << "size-dist requires batch 1 (batched records share one fixed size)\n";
+			return 1;
+		}
+	}
+	if (!Backoff::valid(cfg.backoff)) {
+		cerr << "backoff must be sleep, spin, exp or hybrid\n";
+		return 1;
+	}
+	if (cfg.spinLimit < 0) {
+		cerr << "spin-limit must be >= 0\n";
+		return 1;
+	}
+	if (cfg.queues < 1 || (cfg.routing != "round-robin" && cfg.routing != "hash" && cfg.routing != "affinity")) {
+		cerr << "queues must be >= 1 and routing round-robin, hash or affinity\n";
+		return 1;
+	}
+	if (cfg.consumerWait == "notify" && cfg.consumers != cfg.queues) {
+		cerr << "consumer-wait notify needs exactly one consumer per queue (mq_notify allows one registration per queue)\n";
+		return 1;
+	}
+#ifndef __linux__
+	if (cfg.consumers < cfg.queues) {
+		cerr << "consumers owning several queues wait with epoll, which is Linux-only; use consumers >= queues\n";
+		return 1;
+	}
+#endif
+	if (cfg.consumers < cfg.queues && cfg.consumerWait == "timed") {
+		cerr << "Note: consumers own several queues each and wait on them with epoll.\n";
+	}
+	if (cfg.routing == "affinity" && cfg.producers < cfg.queues) {
+		cerr << "Note: routing=affinity with fewer producers than queues leaves queues idle.\n";
+	}
+	if (!cfg.priorityMix.empty()) {
+		if (!PriorityMix::parse(cfg.priorityMix, cfg.priorities)) {
+			cerr << "invalid priority-mix '" << cfg.priorityMix << "' (expected PRIO:PCT[,...], PRIO >= 1, total <= 100)\n";
+			return 1;
+		}
+		long prioMax = sysconf(_SC_MQ_PRIO_MAX);
+		for (unsigned prio : cfg.priorities.prios) {
+			if (prioMax > 0 && static_cast<long>(prio) >= prioMax) {
+				cerr << "priority " << prio << " exceeds MQ_PRIO_MAX-1 (" << prioMax - 1 << ")\n";
+				return 1;
+			}
+		}
+	}
+	if (cfg.pingPong < 0) {
+		cerr << "ping-pong must be >= 0\n";
+		return 1;
+	}
+	if (cfg.pingPong > 0) {
+		if (cfg.messageSize < sizeof(MsgHeader)) {
+			cerr << "ping-pong requires message-size >= " << sizeof(MsgHeader) << " (header names the reply queue)\n";
+			return 1;
+		}
+		if (cfg.sweep || cfg.autotune || cfg.queues > 1 || cfg.batch > 1 || cfg.sizes.variable() ||
+		    !cfg.priorityMix.empty() || cfg.verify || cfg.rate > 0.0 || cfg.consumerWait != "timed") {
+			cerr << "ping-pong runs one request queue with fixed-size records and timed waits (no sweep, autotune, queues,\n"
+			     << "batch, size-dist, priority-mix, verify, rate or consumer-wait)\n";
+			return 1;
+		}
+	}
+	if (cfg.verify && cfg.messageSize < sizeof(MsgHeader)) {
+		cerr << "verify requires message-size >= " << sizeof(MsgHeader) << " (header carries the checksum)\n";
+		return 1;
+	}
+	if (cfg.placement != "none" && cfg.placement != "smt" && cfg.placement != "socket" && cfg.placement != "cross-socket") {
+		cerr << "placement must be none, smt, socket or cross-socket\n";
+		return 1;
+	}
+	for (const string* list : {&cfg.producerCpus, &cfg.consumerCpus}) {
+		vector<int> cpus;
+		string bad;
+		if (list->empty()) continue;
+		if (!parseCpuList(*list, cpus, &bad)) {
+			cerr << "invalid CPU list '" << *list << "': bad entry '" << bad << "' (expected e.g. 0,2,4-7, each < "
+			     << kMaxCpus << ")\n";
+			return 1;
+		}
+	}
+
+	if (cfg.stages < 1 || cfg.stages > kMaxStages) {
+		cerr << "stages must be in 1.." << kMaxStages << "\n";
+		return 1;
+	}
+	if (cfg.stages > 1) {
+		if (!cfg.stageConsumers.empty() &&
+		    (!parseCountList(cfg.stageConsumers, cfg.stageReaders) || static_cast<int>(cfg.stageReaders.size()) != cfg.stages)) {
+			cerr << "stage-consumers must list " << cfg.stages << " reader counts >= 1, e.g. 2,1,4\n";
+			return 1;
+		}
+		if (cfg.stageConsumers.empty()) cfg.stageReaders.assign(static_cast<size_t>(cfg.stages), cfg.consumers);
+		if (cfg.messageSize < pipelineRecordBytes(cfg.stages)) {
+			cerr << "stages=" << cfg.stages << " requires message-size >= " << pipelineRecordBytes(cfg.stages)
+			     << " (header plus one hand-off stamp per forwarding stage)\n";
+			return 1;
+		}
+		if (cfg.processMode || cfg.sweep || cfg.autotune || cfg.queues > 1 || cfg.pingPong > 0 || cfg.batch > 1 ||
+		    cfg.sizes.variable() || !cfg.priorityMix.empty() || cfg.verify || cfg.consumerWait != "timed" ||
+		    cfg.warmupSeconds > 0 || !cfg.intervalCsvPath.empty() || cfg.perf || cfg.placement != "none" ||
+		    !cfg.producerCpus.empty() || !cfg.consumerCpus.empty()) {
+			cerr << "stages runs threads over one queue per stage with fixed-size records and timed waits (no process-mode,\n"
+			     << "sweep, autotune, queues, ping-pong, batch, size-dist, priority-mix, verify, consumer-wait, warmup,\n"
+			     << "interval-csv, perf or placement)\n";
+			return 1;
+		}
+	} else if (!cfg.stageConsumers.empty()) {
+		cerr << "Note: stage-consumers is ignored without --stages > 1.\n";
+	}
+
+	if (cfg.repeat < 1 || cfg.regressThresholdPct < 0.0) {
+		cerr << "repeat must be >= 1 and regress-threshold >= 0\n";
+		return 1;
+	}
+	vector<BaselineRow> baseline;
+	if (!cfg.comparePath.empty() && !loadBaseline(cfg.comparePath, baseline)) {
+		cerr << "cannot read baseline CSV " << cfg.comparePath << "\n";
+		return 1;
+	}
+
+	if (cfg.sweep || cfg.autotune) {
+		if (cfg.processMode || cfg.sizes.variable() || cfg.queues > 1) {
+			cerr << "sweep runs in thread mode with fixed sizes on one queue (no process-mode, size-dist or queues)\n";
+			return 1;
+		}
+		// Points end on convergence, not on print intervals, and have no
+		// warmup boundary of their own.
+		if (cfg.warmupSeconds > 0 || !cfg.intervalCsvPath.empty()) {
+			cerr << "sweep points do not support warmup-seconds or interval-csv\n";
+			return 1;
+		}
+		if (cfg.sweepTolerance <= 0.0 || cfg.sweepWindow < 2) {
+			cerr << "sweep-tolerance must be > 0 and sweep-window >= 2\n";
+			return 1;
+		}
+		vector<long> axes[4];
+		const string* lists[4] = {&cfg.sweepMaxMessages, &cfg.sweepSizes, &cfg.sweepProducers, &cfg.sweepConsumers};
+		const long singles[4] = {cfg.maxMessages, static_cast<long>(cfg.messageSize), cfg.producers, cfg.consumers};
+		for (int a = 0; a < 4; ++a) {
+			if (lists[a]->empty()) {
+				axes[a] = {singles[a]};
+			} else if (!parseCountList(*lists[a], axes[a])) {
+				cerr << "invalid sweep list '" << *lists[a] << "' (expected e.g. 1,2,4)\n";
+				return 1;
+			}
+		}
+		if (cfg.autotune) autotuneAxes(cfg, axes[0], axes[1]);
+		for (long size : axes[1]) {
+			if (cfg.verify && static_cast<size_t>(size) < sizeof(MsgHeader)) {
+				cerr << "verify requires every sweep size >= " << sizeof(MsgHeader) << "\n";
+				return 1;
+			}
+		}
+		if (cfg.consumerWait == "notify" && *max_element(axes[3].begin(), axes[3].end()) != 1) {
+			cerr << "consumer-wait notify supports exactly one consumer\n";
+			return 1;
+		}
+		// Queue attributes vary slowest so consecutive points share a queue.
+		// Pairs the per-user RLIMIT_MSGQUEUE could not hold are skipped.
+		vector<SweepPoint> points;
+		const long long limit = msgqueueLimit();
+		for (long mm : axes[0])
+			for (long size : axes[1]) {
+				Config probe = cfg;
+				probe.maxMessages = mm;
+				probe.messageSize = static_cast<size_t>(size);
+				mq_attr attr{};
+				queueAttrFor(probe, attr, true);
+				long long charge = mqueueCharge(attr.mq_maxmsg, attr.mq_msgsize);
+				if (limit >= 0 && charge > limit) {
+					cerr << "Note: max-messages=" << attr.mq_maxmsg << " x msgsize=" << attr.mq_msgsize << " needs " << charge
+					     << " B > RLIMIT_MSGQUEUE " << limit << " B, skipping.\n";
+					continue;
+				}
+				for (long p : axes[2])
+					for (long c : axes[3])
+						for (int r = 0; r < cfg.repeat; ++r) points.push_back({mm, size, static_cast<int>(p), static_cast<int>(c), r});
+			}
+		if (points.empty()) {
+			cerr << "no sweep point fits RLIMIT_MSGQUEUE\n";
+			return 1;
+		}
+		if (cfg.unlinkAtStart) mq_unlink(cfg.queueName.c_str());
+		vector<pair<SweepPoint, RunResult>> results;
+		int rc = runSweep(cfg, points, cfg.comparePath.empty() ? nullptr : &baseline, &results);
+		if (cfg.autotune && rc != 2) printParetoFrontier(results);
+		return rc;
+	}
 
+	vector<RunResult> runs;
+	for (int r = 0; r < cfg.repeat && !interrupted.load(); ++r) {
+		if (cfg.repeat > 1) cout << "\n=== Repeat " << r + 1 << "/" << cfg.repeat << " ===\n";
+		Config run = cfg;
+		run.repeatIndex = r;
+		stopFlag.store(false);
+		RunResult result;
+		int rc = run.stages > 1 ? runPipeline(run, result) : runBenchmark(run, result);
+		if (rc != 0) return rc;
+		runs.push_back(result);
+	}
+	if (cfg.repeat > 1 || !cfg.comparePath.empty()) {
+		if (reportRepeats(cfg, backendNameFor(cfg).c_str(), runs, cfg.comparePath.empty() ? nullptr : &baseline)) return 3;
+	}
+	return 0;
+}
@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "bench_core.h"
+#include "result_file.h"
+
+using namespace std;
+
+// Reads the binary run records the benchmarks append with --results and turns
+// them into what used to be assembled by hand from results_all.csv: runs of
+// the same configuration on the same machine are merged (their histograms
+// summed, so merged percentiles are exact rather than averaged), and the
+// report lists the peak configurations, the msg/s-vs-p99 Pareto frontier, or
+// the README tables. csv re-emits the records as results CSV rows, which keeps
+// --compare baselines and spreadsheets working.
+struct Config {
+	string command = "list";
+	vector<string> inputs;
+	string output = "";
+	string backend = "";
+	long messageSize = 0;
+	bool merge = true;
+};
+
+// Extras that are part of a run's configuration rather than its measurements;
+// runs are merged only when these agree (missing counts as its own value).
+static const char* const kConfigExtras[] = {"batch", "pack", "payload", "sizeDist", "priorityMix", "rate",
+                                            "consumerWait", "backoff", "placement", "queues", "routing", "pingPong",
+                                            "stages", "stageReaders", "carrier", "work", "verify", "clock",
+                                            "warmupSec"};
+// Values of those extras that are the backends' defaults, left out of the
+// configuration text.
+static const pair<const char*, const char*> kConfigDefaults[] = {
+	{"batch", "1"}, {"consumerWait", "timed"}, {"backoff", "sleep"}, {"placement", "none"}, {"payload", "copy"}};
+static const char* const kEnvKeys[] = {"env.os", "env.kernel", "env.machine", "env.cpu", "env.cpus", "env.container"};
+// The fixed results CSV columns, in order; everything else is an extra.
+static const char* const kCsvColumns[] = {"backend", "queueName", "duration", "messageSize", "maxMessages",
+                                          "producers", "consumers", "nonBlocking", "randomPayload", "latencySample",
+                                          "elapsedSec", "recv", "bytesRecv", "msgPerSec", "MiBps", "p50us",
+                                          "p90us", "p95us", "p99us", "p999us", "p9999us", "maxus"};
+
+static void usage(const char* argv0) {
+	cerr << "Usage: " << argv0 << " COMMAND [options] FILE...\n";
+	cerr << "Commands (FILEs are --results files of any backend):\n";
+	cerr << "  list                       One line per configuration (per run with --runs)\n";
+	cerr << "  peak                       Highest msg/s and MiB/s configuration per backend and machine\n";
+	cerr << "  pareto                     msg/s-vs-p99 frontier per backend, machine and message size\n";
+	cerr << "  readme                     Markdown summary and tables for README.md\n";
+	cerr << "  intervals                  Interval series of every run as CSV\n";
+	cerr << "  csv                        Runs as results CSV rows (results_all.csv format, with header)\n";
+	cerr << "  merge                      Concatenate FILEs into --output, dropping duplicate runs\n";
+	cerr << "Options:\n";
+	cerr << "  --backend NAME             Only runs of this backend\n";
+	cerr << "  --message-size BYTES       Only runs of this message size\n";
+	cerr << "  --runs                     Do not merge repeated runs of one configuration\n";
+	cerr << "  --output PATH              Output file for merge\n";
+	cerr << "  --help                     Show this help\n";
+}
+
+static bool parseArgs(int argc, char** argv, Config& cfg) {
+	static const char* const commands[] = {"list", "peak", "pareto", "readme", "intervals", "csv", "merge"};
+	int i = 1;
+	if (i < argc && any_of(begin(commands), end(commands), [&](const char* c) { return string(argv[i]) == c; })) {
+		cfg.command = argv[i++];
+	}
+	for (; i < argc; ++i) {
+		string arg = argv[i];
+		auto need = [&](const string& name) {
+			if (i + 1 >= argc) {
+				cerr << "Missing value for " << name << "\n";
+				exit(1);
+			}
+		};
+		if (arg == "--help" || arg == "-h") {
+			usage(argv[0]);
+			exit(0);
+		} else if (arg == "--backend") { need(arg); cfg.backend = argv[++i]; }
+		else if (arg == "--message-size") { need(arg); cfg.messageSize = stol(argv[++i]); }
+		else if (arg == "--runs") cfg.merge = false;
+		else if (arg == "--output" || arg == "-o") { need(arg); cfg.output = argv[++i]; }
+		else if (arg.size() > 1 && arg[0] == '-') {
+			cerr << "Unknown option: " << arg << "\n";
+			usage(argv[0]);
+			return false;
+		} else {
+			cfg.inputs.push_back(arg);
+		}
+	}
+	return true;
+}
+
+// Runs merged into one configuration. Throughput is the aggregate over all
+// runs (total messages / total measured time); the histogram is their sum.
+struct Group {
+	const RunRecord* first = nullptr; // configuration and environment
+	vector<const RunRecord*> runs;
+	double elapsedSec = 0.0;
+	double recv = 0.0;
+	double bytes = 0.0;
+	unique_ptr<LatencyHistogram> hist;
+	vector<pair<double, double>> pctUs; // as computePercentiles, or the first run's if no run kept buckets
+
+	double msgPerSec() const { return elapsedSec > 0.0 ? recv / elapsedSec : 0.0; }
+	double mibPerSec() const { return elapsedSec > 0.0 ? bytes / (1024.0 * 1024.0) / elapsedSec : 0.0; }
+	double pct(size_t i) const { return i < pctUs.size() ? pctUs[i].second : NAN; }
+	double p99() const { return pct(3); }
+	// Lowest and highest per-run msg/s, to show how much the merged runs agree.
+	pair<double, double> rateRange() const {
+		double lo = INFINITY, hi = 0.0;
+		for (const RunRecord* r : runs) {
+			double v = r->number("msgPerSec", 0.0);
+			lo = min(lo, v);
+			hi = max(hi, v);
+		}
+		return {lo, hi};
+	}
+};
+
+static string envKey(const RunRecord& r) {
+	string key;
+	for (const char* k : kEnvKeys) key += r.text(k, "?") + "|";
+	return key;
+}
+
+static string configKey(const RunRecord& r) {
+	string key = r.text("backend") + "|" + r.text("messageSize") + "|" + r.text("maxMessages") + "|" +
+	             r.text("producers") + "|" + r.text("consumers") + "|" + r.text("nonBlocking") + "|" +
+	             r.text("randomPayload") + "|";
+	for (const char* k : kConfigExtras) key += r.text(k, "-") + "|";
+	return key + envKey(r);
+}
+
+// "Linux 6.8.0 x86_64, <cpu> x4, container".
+static string describeEnv(const RunRecord& r) {
+	string s = r.text("env.os", "?") + " " + r.text("env.kernel", "?") + " " + r.text("env.machine", "?") + ", " +
+	           r.text("env.cpu", "unknown CPU") + " x" + r.text("env.cpus", "?");
+	if (r.number("env.container", 0.0) != 0.0) s += ", container";
+	return s;
+}
+
+// "producers=4, consumers=1, max-messages=10" plus any configuration extras;
+// the depth column is max-inflight for the dispatch backends.
+static string describeConfig(const RunRecord& r, const char* sep = ", ", const char* quote = "") {
+	auto item = [&](const string& k, const string& v) { return string(quote) + k + "=" + v + quote; };
+	const string backend = r.text("backend");
+	const bool dispatch = backend == "gcd" || backend == "nsoperation" || backend == "steal";
+	string s = item("producers", r.text("producers")) + sep + item("consumers", r.text("consumers")) + sep +
+	           item(dispatch ? "max-inflight" : "max-messages", r.text("maxMessages"));
+	for (const char* k : kConfigExtras) {
+		const ResultField* f = r.find(k);
+		if (!f || string(k) == "clock") continue;
+		auto d = find_if(begin(kConfigDefaults), end(kConfigDefaults), [&](const pair<const char*, const char*>& e) {
+			return string(k) == e.first;
+		});
+		if (d != end(kConfigDefaults) && r.text(k) == d->second) continue;
+		s += sep + item(k, r.text(k));
+	}
+	return s;
+}
+
+// Identity of a run for de-duplication across inputs (the same record can
+// reach mq_report through several files, e.g. after merge).
+static string runIdentity(const RunRecord& r) {
+	char recv[32];
+	snprintf(recv, sizeof(recv), "%.17g", r.number("recv", 0.0));
+	return r.text("runId") + '\n' + r.text("backend") + '\n' + recv;
+}
+
+static bool loadRuns(const Config& cfg, vector<RunRecord>& runs) {
+	bool ok = true;
+	unordered_set<string> seen;
+	for (const RunRecord& r : runs) seen.insert(runIdentity(r));
+	for (const string& path : cfg.inputs) {
+		vector<RunRecord> recs;
+		string error;
+		if (!readRunRecords(path, recs, error)) {
+			if (recs.empty()) {
+				cerr << error << "\n";
+				ok = false;
+			} else {
+				cerr << "Note: " << error << "; using the " << recs.size() << " records before it\n";
+			}
+		}
+		for (RunRecord& r : recs) {
+			if (!cfg.backend.empty() && r.text("backend") != cfg.backend) continue;
+			if (cfg.messageSize > 0 && r.number("messageSize", 0.0) != static_cast<double>(cfg.messageSize)) continue;
+			if (seen.insert(runIdentity(r)).second) runs.push_back(move(r));
+		}
+	}
+	return ok;
+}
+
+static vector<Group> groupRuns(const vector<RunRecord>& runs, bool merge) {
+	vector<Group> groups;
+	map<string, size_t> index;
+	for (const RunRecord& r : runs) {
+		string key = merge ? configKey(r) : to_string(groups.size());
+		auto it = index.find(key);
+		if (it == index.end()) {
+			it = index.emplace(key, groups.size()).first;
+			groups.emplace_back();
+			groups.back().first = &r;
+		}
+		Group& g = groups[it->second];
+		g.runs.push_back(&r);
+		g.elapsedSec += r.number("elapsedSec", 0.0);
+		g.recv += r.number("recv", 0.0);
+		g.bytes += r.number("bytesRecv", 0.0);
+		if (r.histSubBits == LatencyHistogram::kSubBits && !r.buckets.empty()) {
+			if (!g.hist) g.hist = make_unique<LatencyHistogram>();
+			for (const auto& b : r.buckets) {
+				if (b.first >= LatencyHistogram::kBuckets) continue;
+				g.hist->counts[b.first] += b.second;
+				g.hist->total += b.second;
+			}
+			g.hist->maxNs = max(g.hist->maxNs, r.histMaxNs);
+		}
+	}
+	for (Group& g : groups) {
+		if (g.hist) {
+			computePercentiles(*g.hist, g.pctUs);
+		} else {
+			static const char* const keys[7] = {"p50us", "p90us", "p95us", "p99us", "p999us", "p9999us", "maxus"};
+			const double qs[7] = {0.5, 0.90, 0.95, 0.99, 0.999, 0.9999, 1.0};
+			if (!isnan(g.first->number("p50us"))) {
+				for (int i = 0; i < 7; ++i) g.pctUs.push_back({qs[i], g.first->number(keys[i])});
+			}
+		}
+	}
+	return groups;
+}
+
+// Groups keyed by backend and machine, in first-seen order.
+static vector<pair<string, vector<const Group*>>> byBackend(const vector<Group>& groups) {
+	vector<pair<string, vector<const Group*>>> out;
+	for (const Group& g : groups) {
+		string key = g.first->text("backend") + "|" + envKey(*g.first);
+		auto it = find_if(out.begin(), out.end(), [&](const pair<string, vector<const Group*>>& e) { return e.first == key; });
+		if (it == out.end()) {
+			out.push_back({key, {}});
+			it = out.end() - 1;
+		}
+		it->second.push_back(&g);
+	}
+	return out;
+}
+
+// Groups no other group beats on both msg/s and p99, by descending msg/s.
+static vector<const Group*> paretoFrontier(const vector<const Group*>& cands) {
+	vector<const Group*> out;
+	for (const Group* c : cands) {
+		const double cp = isnan(c->p99()) ? INFINITY : c->p99();
+		bool dominated = any_of(cands.begin(), cands.end(), [&](const Group* o) {
+			const double op = isnan(o->p99()) ? INFINITY : o->p99();
+			return o->msgPerSec() >= c->msgPerSec() && op <= cp && (o->msgPerSec() > c->msgPerSec() || op < cp);
+		});
+		if (!dominated) out.push_back(c);
+	}
+	sort(out.begin(), out.end(), [](const Group* a, const Group* b) { return a->msgPerSec() > b->msgPerSec(); });
+	return out;
+}
+
+static vector<long> messageSizes(const vector<const Group*>& groups) {
+	vector<long> sizes;
+	for (const Group* g : groups) sizes.push_back(static_cast<long>(g->first->number("messageSize", 0.0)));
+	sort(sizes.begin(), sizes.end());
+	sizes.erase(unique(sizes.begin(), sizes.end()), sizes.end());
+	return sizes;
+}
+
+// ~649k, ~1.93M: the precision the README summaries use.
+static string approxRate(double v) {
+	ostringstream os;
+	if (v >= 1e6) os << fixed << setprecision(2) << v / 1e6 << "M";
+	else if (v >= 1e3) os << fixed << setprecision(0) << v / 1e3 << "k";
+	else os << fixed << setprecision(0) << v;
+	return os.str();
+}
+
+static void printList(const vector<Group>& groups) {
+	cout << left << setw(18) << "backend" << right << setw(7) << "size" << setw(6) << "P" << setw(4) << "C"
+	     << setw(7) << "depth" << setw(5) << "runs" << setw(14) << "msg/s" << setw(11) << "MiB/s" << setw(10)
+	     << "p50us" << setw(10) << "p99us" << setw(11) << "p99.99us" << "  config\n";
+	for (const Group& g : groups) {
+		const RunRecord& r = *g.first;
+		cout << left << setw(18) << r.text("backend") << right << setw(7) << r.text("messageSize") << setw(6)
+		     << r.text("producers") << setw(4) << r.text("consumers") << setw(7) << r.text("maxMessages") << setw(5)
+		     << g.runs.size() << fixed << setprecision(2) << setw(14) << g.msgPerSec() << setw(11) << g.mibPerSec()
+		     << setw(10) << g.pct(0) << setw(10) << g.p99() << setw(11) << g.pct(5) << "  ";
+		if (g.runs.size() == 1) cout << "runId=" << r.text("runId");
+		else {
+			pair<double, double> range = g.rateRange();
+			cout << "msg/s " << setprecision(0) << range.first << ".." << range.second;
+		}
+		cout << "\n";
+	}
+}
+
+static void printPeak(const vector<Group>& groups) {
+	for (const auto& b : byBackend(groups)) {
+		const Group* rate = b.second.front();
+		const Group* bw = b.second.front();
+		for (const Group* g : b.second) {
+			if (g->msgPerSec() > rate->msgPerSec()) rate = g;
+			if (g->mibPerSec() > bw->mibPerSec()) bw = g;
+		}
+		cout << b.second.front()->first->text("backend") << " (" << describeEnv(*b.second.front()->first) << "):\n";
+		cout << "  peak msg/s:          " << fixed << setprecision(2) << rate->msgPerSec() << " at message-size="
+		     << rate->first->text("messageSize") << " " << describeConfig(*rate->first, " ") << " (MiB/s "
+		     << rate->mibPerSec() << ", p99 " << rate->p99() << " us, runs " << rate->runs.size() << ")\n";
+		cout << "  peak MiB/s:          " << fixed << setprecision(2) << bw->mibPerSec() << " at message-size="
+		     << bw->first->text("messageSize") << " " << describeConfig(*bw->first, " ") << " (msg/s "
+		     << bw->msgPerSec() << ", p99 " << bw->p99() << " us, runs " << bw->runs.size() << ")\n";
+	}
+}
+
+static void printPareto(const vector<Group>& groups) {
+	for (const auto& b : byBackend(groups)) {
+		for (long size : messageSizes(b.second)) {
+			vector<const Group*> cands;
+			for (const Group* g : b.second) {
+				if (static_cast<long>(g->first->number("messageSize", 0.0)) == size) cands.push_back(g);
+			}
+			cout << "\nPareto frontier (" << b.second.front()->first->text("backend") << ", size=" << size << ", "
+			     << describeEnv(*b.second.front()->first) << "):\n";
+			for (const Group* g : paretoFrontier(cands)) {
+				cout << "  msg/s=" << fixed << setprecision(2) << g->msgPerSec() << " p99=" << g->p99()
+				     << " p99.99=" << g->pct(5) << " " << describeConfig(*g->first, " ") << " (runs " << g->runs.size()
+				     << ")\n";
+			}
+		}
+	}
+}
+
+// The "Collected results" section: per backend and machine the peak bullets
+// in the README's wording, the best configuration per message size and the
+// Pareto points.
+static void printReadme(const vector<Group>& groups) {
+	cout << "### Collected results (generated by `mq_report readme`)\n";
+	for (const auto& b : byBackend(groups)) {
+		const RunRecord& any = *b.second.front()->first;
+		const Group* rate = b.second.front();
+		const Group* bw = b.second.front();
+		size_t runs = 0;
+		for (const Group* g : b.second) {
+			if (g->msgPerSec() > rate->msgPerSec()) rate = g;
+			if (g->mibPerSec() > bw->mibPerSec()) bw = g;
+			runs += g->runs.size();
+		}
+		cout << "\n- **" << any.text("backend") << "** (" << describeEnv(any) << "; " << runs << " runs, "
+		     << b.second.size() << " configurations)\n";
+		cout << "  - **Peak bandwidth**: ~" << fixed << setprecision(0) << bw->mibPerSec() << " MiB/s at `message-size="
+		     << bw->first->text("messageSize") << "`, " << describeConfig(*bw->first, ", ", "`") << " (throughput ~"
+		     << approxRate(bw->msgPerSec()) << " msg/s)\n";
+		cout << "  - **Peak msg/s**: ~" << approxRate(rate->msgPerSec()) << " msg/s at `message-size="
+		     << rate->first->text("messageSize") << "`, " << describeConfig(*rate->first, ", ", "`")
+		     << " (bandwidth ~" << fixed << setprecision(0) << rate->mibPerSec() << " MiB/s)\n";
+
+		cout << "\n| size (B) | best configuration | msg/s | MiB/s | p50 µs | p99 µs | p99.99 µs | runs |\n";
+		cout << "|---:|---|---:|---:|---:|---:|---:|---:|\n";
+		const vector<long> sizes = messageSizes(b.second);
+		for (long size : sizes) {
+			const Group* best = nullptr;
+			for (const Group* g : b.second) {
+				if (static_cast<long>(g->first->number("messageSize", 0.0)) != size) continue;
+				if (!best || g->msgPerSec() > best->msgPerSec()) best = g;
+			}
+			cout << "| " << size << " | " << describeConfig(*best->first, ", ") << " | " << fixed << setprecision(0)
+			     << best->msgPerSec() << " | " << setprecision(2) << best->mibPerSec() << " | " << best->pct(0)
+			     << " | " << best->p99() << " | " << best->pct(5) << " | " << best->runs.size() << " |\n";
+		}
+
+		cout << "\nPareto points (msg/s vs p99, per message size):\n\n";
+		cout << "| size (B) | configuration | msg/s | p99 µs | p99.99 µs |\n";
+		cout << "|---:|---|---:|---:|---:|\n";
+		for (long size : sizes) {
+			vector<const Group*> cands;
+			for (const Group* g : b.second) {
+				if (static_cast<long>(g->first->number("messageSize", 0.0)) == size) cands.push_back(g);
+			}
+			for (const Group* g : paretoFrontier(cands)) {
+				cout << "| " << size << " | " << describeConfig(*g->first, ", ") << " | " << fixed << setprecision(0)
+				     << g->msgPerSec() << " | " << setprecision(2) << g->p99() << " | " << g->pct(5) << " |\n";
+			}
+		}
+	}
+}
+
+static void printIntervals(const vector<RunRecord>& runs) {
+	cout << "runId,backend,interval,tSec,warmup,sent,recv,recvMsgPerSec,p50us,p99us\n";
+	for (const RunRecord& r : runs) {
+		double prevT = 0.0;
+		for (size_t i = 0; i < r.intervals.size(); ++i) {
+			const IntervalSample& s = r.intervals[i];
+			const double dt = s.tSec - prevT;
+			printf("%s,%s,%zu,%.3f,%d,%llu,%llu,%.2f,%.2f,%.2f\n", r.text("runId").c_str(), r.text("backend").c_str(),
+			       i, s.tSec, s.warmup ? 1 : 0, static_cast<unsigned long long>(s.sent),
+			       static_cast<unsigned long long>(s.recv), dt > 0.0 ? s.recv / dt : 0.0, s.p50us, s.p99us);
+			prevT = s.tSec;
+		}
+	}
+}
+
+// The fields back in results_all.csv form: the fixed columns, then every other
+// non-environment field as the extra column.
+static void printCsv(const vector<RunRecord>& runs) {
+	for (size_t i = 0; i < size(kCsvColumns); ++i) cout << (i ? "," : "") << kCsvColumns[i];
+	cout << ",extra\n";
+	for (const RunRecord& r : runs) {
+		for (size_t i = 0; i < size(kCsvColumns); ++i) {
+			const ResultField* f = r.find(kCsvColumns[i]);
+			cout << (i ? "," : "");
+			if (!f) continue;
+			const string col = kCsvColumns[i];
+			if (!f->numeric) cout << f->text;
+			else if (col == "elapsedSec") cout << formatDouble(f->number, 6);
+			else if (i >= 13) cout << formatDouble(f->number);
+			else cout << r.text(col);
+		}
+		string extra;
+		for (const ResultField& f : r.fields) {
+			if (f.key == "time" || f.key.compare(0, 4, "env.") == 0) continue;
+			if (any_of(begin(kCsvColumns), end(kCsvColumns), [&](const char* c) { return f.key == c; })) continue;
+			appendExtra(extra, f.key, r.text(f.key));
+		}
+		cout << "," << extra << "\n";
+	}
+}
+
+int main(int argc, char** argv) {
+	Config cfg;
+	if (!parseArgs(argc, argv, cfg)) return 1;
+	if (cfg.inputs.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (cfg.command == "merge" && cfg.output.empty()) {
+		cerr << "merge needs --output PATH\n";
+		return 1;
+	}
+
+	if (cfg.command == "merge" && find(cfg.inputs.begin(), cfg.inputs.end(), cfg.output) != cfg.inputs.end()) {
+		cerr << "--output must not be one of the input files\n";
+		return 1;
+	}
+
+	vector<RunRecord> runs;
+	if (!loadRuns(cfg, runs)) return 1;
+	if (cfg.command == "merge") {
+		FILE* f = fopen(cfg.output.c_str(), "wb");
+		if (!f) {
+			perror("fopen output");
+			return 1;
+		}
+		fclose(f);
+		for (const RunRecord& r : runs) {
+			if (!appendRunRecord(cfg.output, r)) return 1;
+		}
+		cout << "Wrote " << runs.size() << " runs to " << cfg.output << "\n";
+		return 0;
+	}
+	if (runs.empty()) {
+		cerr << "No runs match\n";
+		return 1;
+	}
+	if (cfg.command == "intervals") {
+		printIntervals(runs);
+		return 0;
+	}
+	if (cfg.command == "csv") {
+		printCsv(runs);
+		return 0;
+	}
+
+	const vector<Group> groups = groupRuns(runs, cfg.merge);
+	if (cfg.command == "list") printList(groups);
+	else if (cfg.command == "peak") printPeak(groups);
+	else if (cfg.command == "pareto") printPareto(groups);
+	else printReadme(groups);
+	return 0;
+}
@@ -2,124 +2,103 @@
 #include <atomic>
 #include <chrono>
 #include <csignal>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
-#include <random>
 #include <string>
 #include <thread>
 #include <vector>
 #include <algorithm>
 
+#include "bench_core.h"
+#include "payload_fill.h"
+#include "slot_pool.h"
+
 using namespace std;
 
-struct Config {
-	int durationSeconds = 5;
-	size_t messageSize = 256;
+struct Config : BenchConfig {
 	long maxInFlight = 1024;
-	int producers = 1;
-	int consumers = 1;
-	bool randomPayload = false;
-	size_t latencySample = 100000;
-	int printIntervalSeconds = 1;
-	string csvPath = "";
+	long batch = 1;
+	long pack = 1;
+	bool reuse = false;
 };
 
-static atomic<bool> stopFlag{false};
-
-static inline uint64_t nowNs() {
-	timespec ts;
-	clock_gettime(CLOCK_MONOTONIC, &ts);
-	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
-}
-
 static void onSignal(int) {
 	stopFlag.store(true, memory_order_relaxed);
 }
 
-struct MsgHeader {
-	uint64_t sequence;
-	uint64_t sendTimeNs;
+// The shared per-thread counters plus the submission counts only producers keep.
+struct alignas(64) NsopCounters : ThreadCounters {
+	atomic<uint64_t> operations{0};
+	atomic<uint64_t> submitCalls{0};
 };
 
-struct Stats {
-	atomic<uint64_t> sentMessages{0};
-	atomic<uint64_t> sentBytes{0};
-	atomic<uint64_t> recvMessages{0};
-	atomic<uint64_t> recvBytes{0};
+struct NsopStats : Stats {
+	uint64_t operations = 0;
+	uint64_t submitCalls = 0;
 };
 
-struct LatencyRecorder {
-	vector<uint64_t> samplesNs;
-	size_t capacity;
+// Operations run on arbitrary NSOperationQueue worker threads, so each thread
+// lazily registers its own counters and histogram. The mutex is only taken on
+// first use per thread and when reading them; counting and record() stay
+// lock-free.
+struct ConsumerRegistry {
+	struct Local {
+		ThreadCounters counters;
+		LatencyHistogram hist;
+	};
 	mutex mtx;
-	mt19937_64 rng;
-	atomic<uint64_t> seen{0};
-
-	explicit LatencyRecorder(size_t cap)
-	    : capacity(cap), rng(random_device{}()) {
-		samplesNs.reserve(capacity);
-	}
+	vector<unique_ptr<Local>> locals;
 
-	void record(uint64_t valueNs) {
-		uint64_t index = seen.fetch_add(1, memory_order_relaxed);
-		if (capacity == 0) return;
-		if (index < capacity) {
-			lock_guard<mutex> lock(mtx);
-			if (samplesNs.size() < capacity) {
-				samplesNs.push_back(valueNs);
-			}
-			return;
-		}
-		uniform_int_distribution<uint64_t> dist(0, index);
-		uint64_t pos = dist(rng);
-		if (pos < capacity) {
+	Local& local() {
+		thread_local Local* mine = nullptr;
+		if (!mine) {
+			auto l = make_unique<Local>();
+			mine = l.get();
 			lock_guard<mutex> lock(mtx);
-			if (pos < samplesNs.size()) {
-				samplesNs[pos] = valueNs;
-			}
+			locals.push_back(std::move(l));
 		}
+		return *mine;
 	}
-};
 
-static void computePercentiles(vector<uint64_t>& dataNs, vector<pair<double, double>>& outPctToUs) {
-	if (dataNs.empty()) return;
-	sort(dataNs.begin(), dataNs.end());
-	auto at = [&](double pct) -> double {
-		if (dataNs.empty()) return 0.0;
-		double pos = pct * (dataNs.size() - 1);
-		size_t idx = static_cast<size_t>(pos);
-		size_t idx2 = min(idx + 1, dataNs.size() - 1);
-		double frac = pos - idx;
-		double vNs = static_cast<double>(dataNs[idx]) * (1.0 - frac) + static_cast<double>(dataNs[idx2]) * frac;
-		return vNs / 1000.0;
-	};
-	const double pcts[] = {0.5, 0.90, 0.95, 0.99, 0.999};
-	for (double p : pcts) {
-		outPctToUs.push_back({p, at(p)});
+	void addTo(Stats& s) {
+		lock_guard<mutex> lock(mtx);
+		for (auto& l : locals) addCounters(s, static_cast<const ThreadCounters*>(nullptr), 0, &l->counters, 1);
 	}
-}
 
-static bool parseBool(const string& s) {
-	return s == "1" || s == "true" || s == "True" || s == "TRUE" || s == "yes" || s == "on";
-}
+	unique_ptr<LatencyHistogram> merged() {
+		auto out = make_unique<LatencyHistogram>();
+		lock_guard<mutex> lock(mtx);
+		for (auto& l : locals) out->merge(l->hist);
+		return out;
+	}
+};
 
 static void usage(const char* argv0) {
 	cerr << "Usage: " << argv0 << " [options]\n";
 	cerr << "Options:\n";
 	cerr << "  --duration-seconds N       Default 5\n";
 	cerr << "  --message-size N           Default 256\n";
-	cerr << "  --max-inflight N           Default 1024 (bounded in-flight operations)\n";
+	cerr << "  --max-inflight N           Default 1024 (bounded in-flight messages)\n";
 	cerr << "  --producers N              Default 1\n";
 	cerr << "  --consumers N              Default 1 (NSOperationQueue maxConcurrentOperationCount)\n";
+	cerr << "  --batch N                  Default 1 (operations per addOperations:waitUntilFinished:NO; 1 = addOperation:)\n";
+	cerr << "  --pack N                   Default 1 (messages carried by one block operation)\n";
+	cerr << "  --reuse true|false         Default false (true: pooled pack buffers, block captures a slot pointer)\n";
 	cerr << "  --random-payload true|false Default false\n";
-	cerr << "  --latency-sample N         Default 100000\n";
+	cerr << "  --rate MSGS_PER_SEC        Default 0 (closed loop); total open-loop rate split across producers\n";
+	cerr << "  --latency-sample 0|1       Default 1 (record every message's latency; 0 disables the histograms)\n";
+	cerr << "  --clock SOURCE             auto|tsc|monotonic, default auto (calibrated TSC/cntvct when invariant)\n";
+	cerr << "  --work KERNEL              none|memcpy[:PASSES]|hash[:PASSES]|spin:NS per message, default none\n";
 	cerr << "  --print-interval N         Default 1 (seconds)\n";
 	cerr << "  --csv PATH                 Append CSV results to PATH\n";
+	cerr << "  --results PATH             Append a binary run record (histogram, intervals) for mq_report\n";
 }
 
 static Config parseArgs(int argc, char** argv) {
@@ -133,15 +112,12 @@ static Config parseArgs(int argc, char** argv) {
 				exit(1);
 			}
 		};
-		if (arg == "--duration-seconds") { need(arg); cfg.durationSeconds = stoi(argv[++i]); }
-		else if (arg == "--message-size") { need(arg); cfg.messageSize = static_cast<size_t>(stoll(argv[++i])); }
-		else if (arg == "--max-inflight") { need(arg); cfg.maxInFlight = stol(argv[++i]); }
-		else if (arg == "--producers") { need(arg); cfg.producers = stoi(argv[++i]); }
-		else if (arg == "--consumers") { need(arg); cfg.consumers = stoi(argv[++i]); }
-		else if (arg == "--random-payload") { need(arg); cfg.randomPayload = parseBool(argv[++i]); }
-		else if (arg == "--latency-sample") { need(arg); cfg.latencySample = static_cast<size_t>(stoll(argv[++i])); }
-		else if (arg == "--print-interval") { need(arg); cfg.printIntervalSeconds = stoi(argv[++i]); }
-		else if (arg == "--csv") { need(arg); cfg.csvPath = argv[++i]; }
+		auto value = [&]() -> const char* { need(arg); return argv[++i]; };
+		if (parseCommonOption(cfg, arg, value)) continue;
+		if (arg == "--max-inflight") { need(arg); cfg.maxInFlight = stol(argv[++i]); }
+		else if (arg == "--batch") { need(arg); cfg.batch = stol(argv[++i]); }
+		else if (arg == "--pack") { need(arg); cfg.pack = stol(argv[++i]); }
+		else if (arg == "--reuse") { need(arg); cfg.reuse = parseBool(argv[++i]); }
 		else if (arg == "--help" || arg == "-h") { usage(argv[0]); exit(0); }
 		else {
 			cerr << "Unknown option: " << arg << "\n";
@@ -159,61 +135,178 @@ int main(int argc, char** argv) {
 	@autoreleasepool {
 		Config cfg = parseArgs(argc, argv);
 		if (cfg.messageSize == 0 || cfg.producers <= 0 || cfg.consumers <= 0 ||
-		    cfg.durationSeconds <= 0 || cfg.maxInFlight <= 0) {
+		    cfg.durationSeconds <= 0 || cfg.printIntervalSeconds <= 0 || cfg.maxInFlight <= 0 || cfg.rate < 0.0 ||
+		    cfg.batch <= 0 || cfg.pack <= 0) {
 			cerr << "Invalid config\n";
 			return 1;
 		}
+		// Every producer can hold up to pack * batch semaphore units in
+		// operations it has not submitted yet; if they can add up to the whole
+		// budget, all producers block in dispatch_semaphore_wait for good.
+		if (static_cast<double>(cfg.pack) * cfg.batch * cfg.producers > static_cast<double>(cfg.maxInFlight)) {
+			cerr << "pack * batch * producers must not exceed max-inflight\n";
+			return 1;
+		}
+		if (cfg.reuse && cfg.maxInFlight >= 0xFFFFFFFFl) {
+			cerr << "--reuse requires max-inflight < 2^32\n";
+			return 1;
+		}
+		if (!setupClock(cfg.clock)) {
+			cerr << "clock must be auto, tsc or monotonic\n";
+			return 1;
+		}
+		if (!setupWork(cfg)) {
+			cerr << "work must be none, memcpy[:PASSES], hash[:PASSES] or spin:NS\n";
+			return 1;
+		}
 
 		NSOperationQueue* queue = [[NSOperationQueue alloc] init];
 		queue.maxConcurrentOperationCount = cfg.consumers;
 
 		dispatch_semaphore_t spaceSem = dispatch_semaphore_create(cfg.maxInFlight);
 
-		Stats stats;
-		LatencyRecorder latRecorder(cfg.latencySample);
+		vector<NsopCounters> producerSlots(static_cast<size_t>(cfg.producers));
+		ConsumerRegistry consumerSlots;
+		auto sum = [&] {
+			NsopStats s;
+			addCounters(s, producerSlots.data(), cfg.producers, static_cast<const NsopCounters*>(nullptr), 0);
+			for (const NsopCounters& c : producerSlots) {
+				s.operations += c.operations.load(memory_order_relaxed);
+				s.submitCalls += c.submitCalls.load(memory_order_relaxed);
+			}
+			consumerSlots.addTo(s);
+			return s;
+		};
+
+		// An operation carries `pack` messages back to back at msgStride bytes
+		// (rounded up so every MsgHeader stays aligned). Without --reuse the
+		// producer fills a scratch buffer and the block captures a copy of it,
+		// one heap vector per operation; with --reuse the producer fills a pool
+		// slot in place and the block captures its pointer. NSOperation itself
+		// is one-shot (a finished operation cannot be enqueued again), so the
+		// operation and its block stay per-operation allocations; --pack is
+		// what amortises them.
+		const size_t pack = static_cast<size_t>(cfg.pack);
+		const size_t msgStride = (cfg.messageSize + alignof(MsgHeader) - 1) & ~(alignof(MsgHeader) - 1);
+		unique_ptr<SlotPool> pool;
+		if (cfg.reuse) {
+			// Submitted or batched packs hold pack semaphore units each, so at
+			// most max-inflight / pack of them are out, plus the one every
+			// producer is filling.
+			size_t slots = static_cast<size_t>((cfg.maxInFlight + cfg.pack - 1) / cfg.pack) + static_cast<size_t>(cfg.producers);
+			pool = make_unique<SlotPool>(slots, pack * msgStride);
+		}
+		SlotPool* slots = pool.get();
 
-		auto produceFunc = [&](int producerId) {
-			vector<uint8_t> buffer(cfg.messageSize, 0);
-			MsgHeader* header = nullptr;
-			if (cfg.messageSize >= sizeof(MsgHeader)) {
-				header = reinterpret_cast<MsgHeader*>(buffer.data());
+		auto consume = [&](const uint8_t* data, size_t count) {
+			ConsumerRegistry::Local& mine = consumerSlots.local();
+			ThreadCounters::bump(mine.counters.messages, count);
+			ThreadCounters::bump(mine.counters.bytes, count * cfg.messageSize);
+			if (cfg.workKernel.enabled()) {
+				// Operations run on arbitrary pool threads, like the histograms.
+				thread_local WorkSink sink;
+				uint64_t ns = 0;
+				for (size_t k = 0; k < count; ++k) ns += runWork(cfg.workKernel, sink, data + k * msgStride, cfg.messageSize);
+				ThreadCounters::bump(mine.counters.workNs, ns);
 			}
-			mt19937_64 rng(static_cast<uint64_t>(producerId) ^ 0x9e3779b97f4a7c15ull);
-			uniform_int_distribution<uint32_t> dist(0, 0xFFFFFFFFu);
+			if (cfg.latencySample && cfg.messageSize >= sizeof(MsgHeader)) {
+				LatencyHistogram& hist = mine.hist;
+				for (size_t k = 0; k < count; ++k) {
+					const MsgHeader* h = reinterpret_cast<const MsgHeader*>(data + k * msgStride);
+					uint64_t recvNs = nowNs();
+					uint64_t sendNs = h->intendedTimeNs;
+					if (recvNs >= sendNs) hist.record(recvNs - sendNs);
+				}
+			}
+		};
+
+		auto produceFunc = [&](int producerId) {
+			NsopCounters& counters = producerSlots[static_cast<size_t>(producerId)];
+			const bool hasHeader = cfg.messageSize >= sizeof(MsgHeader);
+			vector<uint8_t> buffer(slots ? 0 : pack * msgStride, 0);
+			PayloadFill filler(static_cast<uint64_t>(producerId));
+			Pacer pacer(cfg.rate, cfg.producers, producerId);
 			uint64_t seq = 0;
+			uint8_t* base = slots ? nullptr : buffer.data();
+			long slot = -1;
+			size_t filled = 0;
+			NSMutableArray* pending = cfg.batch > 1 ? [NSMutableArray arrayWithCapacity:static_cast<NSUInteger>(cfg.batch)] : nil;
+			size_t pendingMessages = 0;
+
+			auto submit = [&](NSOperation* op, size_t count) {
+				ThreadCounters::bump(counters.operations);
+				if (!pending) {
+					[queue addOperation:op];
+					ThreadCounters::bump(counters.submitCalls);
+					ThreadCounters::bump(counters.messages, count);
+					ThreadCounters::bump(counters.bytes, count * cfg.messageSize);
+					return;
+				}
+				[pending addObject:op];
+				pendingMessages += count;
+			};
+			auto flushBatch = [&]() {
+				if (!pending || pending.count == 0) return;
+				[queue addOperations:pending waitUntilFinished:NO];
+				[pending removeAllObjects];
+				ThreadCounters::bump(counters.submitCalls);
+				ThreadCounters::bump(counters.messages, pendingMessages);
+				ThreadCounters::bump(counters.bytes, pendingMessages * cfg.messageSize);
+				pendingMessages = 0;
+			};
+			auto submitPack = [&]() {
+				const size_t count = filled;
+				NSBlockOperation* op = nil;
+				if (slots) {
+					const uint8_t* data = base;
+					const uint32_t index = static_cast<uint32_t>(slot);
+					op = [NSBlockOperation blockOperationWithBlock:^{
+						consume(data, count);
+						slots->release(index);
+						for (size_t k = 0; k < count; ++k) dispatch_semaphore_signal(spaceSem);
+					}];
+				} else {
+					vector<uint8_t> payload(buffer.begin(), buffer.begin() + static_cast<ptrdiff_t>(count * msgStride));
+					op = [NSBlockOperation blockOperationWithBlock:^{
+						consume(payload.data(), count);
+						for (size_t k = 0; k < count; ++k) dispatch_semaphore_signal(spaceSem);
+					}];
+				}
+				submit(op, count);
+				if (pending && pending.count >= static_cast<NSUInteger>(cfg.batch)) flushBatch();
+				filled = 0;
+			};
+
 			while (!stopFlag.load(memory_order_relaxed)) {
-				if (header) {
+				uint64_t intended = 0;
+				if (pacer.enabled()) {
+					intended = pacer.next();
+					Pacer::waitUntil(intended);
+				}
+				if (filled == 0 && slots) {
+					slot = slots->acquire();
+					if (slot < 0) break;
+					base = slots->at(static_cast<uint32_t>(slot));
+				}
+				uint8_t* msg = base + filled * msgStride;
+				if (hasHeader) {
+					MsgHeader* header = reinterpret_cast<MsgHeader*>(msg);
 					header->sequence = seq++;
 					header->sendTimeNs = nowNs();
+					header->intendedTimeNs = pacer.enabled() ? intended : header->sendTimeNs;
+					header->producerId = static_cast<uint32_t>(producerId);
 				}
 				if (cfg.randomPayload) {
-					size_t start = header ? sizeof(MsgHeader) : 0;
-					for (size_t i = start; i + sizeof(uint32_t) <= cfg.messageSize; i += sizeof(uint32_t)) {
-						uint32_t r = dist(rng);
-						memcpy(buffer.data() + i, &r, sizeof(uint32_t));
-					}
+					size_t start = hasHeader ? sizeof(MsgHeader) : 0;
+					filler.fill(msg + start, cfg.messageSize - start);
 				}
 				dispatch_semaphore_wait(spaceSem, DISPATCH_TIME_FOREVER);
-
-				vector<uint8_t> payload = buffer;
-				NSBlockOperation* op = [NSBlockOperation blockOperationWithBlock:^{
-					stats.recvMessages.fetch_add(1, memory_order_relaxed);
-					stats.recvBytes.fetch_add(payload.size(), memory_order_relaxed);
-					if (payload.size() >= sizeof(MsgHeader)) {
-						const MsgHeader* h = reinterpret_cast<const MsgHeader*>(payload.data());
-						uint64_t recvNs = nowNs();
-						uint64_t sendNs = h->sendTimeNs;
-						if (recvNs >= sendNs) {
-							latRecorder.record(recvNs - sendNs);
-						}
-					}
-					dispatch_semaphore_signal(spaceSem);
-				}];
-				[queue addOperation:op];
-
-				stats.sentMessages.fetch_add(1, memory_order_relaxed);
-				stats.sentBytes.fetch_add(cfg.messageSize, memory_order_relaxed);
+				if (++filled == pack) submitPack();
 			}
+			// Hand over a partially filled pack and batch so every stamped
+			// message is delivered and semaphore unit returned.
+			if (filled > 0) submitPack();
+			flushBatch();
 		};
 
 		vector<thread> producers;
@@ -223,12 +316,15 @@ int main(int argc, char** argv) {
 
 		const auto start = chrono::steady_clock::now();
 		const auto endTime = start + chrono::seconds(cfg.durationSeconds);
+		IntervalSeries intervals;
 		while (chrono::steady_clock::now() < endTime && !stopFlag.load(memory_order_relaxed)) {
 			this_thread::sleep_for(chrono::seconds(cfg.printIntervalSeconds));
-			uint64_t sent = stats.sentMessages.load(memory_order_relaxed);
-			uint64_t recv = stats.recvMessages.load(memory_order_relaxed);
-			uint64_t sbytes = stats.sentBytes.load(memory_order_relaxed);
-			uint64_t rbytes = stats.recvBytes.load(memory_order_relaxed);
+			NsopStats s = sum();
+			uint64_t sent = s.sentMessages;
+			uint64_t recv = s.recvMessages;
+			intervals.add(chrono::duration<double>(chrono::steady_clock::now() - start).count(), sent, recv);
+			uint64_t sbytes = s.sentBytes;
+			uint64_t rbytes = s.recvBytes;
 			cout << "NSOp Progress: sent=" << sent << " recv=" << recv
 			     << " sentMiB=" << fixed << setprecision(2) << (double)sbytes / (1024.0 * 1024.0)
 			     << " recvMiB=" << fixed << setprecision(2) << (double)rbytes / (1024.0 * 1024.0)
@@ -243,69 +339,55 @@ int main(int argc, char** argv) {
 		const auto end = chrono::steady_clock::now();
 		double elapsedSec = chrono::duration<double>(end - start).count();
 		if (elapsedSec <= 0) elapsedSec = static_cast<double>(cfg.durationSeconds);
-		uint64_t sent = stats.sentMessages.load(memory_order_relaxed);
-		uint64_t recv = stats.recvMessages.load(memory_order_relaxed);
-		uint64_t sbytes = stats.sentBytes.load(memory_order_relaxed);
-		uint64_t rbytes = stats.recvBytes.load(memory_order_relaxed);
-		double recvMsgPerSec = recv / elapsedSec;
-		double recvMBps = (rbytes / (1024.0 * 1024.0)) / elapsedSec;
+		NsopStats totals = sum();
+		uint64_t sent = totals.sentMessages;
+		uint64_t recv = totals.recvMessages;
+		uint64_t sbytes = totals.sentBytes;
+		uint64_t rbytes = totals.recvBytes;
+		uint64_t operations = totals.operations;
+		uint64_t submitCalls = totals.submitCalls;
+		uint64_t workNs = totals.workNs;
+		double msgsPerOp = operations ? static_cast<double>(sent) / operations : 0.0;
+		double msgsPerCall = submitCalls ? static_cast<double>(sent) / submitCalls : 0.0;
 
-		vector<uint64_t> latCopyNs;
-		{
-			lock_guard<mutex> lock(latRecorder.mtx);
-			latCopyNs = latRecorder.samplesNs;
-		}
 		vector<pair<double, double>> pctUs;
-		computePercentiles(latCopyNs, pctUs);
+		unique_ptr<LatencyHistogram> merged = consumerSlots.merged();
+		computePercentiles(*merged, pctUs);
 
 		cout << "\nNSOperationQueue Summary:\n";
-		cout << "  elapsed-sec:         " << fixed << setprecision(3) << elapsedSec << "\n";
-		cout << "  messages-sent:       " << sent << "\n";
-		cout << "  messages-recv:       " << recv << "\n";
-		cout << "  bytes-sent:          " << sbytes << "\n";
-		cout << "  bytes-recv:          " << rbytes << "\n";
-		cout << "  throughput-msg/s:    " << fixed << setprecision(2) << recvMsgPerSec << "\n";
-		cout << "  throughput-MiB/s:    " << fixed << setprecision(2) << recvMBps << "\n";
-		if (!pctUs.empty()) {
-			cout << "  latency-us (p50,p90,p95,p99,p99.9):";
-			for (auto& p : pctUs) {
-				cout << " p" << fixed << setprecision(3) << (p.first * 100.0) << "=" << fixed << setprecision(2) << p.second;
-			}
-			cout << "\n";
+		printThroughputSummary(elapsedSec, sent, recv, sbytes, rbytes);
+		cout << "  submit:              " << (cfg.batch > 1 ? "addOperations:" : "addOperation:")
+		     << " batch=" << cfg.batch << " pack=" << cfg.pack << " ops=" << operations
+		     << " calls=" << submitCalls << " msgs/op=" << fixed << setprecision(2) << msgsPerOp
+		     << " msgs/call=" << msgsPerCall << "\n";
+		if (slots) {
+			cout << "  payload:             pool " << slots->next.size() << " x " << slots->stride
+			     << " B (block captures a slot pointer, no per-operation copy)\n";
 		} else {
-			cout << "  latency-us:          not available (message-size < header)\n";
+			cout << "  payload:             copy (vector per operation captured by the block)\n";
 		}
+		printOfferedRate(cfg, sent, elapsedSec);
+		printWorkSummary(cfg, workNs, recv, elapsedSec, cfg.consumers);
+		printLatencySummary(pctUs);
 
-		if (!cfg.csvPath.empty()) {
-			FILE* f = fopen(cfg.csvPath.c_str(), "a");
-			if (!f) {
-				perror("fopen csv");
-			} else {
-				double p50 = NAN, p90 = NAN, p95 = NAN, p99 = NAN, p999 = NAN;
-				if (pctUs.size() >= 5) {
-					p50 = pctUs[0].second; p90 = pctUs[1].second; p95 = pctUs[2].second; p99 = pctUs[3].second; p999 = pctUs[4].second;
-				}
-				fprintf(f,
-				        "%s,%s,%d,%zu,%ld,%d,%d,%d,%d,%zu,%.6f,%llu,%llu,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
-				        "nsoperation",
-				        "nsoperation_queue",
-				        cfg.durationSeconds,
-				        cfg.messageSize,
-				        cfg.maxInFlight,
-				        cfg.producers,
-				        cfg.consumers,
-				        0,
-				        cfg.randomPayload ? 1 : 0,
-				        cfg.latencySample,
-				        elapsedSec,
-				        static_cast<unsigned long long>(recv),
-				        static_cast<unsigned long long>(rbytes),
-				        recvMsgPerSec,
-				        recvMBps,
-				        p50, p90, p95, p99, p999);
-				fclose(f);
-			}
-		}
+		ResultRow row;
+		row.backend = "nsoperation";
+		row.queueName = "nsoperation_queue";
+		row.depth = cfg.maxInFlight;
+		row.elapsedSec = elapsedSec;
+		row.recvMessages = recv;
+		row.recvBytes = rbytes;
+		row.pctUs = pctUs;
+		row.workNs = workNs;
+		row.hist = merged.get();
+		row.intervals = move(intervals.samples);
+		appendExtra(row.extra, "batch", to_string(cfg.batch));
+		appendExtra(row.extra, "pack", to_string(cfg.pack));
+		appendExtra(row.extra, "payload", slots ? "pool" : "copy");
+		appendExtra(row.extra, "msgsPerOp", formatDouble(msgsPerOp));
+		appendExtra(row.extra, "msgsPerCall", formatDouble(msgsPerCall));
+		if (cfg.rate > 0.0) appendExtra(row.extra, "rate", formatDouble(cfg.rate));
+		appendResultRow(cfg, row);
 	}
 	return 0;
 }
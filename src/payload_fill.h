@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Random payload generator shared by all backends for --random-payload.
+// Four independent xorshift64 lanes emit 32 bytes per step; the lanes have no
+// dependency on each other, so the compiler keeps them in vector registers
+// (SSE2/AVX2/NEON) and an 8 KiB fill costs ~256 steps instead of 2048
+// mt19937_64 + uniform_int_distribution calls. Statistical quality is far
+// below a real PRNG, which is irrelevant here: the bytes only need to defeat
+// compression, dedup and zero-page shortcuts.
+struct PayloadFill {
+	static constexpr size_t kLanes = 4;
+	static constexpr size_t kStepBytes = kLanes * sizeof(uint64_t);
+
+	uint64_t lanes[kLanes];
+
+	explicit PayloadFill(uint64_t seed) {
+		// splitmix64 spreads the seed so no lane starts at zero.
+		for (size_t l = 0; l < kLanes; ++l) {
+			seed += 0x9e3779b97f4a7c15ull;
+			uint64_t z = seed;
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			lanes[l] = (z ^ (z >> 31)) | 1;
+		}
+	}
+
+	inline void step(uint64_t out[kLanes]) {
+		for (size_t l = 0; l < kLanes; ++l) {
+			uint64_t x = lanes[l];
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			lanes[l] = x;
+			out[l] = x;
+		}
+	}
+
+	void fill(uint8_t* dst, size_t len) {
+		uint64_t block[kLanes];
+		while (len >= kStepBytes) {
+			step(block);
+			memcpy(dst, block, kStepBytes);
+			dst += kStepBytes;
+			len -= kStepBytes;
+		}
+		if (len > 0) {
+			step(block);
+			memcpy(dst, block, len);
+		}
+	}
+};
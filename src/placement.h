@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "bench_core.h"
+
+// CPU placement. Explicit --producer-cpus/--consumer-cpus lists win; otherwise
+// --placement derives lists from sysfs topology so a producer and its consumer
+// share a core (smt), share a package on distinct cores (socket) or sit on
+// different packages (cross-socket). Worker i runs on list[i % size]. Shared
+// by mq_benchmark and shm_benchmark.
+constexpr int kMaxCpus = 1024;
+
+struct CpuInfo {
+	int cpu;
+	int core;
+	int package;
+};
+
+// Parses "0,2,4-7": comma-separated CPU numbers or lo-hi ranges, each below
+// kMaxCpus. Anything else (empty entries, stray characters, reversed ranges)
+// fails, with the offending entry in *badEntry when given.
+inline bool parseCpuList(const std::string& s, std::vector<int>& out, std::string* badEntry = nullptr) {
+	out.clear();
+	// Reads the digits of item from pos; false unless at least one digit and
+	// the value stays below kMaxCpus.
+	auto number = [](const std::string& item, size_t& pos, long& value) {
+		size_t first = pos;
+		value = 0;
+		while (pos < item.size() && item[pos] >= '0' && item[pos] <= '9') {
+			value = value * 10 + (item[pos++] - '0');
+			if (value >= kMaxCpus) return false;
+		}
+		return pos > first;
+	};
+	size_t begin = 0;
+	while (true) {
+		size_t comma = s.find(',', begin);
+		std::string item = s.substr(begin, comma == std::string::npos ? std::string::npos : comma - begin);
+		size_t pos = 0;
+		long lo = 0;
+		bool ok = number(item, pos, lo);
+		long hi = lo;
+		if (ok && pos < item.size() && item[pos] == '-') ok = number(item, ++pos, hi);
+		if (!ok || pos != item.size() || hi < lo) {
+			if (badEntry) *badEntry = item;
+			out.clear();
+			return false;
+		}
+		for (long c = lo; c <= hi; ++c) out.push_back(static_cast<int>(c));
+		if (comma == std::string::npos) break;
+		begin = comma + 1;
+	}
+	return true;
+}
+
+// Renders a CPU list for the CSV extra column; '+' keeps the field comma-free.
+inline std::string formatCpuList(const std::vector<int>& cpus) {
+	std::string s;
+	for (int c : cpus) {
+		if (!s.empty()) s += '+';
+		s += std::to_string(c);
+	}
+	return s.empty() ? "any" : s;
+}
+
+#ifdef __linux__
+// CPUs this process may run on, with their core and package ids.
+inline std::vector<CpuInfo> readCpuTopology() {
+	std::vector<CpuInfo> cpus;
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return cpus;
+	for (int c = 0; c < CPU_SETSIZE; ++c) {
+		if (!CPU_ISSET(c, &allowed)) continue;
+		std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(c) + "/topology/";
+		long core = readLongFromFile((base + "core_id").c_str(), c);
+		long package = readLongFromFile((base + "physical_package_id").c_str(), 0);
+		cpus.push_back({c, static_cast<int>(core), static_cast<int>(package)});
+	}
+	return cpus;
+}
+
+inline void pinCurrentThread(const std::vector<int>& cpus, int index) {
+	if (cpus.empty()) return;
+	int cpu = cpus[static_cast<size_t>(index) % cpus.size()];
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (cpu >= CPU_SETSIZE) return;
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		fprintf(stderr, "sched_setaffinity(cpu %d): %s\n", cpu, strerror(errno));
+	}
+}
+#else
+inline std::vector<CpuInfo> readCpuTopology() { return {}; }
+inline void pinCurrentThread(const std::vector<int>&, int) {}
+#endif
+
+// Fills producer/consumer CPU lists from cfg (any backend Config with
+// producerCpus, consumerCpus, placement, producers and consumers). Returns the
+// placement actually applied, which is "none" when the topology cannot satisfy
+// the policy.
+template <typename Config>
+inline std::string resolvePlacement(const Config& cfg, std::vector<int>& producerCpus, std::vector<int>& consumerCpus) {
+	producerCpus.clear();
+	consumerCpus.clear();
+	if (!cfg.producerCpus.empty() || !cfg.consumerCpus.empty()) {
+		if (!cfg.producerCpus.empty()) parseCpuList(cfg.producerCpus, producerCpus);
+		if (!cfg.consumerCpus.empty()) parseCpuList(cfg.consumerCpus, consumerCpus);
+		return "explicit";
+	}
+	if (cfg.placement == "none") return "none";
+
+	std::vector<CpuInfo> topo = readCpuTopology();
+	// (package, core) -> hardware threads, in CPU order.
+	std::vector<std::pair<std::pair<int, int>, std::vector<int>>> cores;
+	for (const CpuInfo& ci : topo) {
+		auto key = std::make_pair(ci.package, ci.core);
+		auto it = std::find_if(cores.begin(), cores.end(), [&](const std::pair<std::pair<int, int>, std::vector<int>>& e) { return e.first == key; });
+		if (it == cores.end()) cores.push_back({key, {ci.cpu}});
+		else it->second.push_back(ci.cpu);
+	}
+	std::vector<int> packages;
+	for (const auto& e : cores) {
+		if (std::find(packages.begin(), packages.end(), e.first.first) == packages.end()) packages.push_back(e.first.first);
+	}
+	auto coresOn = [&](int package) {
+		std::vector<const std::vector<int>*> out;
+		for (const auto& e : cores) if (e.first.first == package) out.push_back(&e.second);
+		return out;
+	};
+	const int pairs = std::max(cfg.producers, cfg.consumers);
+
+	if (cfg.placement == "smt") {
+		for (const auto& e : cores) {
+			if (e.second.size() < 2) continue;
+			producerCpus.push_back(e.second[0]);
+			consumerCpus.push_back(e.second[1]);
+			if (static_cast<int>(producerCpus.size()) == pairs) break;
+		}
+		if (!producerCpus.empty()) return "smt";
+		std::cerr << "Note: placement=smt needs a core with two hardware threads; running unpinned.\n";
+	} else if (cfg.placement == "socket") {
+		for (int pkg : packages) {
+			std::vector<const std::vector<int>*> pc = coresOn(pkg);
+			if (pc.size() < 2) continue;
+			for (size_t k = 0; k + 1 < pc.size() && static_cast<int>(producerCpus.size()) < pairs; k += 2) {
+				producerCpus.push_back(pc[k]->front());
+				consumerCpus.push_back(pc[k + 1]->front());
+			}
+			return "socket";
+		}
+		std::cerr << "Note: placement=socket needs two cores on one package; running unpinned.\n";
+	} else if (cfg.placement == "cross-socket") {
+		if (packages.size() >= 2) {
+			std::vector<const std::vector<int>*> a = coresOn(packages[0]);
+			std::vector<const std::vector<int>*> b = coresOn(packages[1]);
+			for (size_t k = 0; k < a.size() && k < b.size() && static_cast<int>(producerCpus.size()) < pairs; ++k) {
+				producerCpus.push_back(a[k]->front());
+				consumerCpus.push_back(b[k]->front());
+			}
+			return "cross-socket";
+		}
+		std::cerr << "Note: placement=cross-socket needs two packages; running unpinned.\n";
+	}
+	producerCpus.clear();
+	consumerCpus.clear();
+	return "none";
+}
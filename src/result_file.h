@@ -0,0 +1,382 @@
+#pragma once
+
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <iterator>
+#include <string>
+#include <sys/utsname.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#if defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
+#include "crc32c.h"
+
+// Binary run records for --results, read back by mq_report. One file holds any
+// number of records, appended one per run, each self-contained:
+//
+//   "MQR1" | varint payloadLen | payload | crc32c(payload) as 4 bytes LE
+//
+// payload = varint version, then
+//   fields:    varint n, n x (str key, u8 kind, str text | f64 number)
+//   intervals: varint n, n x (f64 tSec, u8 warmup, varint sent, varint recv,
+//                             f64 p50us, f64 p99us)
+//   histogram: varint subBits, varint maxNs, varint n,
+//              n x (varint index gap, varint count)
+//
+// str is varint length + bytes, f64 the IEEE bits as 8 bytes LE, varints are
+// unsigned LEB128. Fields carry the run configuration and summary (named like
+// the results CSV columns), the extras and "env." keys for the machine; the
+// histogram lists only non-empty buckets of the LatencyHistogram layout, so a
+// record is a few hundred bytes to a few KiB. The CRC lets the reader stop at a
+// record torn by a crash instead of misreading everything after it.
+inline constexpr char kResultMagic[4] = {'M', 'Q', 'R', '1'};
+inline constexpr uint64_t kResultVersion = 1;
+
+// One print interval of a run: message deltas since the previous interval and,
+// where the backend can take them, the interval's own percentiles (NaN if not).
+struct IntervalSample {
+	double tSec = 0.0;
+	bool warmup = false;
+	uint64_t sent = 0;
+	uint64_t recv = 0;
+	double p50us = NAN;
+	double p99us = NAN;
+};
+
+struct ResultField {
+	std::string key;
+	bool numeric = false;
+	std::string text;
+	double number = 0.0;
+};
+
+struct RunRecord {
+	std::vector<ResultField> fields;
+	std::vector<IntervalSample> intervals;
+	int histSubBits = 0;
+	uint64_t histMaxNs = 0;
+	std::vector<std::pair<uint32_t, uint64_t>> buckets; // non-empty only, ascending
+
+	void set(const std::string& key, const std::string& value) {
+		ResultField f;
+		f.key = key;
+		f.text = value;
+		fields.push_back(std::move(f));
+	}
+	void set(const std::string& key, double value) {
+		ResultField f;
+		f.key = key;
+		f.numeric = true;
+		f.number = value;
+		fields.push_back(std::move(f));
+	}
+	const ResultField* find(const std::string& key) const {
+		for (const ResultField& f : fields) {
+			if (f.key == key) return &f;
+		}
+		return nullptr;
+	}
+	// Text fields holding a number (the extras) are parsed; fallback otherwise.
+	double number(const std::string& key, double fallback = NAN) const {
+		const ResultField* f = find(key);
+		if (!f) return fallback;
+		if (f->numeric) return f->number;
+		char* end = nullptr;
+		double v = strtod(f->text.c_str(), &end);
+		return end && end != f->text.c_str() && *end == '\0' ? v : fallback;
+	}
+	std::string text(const std::string& key, const std::string& fallback = "") const {
+		const ResultField* f = find(key);
+		if (!f) return fallback;
+		if (!f->numeric) return f->text;
+		char buf[64];
+		if (f->number == static_cast<double>(static_cast<long long>(f->number))) {
+			snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(f->number));
+		} else {
+			snprintf(buf, sizeof(buf), "%.6g", f->number);
+		}
+		return buf;
+	}
+};
+
+namespace result_detail {
+
+inline void putVarint(std::string& out, uint64_t v) {
+	while (v >= 0x80) {
+		out += static_cast<char>((v & 0x7F) | 0x80);
+		v >>= 7;
+	}
+	out += static_cast<char>(v);
+}
+
+inline void putDouble(std::string& out, double v) {
+	uint64_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	for (int i = 0; i < 8; ++i) out += static_cast<char>((bits >> (8 * i)) & 0xFF);
+}
+
+inline void putString(std::string& out, const std::string& s) {
+	putVarint(out, s.size());
+	out += s;
+}
+
+// Bounds-checked cursor over one payload; ok turns false on any overrun.
+struct Reader {
+	const uint8_t* p;
+	const uint8_t* end;
+	bool ok = true;
+
+	uint64_t varint() {
+		uint64_t v = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (p >= end) break;
+			uint8_t b = *p++;
+			v |= static_cast<uint64_t>(b & 0x7F) << shift;
+			if (!(b & 0x80)) return v;
+		}
+		ok = false;
+		return 0;
+	}
+	uint8_t byte() {
+		if (p >= end) {
+			ok = false;
+			return 0;
+		}
+		return *p++;
+	}
+	double f64() {
+		if (end - p < 8) {
+			ok = false;
+			p = end;
+			return 0.0;
+		}
+		uint64_t bits = 0;
+		for (int i = 0; i < 8; ++i) bits |= static_cast<uint64_t>(*p++) << (8 * i);
+		double v;
+		memcpy(&v, &bits, sizeof(v));
+		return v;
+	}
+	std::string str() {
+		uint64_t n = varint();
+		if (!ok || n > static_cast<uint64_t>(end - p)) {
+			ok = false;
+			p = end;
+			return "";
+		}
+		std::string s(reinterpret_cast<const char*>(p), static_cast<size_t>(n));
+		p += n;
+		return s;
+	}
+	// Element counts are bounded by the bytes left, so a corrupt count cannot
+	// make the reader reserve gigabytes.
+	uint64_t count() {
+		uint64_t n = varint();
+		if (n > static_cast<uint64_t>(end - p)) ok = false;
+		return ok ? n : 0;
+	}
+};
+
+inline std::string firstLineValue(const char* path, const char* prefix) {
+	std::ifstream in(path);
+	std::string line;
+	const size_t n = strlen(prefix);
+	while (std::getline(in, line)) {
+		if (line.compare(0, n, prefix) != 0) continue;
+		size_t colon = line.find(':');
+		if (colon == std::string::npos) continue;
+		size_t start = line.find_first_not_of(" \t", colon + 1);
+		return start == std::string::npos ? "" : line.substr(start);
+	}
+	return "";
+}
+
+inline bool fileContains(const char* path, const char* const* needles) {
+	std::ifstream in(path);
+	std::string line;
+	while (std::getline(in, line)) {
+		for (const char* const* n = needles; *n; ++n) {
+			if (line.find(*n) != std::string::npos) return true;
+		}
+	}
+	return false;
+}
+
+} // namespace result_detail
+
+inline std::string encodeRunRecord(const RunRecord& rec) {
+	using namespace result_detail;
+	std::string payload;
+	putVarint(payload, kResultVersion);
+	putVarint(payload, rec.fields.size());
+	for (const ResultField& f : rec.fields) {
+		putString(payload, f.key);
+		payload += static_cast<char>(f.numeric ? 1 : 0);
+		if (f.numeric) putDouble(payload, f.number);
+		else putString(payload, f.text);
+	}
+	putVarint(payload, rec.intervals.size());
+	for (const IntervalSample& s : rec.intervals) {
+		putDouble(payload, s.tSec);
+		payload += static_cast<char>(s.warmup ? 1 : 0);
+		putVarint(payload, s.sent);
+		putVarint(payload, s.recv);
+		putDouble(payload, s.p50us);
+		putDouble(payload, s.p99us);
+	}
+	putVarint(payload, static_cast<uint64_t>(rec.histSubBits));
+	putVarint(payload, rec.histMaxNs);
+	putVarint(payload, rec.buckets.size());
+	uint32_t prev = 0;
+	for (const auto& b : rec.buckets) {
+		putVarint(payload, b.first - prev);
+		putVarint(payload, b.second);
+		prev = b.first;
+	}
+
+	std::string out(kResultMagic, sizeof(kResultMagic));
+	putVarint(out, payload.size());
+	out += payload;
+	uint32_t crc = crc32cUpdate(0, payload.data(), payload.size());
+	for (int i = 0; i < 4; ++i) out += static_cast<char>((crc >> (8 * i)) & 0xFF);
+	return out;
+}
+
+// Appends rec to path with a single O_APPEND write(), so concurrent runs
+// appending to the same file do not interleave within a record (stdio would
+// split a record larger than its buffer into several writes).
+inline bool appendRunRecord(const std::string& path, const RunRecord& rec) {
+	const std::string bytes = encodeRunRecord(rec);
+	int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0) {
+		perror("open results");
+		return false;
+	}
+	ssize_t n;
+	do {
+		n = write(fd, bytes.data(), bytes.size());
+	} while (n < 0 && errno == EINTR);
+	bool ok = n == static_cast<ssize_t>(bytes.size());
+	if (n < 0) perror("write results");
+	else if (!ok) fprintf(stderr, "write results: short write (%zd of %zu bytes)\n", n, bytes.size());
+	if (close(fd) != 0) {
+		perror("close results");
+		ok = false;
+	}
+	return ok;
+}
+
+// Reads every record of path into out. Stops at the first malformed or torn
+// record and says so in error; the records before it are kept.
+inline bool readRunRecords(const std::string& path, std::vector<RunRecord>& out, std::string& error) {
+	using namespace result_detail;
+	std::ifstream in(path, std::ios::binary);
+	if (!in.good()) {
+		error = path + ": cannot open";
+		return false;
+	}
+	const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	Reader file{reinterpret_cast<const uint8_t*>(data.data()), reinterpret_cast<const uint8_t*>(data.data()) + data.size()};
+	size_t index = 0;
+	while (file.p < file.end) {
+		const std::string where = path + ": record " + std::to_string(index);
+		if (file.end - file.p < 4 || memcmp(file.p, kResultMagic, 4) != 0) {
+			error = where + ": bad magic";
+			return false;
+		}
+		file.p += 4;
+		uint64_t len = file.varint();
+		const uint64_t remaining = static_cast<uint64_t>(file.end - file.p);
+		if (!file.ok || len > remaining || remaining - len < 4) {
+			error = where + ": truncated";
+			return false;
+		}
+		const uint8_t* payload = file.p;
+		file.p += len;
+		uint32_t crc = 0;
+		for (int i = 0; i < 4; ++i) crc |= static_cast<uint32_t>(*file.p++) << (8 * i);
+		if (crc32cUpdate(0, payload, static_cast<size_t>(len)) != crc) {
+			error = where + ": checksum mismatch";
+			return false;
+		}
+
+		Reader r{payload, payload + len};
+		RunRecord rec;
+		if (r.varint() != kResultVersion || !r.ok) {
+			error = where + ": unsupported version";
+			return false;
+		}
+		for (uint64_t n = r.count(); n > 0 && r.ok; --n) {
+			ResultField f;
+			f.key = r.str();
+			f.numeric = r.byte() != 0;
+			if (f.numeric) f.number = r.f64();
+			else f.text = r.str();
+			rec.fields.push_back(std::move(f));
+		}
+		for (uint64_t n = r.count(); n > 0 && r.ok; --n) {
+			IntervalSample s;
+			s.tSec = r.f64();
+			s.warmup = r.byte() != 0;
+			s.sent = r.varint();
+			s.recv = r.varint();
+			s.p50us = r.f64();
+			s.p99us = r.f64();
+			rec.intervals.push_back(s);
+		}
+		rec.histSubBits = static_cast<int>(r.varint());
+		rec.histMaxNs = r.varint();
+		uint64_t bucket = 0;
+		for (uint64_t n = r.count(); n > 0 && r.ok; --n) {
+			bucket += r.varint();
+			rec.buckets.push_back({static_cast<uint32_t>(bucket), r.varint()});
+		}
+		if (!r.ok || r.p != r.end) {
+			error = where + ": malformed payload";
+			return false;
+		}
+		out.push_back(std::move(rec));
+		index++;
+	}
+	return true;
+}
+
+// "env." fields describing where a run happened, so results from different
+// machines, kernels and containers are never merged into one row.
+inline void addEnvironment(RunRecord& rec) {
+	utsname u{};
+	if (uname(&u) == 0) {
+		rec.set("env.os", u.sysname);
+		rec.set("env.kernel", u.release);
+		rec.set("env.machine", u.machine);
+	}
+	char host[256] = {};
+	if (gethostname(host, sizeof(host) - 1) == 0) rec.set("env.host", host);
+	std::string cpu;
+#if defined(__APPLE__)
+	char brand[256] = {};
+	size_t len = sizeof(brand);
+	if (sysctlbyname("machdep.cpu.brand_string", brand, &len, nullptr, 0) == 0) cpu = brand;
+#else
+	cpu = result_detail::firstLineValue("/proc/cpuinfo", "model name");
+	if (cpu.empty()) cpu = result_detail::firstLineValue("/proc/cpuinfo", "CPU part");
+#endif
+	rec.set("env.cpu", cpu.empty() ? "unknown" : cpu);
+	rec.set("env.cpus", static_cast<double>(std::thread::hardware_concurrency()));
+	// Docker leaves /.dockerenv, podman /run/.containerenv; other runtimes show
+	// up in the init process's cgroup path.
+	static const char* const runtimes[] = {"docker", "containerd", "kubepods", "lxc", "libpod", nullptr};
+	bool container = access("/.dockerenv", F_OK) == 0 || access("/run/.containerenv", F_OK) == 0 ||
+	                 result_detail::fileContains("/proc/1/cgroup", runtimes);
+	rec.set("env.container", container ? 1.0 : 0.0);
+}
@@ -0,0 +1,662 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench_core.h"
+#include "mpmc_queue.h"
+#include "payload_fill.h"
+#include "placement.h"
+
+using namespace std;
+
+struct Config : BenchConfig {
+	string queueName = "/shm_bench";
+	long maxMessages = 1024;
+	bool unlinkAtStart = true;
+	bool unlinkAtEnd = true;
+	bool nonBlocking = false;
+	bool processMode = true;
+	string ring = "auto";
+	string placement = "none";
+	string producerCpus = "";
+	string consumerCpus = "";
+};
+
+static void onSignal(int) {
+	stopFlag.store(true, memory_order_relaxed);
+}
+
+static constexpr int kSpinBeforeWait = 128;
+
+// Bounded ring in a shm_open segment. head/tail are monotonically increasing
+// positions (slot = pos % capacity) on their own cache lines. The SPSC path
+// only uses head/tail; the MPMC path runs the Vyukov protocol from
+// mpmc_queue.h on each slot's seq.
+struct alignas(64) RingHeader {
+	uint64_t capacity = 0;
+	uint64_t slotStride = 0;
+	uint64_t messageSize = 0;
+	alignas(64) atomic<uint64_t> head{0};
+	alignas(64) atomic<uint64_t> tail{0};
+	FutexEvent notEmpty;
+	FutexEvent notFull;
+};
+
+struct SlotHeader {
+	atomic<uint64_t> seq;
+	uint32_t length;
+	uint32_t reserved;
+};
+
+static size_t slotStrideFor(size_t messageSize) {
+	return (sizeof(SlotHeader) + messageSize + 63) & ~static_cast<size_t>(63);
+}
+
+static size_t ringBytes(size_t capacity, size_t messageSize) {
+	return sizeof(RingHeader) + capacity * slotStrideFor(messageSize);
+}
+
+static inline SlotHeader* slotAt(RingHeader* ring, uint64_t pos) {
+	uint8_t* base = reinterpret_cast<uint8_t*>(ring + 1);
+	return reinterpret_cast<SlotHeader*>(base + (pos % ring->capacity) * ring->slotStride);
+}
+
+static inline uint8_t* slotData(SlotHeader* slot) {
+	return reinterpret_cast<uint8_t*>(slot + 1);
+}
+
+// Per-thread cached copy of the opposite index, so the SPSC fast path only
+// touches the other side's cache line when the ring looks full or empty.
+struct RingCursor {
+	uint64_t cachedHead = 0;
+	uint64_t cachedTail = 0;
+};
+
+static bool pushSpsc(RingHeader* ring, RingCursor& cur, const uint8_t* data, uint32_t len) {
+	uint64_t tail = ring->tail.load(memory_order_relaxed);
+	if (tail - cur.cachedHead >= ring->capacity) {
+		cur.cachedHead = ring->head.load(memory_order_acquire);
+		if (tail - cur.cachedHead >= ring->capacity) return false;
+	}
+	SlotHeader* slot = slotAt(ring, tail);
+	memcpy(slotData(slot), data, len);
+	slot->length = len;
+	ring->tail.store(tail + 1, memory_order_release);
+	return true;
+}
+
+static ssize_t popSpsc(RingHeader* ring, RingCursor& cur, uint8_t* out, size_t outSize) {
+	uint64_t head = ring->head.load(memory_order_relaxed);
+	if (head == cur.cachedTail) {
+		cur.cachedTail = ring->tail.load(memory_order_acquire);
+		if (head == cur.cachedTail) return -1;
+	}
+	SlotHeader* slot = slotAt(ring, head);
+	size_t len = min<size_t>(slot->length, outSize);
+	memcpy(out, slotData(slot), len);
+	ring->head.store(head + 1, memory_order_release);
+	return static_cast<ssize_t>(len);
+}
+
+static bool pushMpmc(RingHeader* ring, const uint8_t* data, uint32_t len) {
+	uint64_t pos = 0;
+	if (!vyukovClaimPush(ring->tail, [&](uint64_t p) -> atomic<uint64_t>& { return slotAt(ring, p)->seq; }, pos)) return false;
+	SlotHeader* slot = slotAt(ring, pos);
+	memcpy(slotData(slot), data, len);
+	slot->length = len;
+	slot->seq.store(pos + 1, memory_order_release);
+	return true;
+}
+
+static ssize_t popMpmc(RingHeader* ring, uint8_t* out, size_t outSize) {
+	uint64_t pos = 0;
+	if (!vyukovClaimPop(ring->head, [&](uint64_t p) -> atomic<uint64_t>& { return slotAt(ring, p)->seq; }, pos)) return -1;
+	SlotHeader* slot = slotAt(ring, pos);
+	size_t len = min<size_t>(slot->length, outSize);
+	memcpy(out, slotData(slot), len);
+	slot->seq.store(pos + ring->capacity, memory_order_release);
+	return static_cast<ssize_t>(len);
+}
+
+static bool ringHasData(RingHeader* ring) {
+	return ring->tail.load(memory_order_acquire) != ring->head.load(memory_order_acquire);
+}
+
+static bool ringHasSpace(RingHeader* ring) {
+	return ring->tail.load(memory_order_acquire) - ring->head.load(memory_order_acquire) < ring->capacity;
+}
+
+
+static void printConfig(const Config& cfg) {
+	cout << "Configuration:\n";
+	cout << "  queue-name:           " << cfg.queueName << "\n";
+	cout << "  duration-seconds:     " << cfg.durationSeconds << "\n";
+	cout << "  message-size:         " << cfg.messageSize << "\n";
+	cout << "  max-messages:         " << cfg.maxMessages << "\n";
+	cout << "  producers:            " << cfg.producers << "\n";
+	cout << "  consumers:            " << cfg.consumers << "\n";
+	cout << "  unlink-at-start:      " << (cfg.unlinkAtStart ? "true" : "false") << "\n";
+	cout << "  unlink-at-end:        " << (cfg.unlinkAtEnd ? "true" : "false") << "\n";
+	cout << "  non-blocking:         " << (cfg.nonBlocking ? "true" : "false") << "\n";
+	cout << "  random-payload:       " << (cfg.randomPayload ? "true" : "false") << "\n";
+	cout << "  process-mode:         " << (cfg.processMode ? "true" : "false") << "\n";
+	cout << "  ring:                 " << cfg.ring << "\n";
+	cout << "  rate:                 " << (cfg.rate > 0.0 ? to_string(cfg.rate) : string("closed-loop")) << "\n";
+	cout << "  placement:            " << cfg.placement << "\n";
+	if (!cfg.producerCpus.empty()) cout << "  producer-cpus:        " << cfg.producerCpus << "\n";
+	if (!cfg.consumerCpus.empty()) cout << "  consumer-cpus:        " << cfg.consumerCpus << "\n";
+	cout << "  latency-sample:       " << (cfg.latencySample ? "every message" : "off") << "\n";
+	cout << "  clock:                " << cfg.clock << "\n";
+	cout << "  work:                 " << cfg.work << "\n";
+	cout << "  print-interval-s:     " << cfg.printIntervalSeconds << "\n";
+	if (!cfg.csvPath.empty()) {
+		cout << "  csv-path:             " << cfg.csvPath << "\n";
+	}
+	if (!cfg.resultsPath.empty()) {
+		cout << "  results-path:         " << cfg.resultsPath << "\n";
+	}
+	cout.flush();
+}
+
+static void usage(const char* argv0) {
+	cerr << "Usage: " << argv0 << " [options]\n";
+	cerr << "Options:\n";
+	cerr << "  --queue-name NAME          Default /shm_bench (shm_open name)\n";
+	cerr << "  --duration-seconds N       Default 5\n";
+	cerr << "  --message-size N           Default 256\n";
+	cerr << "  --max-messages N           Default 1024 (ring capacity)\n";
+	cerr << "  --producers N              Default 1\n";
+	cerr << "  --consumers N              Default 1\n";
+	cerr << "  --unlink-start true|false  Default true\n";
+	cerr << "  --unlink-end true|false    Default true\n";
+	cerr << "  --nonblocking true|false   Default false (sleep-poll instead of futex wait)\n";
+	cerr << "  --random-payload true|false Default false\n";
+	cerr << "  --process-mode true|false  Default true (fork producers/consumers as processes)\n";
+	cerr << "  --ring auto|spsc|mpmc      Default auto (spsc for 1x1, mpmc otherwise)\n";
+	cerr << "  --rate MSGS_PER_SEC        Default 0 (closed loop); total open-loop rate split across producers\n";
+	cerr << "  --placement POLICY         none|smt|socket|cross-socket, default none (pin by sysfs topology)\n";
+	cerr << "  --producer-cpus LIST       e.g. 0,2,4-7; producer i runs on LIST[i % len] (overrides placement)\n";
+	cerr << "  --consumer-cpus LIST       Same for consumers\n";
+	cerr << "  --latency-sample 0|1       Default 1 (record every message's latency; 0 disables the histograms)\n";
+	cerr << "  --clock SOURCE             auto|tsc|monotonic, default auto (calibrated TSC/cntvct when invariant)\n";
+	cerr << "  --work KERNEL              none|memcpy[:PASSES]|hash[:PASSES]|spin:NS per message, default none\n";
+	cerr << "  --print-interval N         Default 1 (seconds)\n";
+	cerr << "  --csv PATH                 Append CSV results to PATH\n";
+	cerr << "  --results PATH             Append a binary run record (histogram, intervals) for mq_report\n";
+}
+
+static Config parseArgs(int argc, char** argv) {
+	Config cfg;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		auto need = [&](const string& opt) {
+			if (i + 1 >= argc) {
+				cerr << "Missing value for " << opt << "\n";
+				usage(argv[0]);
+				exit(1);
+			}
+		};
+		auto value = [&]() -> const char* { need(arg); return argv[++i]; };
+		if (parseCommonOption(cfg, arg, value)) continue;
+		if (arg == "--queue-name") { need(arg); cfg.queueName = argv[++i]; }
+		else if (arg == "--max-messages") { need(arg); cfg.maxMessages = stol(argv[++i]); }
+		else if (arg == "--unlink-start") { need(arg); cfg.unlinkAtStart = parseBool(argv[++i]); }
+		else if (arg == "--unlink-end") { need(arg); cfg.unlinkAtEnd = parseBool(argv[++i]); }
+		else if (arg == "--nonblocking") { need(arg); cfg.nonBlocking = parseBool(argv[++i]); }
+		else if (arg == "--process-mode") { need(arg); cfg.processMode = parseBool(argv[++i]); }
+		else if (arg == "--ring") { need(arg); cfg.ring = argv[++i]; }
+		else if (arg == "--placement") { need(arg); cfg.placement = argv[++i]; }
+		else if (arg == "--producer-cpus") { need(arg); cfg.producerCpus = argv[++i]; }
+		else if (arg == "--consumer-cpus") { need(arg); cfg.consumerCpus = argv[++i]; }
+		else if (arg == "--help" || arg == "-h") { usage(argv[0]); exit(0); }
+		else {
+			cerr << "Unknown option: " << arg << "\n";
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+	return cfg;
+}
+
+// How long a blocking push or pop waits before the loop re-checks stopFlag.
+static constexpr uint64_t kWaitNs = 100 * 1000 * 1000;
+
+// The ring as a Transport: the SPSC or MPMC push/pop, plus a futex wait on
+// notFull/notEmpty with a non-zero timeout. Holds the SPSC cursor, so each
+// worker owns its own. A wait that succeeds but loses the slot to another
+// worker reports EAGAIN; only an expired wait is ETIMEDOUT. The ring carries
+// one record per slot and ignores priorities.
+class RingTransport final : public Transport {
+public:
+	RingTransport(RingHeader* ring, bool spsc) : ring_(ring), spsc_(spsc) {}
+
+	int send(const uint8_t* data, size_t len, unsigned, uint64_t timeoutNs) override {
+		if (push(data, len)) return 0;
+		if (timeoutNs > 0) {
+			if (!eventWait(ring_->notFull, timeoutNs, kSpinBeforeWait, [&] { return ringHasSpace(ring_); })) {
+				errno = ETIMEDOUT;
+				return -1;
+			}
+			if (push(data, len)) return 0;
+		}
+		errno = EAGAIN;
+		return -1;
+	}
+
+	ssize_t recv(uint8_t* buf, size_t cap, unsigned* prio, uint64_t timeoutNs) override {
+		if (prio) *prio = 0;
+		ssize_t n = pop(buf, cap);
+		if (n < 0 && timeoutNs > 0) {
+			if (!eventWait(ring_->notEmpty, timeoutNs, kSpinBeforeWait, [&] { return ringHasData(ring_); })) {
+				errno = ETIMEDOUT;
+				return -1;
+			}
+			n = pop(buf, cap);
+		}
+		if (n < 0) errno = EAGAIN;
+		return n;
+	}
+
+	size_t batch(size_t recordSize) const override {
+		return recordSize && recordSize <= ring_->messageSize ? 1 : 0;
+	}
+
+private:
+	bool push(const uint8_t* data, size_t len) {
+		uint32_t n = static_cast<uint32_t>(len);
+		bool ok = spsc_ ? pushSpsc(ring_, cursor_, data, n) : pushMpmc(ring_, data, n);
+		if (ok) eventNotify(ring_->notEmpty);
+		return ok;
+	}
+
+	ssize_t pop(uint8_t* buf, size_t cap) {
+		ssize_t n = spsc_ ? popSpsc(ring_, cursor_, buf, cap) : popMpmc(ring_, buf, cap);
+		if (n >= 0) eventNotify(ring_->notFull);
+		return n;
+	}
+
+	RingHeader* ring_;
+	bool spsc_;
+	RingCursor cursor_;
+};
+
+static RingHeader* mapRing(const Config& cfg, int oflags, size_t bytes) {
+	int fd = shm_open(cfg.queueName.c_str(), oflags, 0600);
+	if (fd < 0) {
+		perror("shm_open");
+		return nullptr;
+	}
+	if ((oflags & O_CREAT) && ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+		perror("ftruncate");
+		close(fd);
+		return nullptr;
+	}
+	void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		perror("mmap ring");
+		return nullptr;
+	}
+	return static_cast<RingHeader*>(mem);
+}
+
+static void producerThread(RingHeader* ring, bool spsc, const Config& cfg, ThreadCounters& counters, int producerId) {
+	vector<uint8_t> buffer(cfg.messageSize, 0);
+	MsgHeader* header = nullptr;
+	if (cfg.messageSize >= sizeof(MsgHeader)) {
+		header = reinterpret_cast<MsgHeader*>(buffer.data());
+	}
+	PayloadFill filler(static_cast<uint64_t>(producerId));
+	RingTransport out(ring, spsc);
+	Pacer pacer(cfg.rate, cfg.producers, producerId);
+	// In open-loop mode a full ring retries the same message, so the time spent
+	// waiting is charged to it rather than lost.
+	bool pending = false;
+	uint64_t seq = 0;
+	while (!stopFlag.load(memory_order_relaxed)) {
+		uint64_t intended = 0;
+		if (pacer.enabled() && !pending) {
+			intended = pacer.next();
+			Pacer::waitUntil(intended);
+		}
+		if (header && !pending) {
+			header->sequence = seq;
+			header->sendTimeNs = nowNs();
+			header->intendedTimeNs = pacer.enabled() ? intended : header->sendTimeNs;
+			header->producerId = static_cast<uint32_t>(producerId);
+		}
+		if (cfg.randomPayload && !pending) {
+			size_t start = header ? sizeof(MsgHeader) : 0;
+			filler.fill(buffer.data() + start, cfg.messageSize - start);
+		}
+		int ret = out.send(buffer.data(), cfg.messageSize, 0, cfg.nonBlocking ? 0 : kWaitNs);
+		pending = ret != 0 && pacer.enabled();
+		if (ret == 0) {
+			seq++;
+			ThreadCounters::bump(counters.messages);
+			ThreadCounters::bump(counters.bytes, cfg.messageSize);
+		} else if (cfg.nonBlocking) {
+			ThreadCounters::bump(counters.eagain);
+			this_thread::sleep_for(chrono::microseconds(50));
+		} else if (errno == ETIMEDOUT) {
+			ThreadCounters::bump(counters.eagain);
+		}
+	}
+}
+
+static void consumerThread(RingHeader* ring, bool spsc, const Config& cfg, ThreadCounters& counters, LatencyHistogram& latHist) {
+	vector<uint8_t> buffer(cfg.messageSize, 0);
+	MsgHeader* header = nullptr;
+	if (cfg.messageSize >= sizeof(MsgHeader)) {
+		header = reinterpret_cast<MsgHeader*>(buffer.data());
+	}
+	RingTransport in(ring, spsc);
+	WorkSink sink;
+	while (!stopFlag.load(memory_order_relaxed)) {
+		ssize_t n = in.recv(buffer.data(), buffer.size(), nullptr, cfg.nonBlocking ? 0 : kWaitNs);
+		if (n >= 0) {
+			ThreadCounters::bump(counters.messages);
+			ThreadCounters::bump(counters.bytes, static_cast<uint64_t>(n));
+			ThreadCounters::bump(counters.workNs, runWork(cfg.workKernel, sink, buffer.data(), static_cast<size_t>(n)));
+			if (header && cfg.latencySample && static_cast<size_t>(n) >= sizeof(MsgHeader)) {
+				uint64_t recvNs = nowNs();
+				uint64_t sendNs = header->intendedTimeNs;
+				if (recvNs >= sendNs) {
+					latHist.record(recvNs - sendNs);
+				}
+			}
+		} else if (cfg.nonBlocking) {
+			ThreadCounters::bump(counters.eagain);
+			this_thread::sleep_for(chrono::microseconds(50));
+		} else if (errno == ETIMEDOUT) {
+			ThreadCounters::bump(counters.eagain);
+		}
+	}
+}
+
+// Body of a process-mode worker: maps the named segment itself (its own
+// address space and mapping) and runs body on it.
+template <typename Body>
+static int withChildRing(const Config& cfg, size_t bytes, Body body) {
+	RingHeader* ring = mapRing(cfg, O_RDWR, bytes);
+	if (!ring) return 2;
+	body(ring);
+	munmap(ring, bytes);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	Config cfg = parseArgs(argc, argv);
+	printConfig(cfg);
+
+	if (cfg.messageSize == 0 || cfg.messageSize > UINT32_MAX) {
+		cerr << "message-size must be in 1..4294967295\n";
+		return 1;
+	}
+	if (cfg.producers <= 0 || cfg.consumers <= 0) {
+		cerr << "producers and consumers must be >= 1\n";
+		return 1;
+	}
+	if (cfg.durationSeconds <= 0) {
+		cerr << "duration-seconds must be >= 1\n";
+		return 1;
+	}
+	if (cfg.printIntervalSeconds <= 0) {
+		cerr << "print-interval must be >= 1\n";
+		return 1;
+	}
+	if (!setupClock(cfg.clock)) {
+		cerr << "clock must be auto, tsc or monotonic\n";
+		return 1;
+	}
+	if (!setupWork(cfg)) {
+		cerr << "work must be none, memcpy[:PASSES], hash[:PASSES] or spin:NS\n";
+		return 1;
+	}
+	if (cfg.maxMessages <= 0) {
+		cerr << "max-messages must be >= 1\n";
+		return 1;
+	}
+	if (cfg.rate < 0.0) {
+		cerr << "rate must be >= 0\n";
+		return 1;
+	}
+	bool spsc;
+	if (cfg.ring == "auto") {
+		spsc = cfg.producers == 1 && cfg.consumers == 1;
+	} else if (cfg.ring == "spsc") {
+		if (cfg.producers != 1 || cfg.consumers != 1) {
+			cerr << "--ring spsc requires exactly 1 producer and 1 consumer\n";
+			return 1;
+		}
+		spsc = true;
+	} else if (cfg.ring == "mpmc") {
+		spsc = false;
+	} else {
+		cerr << "--ring must be auto, spsc or mpmc\n";
+		return 1;
+	}
+	if (cfg.placement != "none" && cfg.placement != "smt" && cfg.placement != "socket" && cfg.placement != "cross-socket") {
+		cerr << "placement must be none, smt, socket or cross-socket\n";
+		return 1;
+	}
+	for (const string* list : {&cfg.producerCpus, &cfg.consumerCpus}) {
+		vector<int> cpus;
+		string bad;
+		if (list->empty()) continue;
+		if (!parseCpuList(*list, cpus, &bad)) {
+			cerr << "invalid CPU list '" << *list << "': bad entry '" << bad << "' (expected e.g. 0,2,4-7, each < "
+			     << kMaxCpus << ")\n";
+			return 1;
+		}
+	}
+
+	if (cfg.unlinkAtStart) {
+		shm_unlink(cfg.queueName.c_str());
+	}
+
+	size_t capacity = static_cast<size_t>(cfg.maxMessages);
+	size_t bytes = ringBytes(capacity, cfg.messageSize);
+	RingHeader* ring = mapRing(cfg, O_CREAT | O_RDWR, bytes);
+	if (!ring) {
+		cerr << "Failed to create shared-memory ring " << cfg.queueName << "\n";
+		return 2;
+	}
+	new (ring) RingHeader();
+	ring->capacity = capacity;
+	ring->slotStride = slotStrideFor(cfg.messageSize);
+	ring->messageSize = cfg.messageSize;
+	for (uint64_t i = 0; i < capacity; ++i) {
+		SlotHeader* slot = slotAt(ring, i);
+		new (&slot->seq) atomic<uint64_t>(i);
+		slot->length = 0;
+	}
+
+	cout << "Effective ring attributes:\n";
+	cout << "  ring:        " << (spsc ? "spsc" : "mpmc") << "\n";
+	cout << "  capacity:    " << ring->capacity << "\n";
+	cout << "  slot-stride: " << ring->slotStride << "\n";
+	cout << "  bytes:       " << bytes << "\n";
+	cout.flush();
+
+	// Process mode: counters and histograms live in a shared mapping, one
+	// histogram per consumer.
+	SharedBlock<ThreadCounters>* shared = nullptr;
+	if (cfg.processMode) {
+		shared = SharedBlock<ThreadCounters>::create(cfg.producers, cfg.consumers, cfg.consumers);
+		if (!shared) {
+			perror("mmap shared stats");
+			munmap(ring, bytes);
+			if (cfg.unlinkAtEnd) shm_unlink(cfg.queueName.c_str());
+			return 2;
+		}
+	}
+	vector<ThreadCounters> localProducerSlots(shared ? 0 : static_cast<size_t>(cfg.producers));
+	vector<ThreadCounters> localConsumerSlots(shared ? 0 : static_cast<size_t>(cfg.consumers));
+	vector<LatencyHistogram> localHists(shared ? 0 : static_cast<size_t>(cfg.consumers));
+	ThreadCounters* producerSlots = shared ? shared->producerSlots() : localProducerSlots.data();
+	ThreadCounters* consumerSlots = shared ? shared->consumerSlots() : localConsumerSlots.data();
+
+	vector<int> producerCpus;
+	vector<int> consumerCpus;
+	const string placement = resolvePlacement(cfg, producerCpus, consumerCpus);
+	if (placement != "none") {
+		cout << "Placement: " << placement << " producers=" << formatCpuList(producerCpus)
+		     << " consumers=" << formatCpuList(consumerCpus) << "\n";
+	}
+
+	vector<thread> threads;
+	vector<pid_t> children;
+	if (cfg.processMode) {
+		cout.flush();
+		for (int i = 0; i < cfg.consumers; ++i) {
+			pid_t pid = spawnWorker([&, i] {
+				return withChildRing(cfg, bytes, [&, i](RingHeader* childRing) {
+					pinCurrentThread(consumerCpus, i);
+					consumerThread(childRing, spsc, cfg, consumerSlots[i], *shared->histogram(i));
+				});
+			});
+			if (pid < 0) { perror("fork"); stopFlag.store(true); break; }
+			children.push_back(pid);
+		}
+		for (int i = 0; i < cfg.producers && !stopFlag.load(); ++i) {
+			pid_t pid = spawnWorker([&, i] {
+				return withChildRing(cfg, bytes, [&, i](RingHeader* childRing) {
+					pinCurrentThread(producerCpus, i);
+					producerThread(childRing, spsc, cfg, producerSlots[i], i);
+				});
+			});
+			if (pid < 0) { perror("fork"); stopFlag.store(true); break; }
+			children.push_back(pid);
+		}
+	} else {
+		threads.reserve(static_cast<size_t>(cfg.producers + cfg.consumers));
+		for (int i = 0; i < cfg.consumers; ++i) {
+			threads.emplace_back([&, i] {
+				pinCurrentThread(consumerCpus, i);
+				consumerThread(ring, spsc, cfg, consumerSlots[i], localHists[static_cast<size_t>(i)]);
+			});
+		}
+		for (int i = 0; i < cfg.producers; ++i) {
+			threads.emplace_back([&, i] {
+				pinCurrentThread(producerCpus, i);
+				producerThread(ring, spsc, cfg, producerSlots[i], i);
+			});
+		}
+	}
+
+	const auto start = chrono::steady_clock::now();
+	const auto endTime = start + chrono::seconds(cfg.durationSeconds);
+	IntervalSeries intervals;
+	while (chrono::steady_clock::now() < endTime && !stopFlag.load(memory_order_relaxed)) {
+		this_thread::sleep_for(chrono::seconds(cfg.printIntervalSeconds));
+		Stats snap = sumCounters(producerSlots, cfg.producers, consumerSlots, cfg.consumers);
+		intervals.add(chrono::duration<double>(chrono::steady_clock::now() - start).count(), snap.sentMessages,
+		              snap.recvMessages);
+		cout << "SHM Progress: sent=" << snap.sentMessages << " recv=" << snap.recvMessages
+		     << " sentMiB=" << fixed << setprecision(2) << (double)snap.sentBytes / (1024.0 * 1024.0)
+		     << " recvMiB=" << fixed << setprecision(2) << (double)snap.recvBytes / (1024.0 * 1024.0)
+		     << "\n";
+		cout.flush();
+	}
+	stopFlag.store(true, memory_order_relaxed);
+
+	for (auto& t : threads) t.join();
+	stopWorkers(children);
+
+	const auto end = chrono::steady_clock::now();
+	double elapsedSec = chrono::duration<double>(end - start).count();
+	if (elapsedSec <= 0) elapsedSec = static_cast<double>(cfg.durationSeconds);
+
+	Stats stats = sumCounters(producerSlots, cfg.producers, consumerSlots, cfg.consumers);
+	uint64_t sent = stats.sentMessages;
+	uint64_t recv = stats.recvMessages;
+	uint64_t sbytes = stats.sentBytes;
+	uint64_t rbytes = stats.recvBytes;
+
+	auto merged = make_unique<LatencyHistogram>();
+	for (int i = 0; i < cfg.consumers; ++i) {
+		merged->merge(shared ? *shared->histogram(i) : localHists[static_cast<size_t>(i)]);
+	}
+	vector<pair<double, double>> pctUs;
+	computePercentiles(*merged, pctUs);
+
+	cout << "\nSHM Summary:\n";
+	printThroughputSummary(elapsedSec, sent, recv, sbytes, rbytes);
+	printOfferedRate(cfg, sent, elapsedSec);
+	printWorkSummary(cfg, stats.workNs, recv, elapsedSec, cfg.consumers);
+	cout << "  send-errors:         " << stats.sendErrors << " (EAGAIN " << stats.sendEagain << ")\n";
+	cout << "  recv-errors:         " << stats.recvErrors << " (EAGAIN " << stats.recvEagain << ")\n";
+	for (int i = 0; i < cfg.producers; ++i) {
+		const ThreadCounters& c = producerSlots[i];
+		cout << "  producer[" << i << "]:         sent=" << c.messages.load()
+		     << " msg/s=" << fixed << setprecision(2) << c.messages.load() / elapsedSec
+		     << " errors=" << c.errors.load() << " eagain=" << c.eagain.load() << "\n";
+	}
+	for (int i = 0; i < cfg.consumers; ++i) {
+		const ThreadCounters& c = consumerSlots[i];
+		double share = recv ? 100.0 * static_cast<double>(c.messages.load()) / static_cast<double>(recv) : 0.0;
+		cout << "  consumer[" << i << "]:         recv=" << c.messages.load()
+		     << " msg/s=" << fixed << setprecision(2) << c.messages.load() / elapsedSec
+		     << " share=" << fixed << setprecision(1) << share << "%"
+		     << " errors=" << c.errors.load() << " eagain=" << c.eagain.load() << "\n";
+	}
+	printLatencySummary(pctUs);
+
+	string extra;
+	if (cfg.rate > 0.0) appendExtra(extra, "rate", formatDouble(cfg.rate));
+	appendExtra(extra, "placement", placement);
+	if (placement == "none" && cfg.placement != "none") appendExtra(extra, "requestedPlacement", cfg.placement);
+	if (placement != "none") {
+		appendExtra(extra, "producerCpus", formatCpuList(producerCpus));
+		appendExtra(extra, "consumerCpus", formatCpuList(consumerCpus));
+	}
+	ResultRow row;
+	row.backend = spsc ? "shm_spsc" : "shm_mpmc";
+	row.queueName = cfg.queueName;
+	row.depth = cfg.maxMessages;
+	row.nonBlocking = cfg.nonBlocking;
+	row.elapsedSec = elapsedSec;
+	row.recvMessages = recv;
+	row.recvBytes = rbytes;
+	row.pctUs = pctUs;
+	row.extra = extra;
+	row.workNs = stats.workNs;
+	row.hist = merged.get();
+	row.intervals = move(intervals.samples);
+	appendResultRow(cfg, row);
+
+	if (shared) shared->destroy();
+	ring->~RingHeader();
+	munmap(ring, bytes);
+	if (cfg.unlinkAtEnd) {
+		shm_unlink(cfg.queueName.c_str());
+	}
+	return 0;
+}
+
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Preallocated message buffers: a slab of fixed-size slots (cache-line aligned
+// stride) and a lock-free free list of slot indices, used by --zero-copy
+// (gcd) and --reuse (nsop) in place of one heap copy per message. Callers
+// size the pool so that their backpressure semaphore guarantees a free slot
+// to anyone who got past it; acquire() only comes back empty after shutdown.
+// The list head packs a 32-bit ABA tag with the index + 1 of the top slot,
+// and next[i] holds the index + 1 of the slot below slot i (0 = none).
+struct SlotPool {
+	size_t stride = 0;
+	std::vector<uint8_t> slab;
+	std::vector<std::atomic<uint32_t>> next;
+	std::atomic<uint64_t> head{0};
+
+	SlotPool(size_t slots, size_t slotSize)
+	    : stride((slotSize + 63) & ~size_t(63)), slab(slots * stride), next(slots) {
+		for (size_t i = 0; i < slots; ++i) next[i].store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+		head.store(slots, std::memory_order_relaxed);
+	}
+
+	uint8_t* at(uint32_t index) { return slab.data() + static_cast<size_t>(index) * stride; }
+
+	// Returns the slot index, or -1 when empty.
+	long acquire() {
+		uint64_t h = head.load(std::memory_order_acquire);
+		while (true) {
+			uint32_t top = static_cast<uint32_t>(h);
+			if (top == 0) return -1;
+			uint64_t desired = ((h >> 32) + 1) << 32 | next[top - 1].load(std::memory_order_relaxed);
+			if (head.compare_exchange_weak(h, desired, std::memory_order_acquire, std::memory_order_acquire))
+				return static_cast<long>(top - 1);
+		}
+	}
+
+	void release(uint32_t index) {
+		uint64_t h = head.load(std::memory_order_relaxed);
+		while (true) {
+			next[index].store(static_cast<uint32_t>(h), std::memory_order_relaxed);
+			uint64_t desired = ((h >> 32) + 1) << 32 | (index + 1);
+			if (head.compare_exchange_weak(h, desired, std::memory_order_release, std::memory_order_relaxed)) return;
+		}
+	}
+};
@@ -0,0 +1,385 @@
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <semaphore.h>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "bench_core.h"
+#include "mpmc_queue.h"
+#include "payload_fill.h"
+
+using namespace std;
+
+// In-process work-stealing pool: the Linux counterpart of gcd_benchmark, with
+// the same options, backpressure and output. Producers hand each message to a
+// worker's queue round-robin (like the GCD serial worker queues); a worker that
+// finds its own queue empty steals from the others before parking on a futex.
+// max-inflight is enforced by a counting semaphore exactly like spaceSem:
+// producers wait on it before handing off, workers post it after consuming.
+struct Config : BenchConfig {
+	long maxInFlight = 1024;
+	bool zeroCopy = false;
+	int occupancyIntervalUs = 1000;
+};
+
+static void onSignal(int) {
+	stopFlag.store(true, memory_order_relaxed);
+}
+
+// The worker queues are mpmc_queue.h's BoundedQueue: many producers push
+// into one queue and both its owner and thieves take from it, which rules out
+// a Chase-Lev deque (single pushing owner); everyone takes from the head, so
+// the oldest message goes first whether it is popped or stolen.
+static constexpr int kSpinBeforePark = 256;
+// How long a parked worker sleeps before re-checking stopFlag on its own.
+static constexpr uint64_t kWaitNs = 100 * 1000 * 1000;
+
+// One message handed to a worker: the payload (a slab slot with --zero-copy,
+// otherwise a heap copy the worker frees) and its slot index.
+struct Task {
+	uint8_t* data = nullptr;
+	uint32_t slot = 0;
+};
+
+// The shared per-thread counters plus what only the work-stealing pool counts.
+struct alignas(64) StealCounters : ThreadCounters {
+	atomic<uint64_t> stolen{0};
+	atomic<uint64_t> parks{0};
+};
+
+struct Worker {
+	BoundedQueue<Task> queue;
+	FutexEvent wake{false};
+	StealCounters counters;
+	LatencyHistogram latHist;
+	WorkSink sink;
+
+	explicit Worker(size_t capacity) : queue(capacity) {}
+};
+
+static void usage(const char* argv0) {
+	cerr << "Usage: " << argv0 << " [options]\n";
+	cerr << "Options:\n";
+	cerr << "  --duration-seconds N       Default 5\n";
+	cerr << "  --message-size N           Default 256\n";
+	cerr << "  --max-inflight N           Default 1024 (bounded in-flight messages, as gcd_benchmark)\n";
+	cerr << "  --producers N              Default 1\n";
+	cerr << "  --consumers N              Default 1 (workers, one queue each)\n";
+	cerr << "  --random-payload true|false Default false\n";
+	cerr << "  --rate MSGS_PER_SEC        Default 0 (closed loop); total open-loop rate split across producers\n";
+	cerr << "  --zero-copy true|false     Default false (true: preallocated slab of max-inflight buffers, task carries a pointer)\n";
+	cerr << "  --occupancy-interval-us N  Default 1000; sample the in-flight count this often (0 disables)\n";
+	cerr << "  --latency-sample 0|1       Default 1 (record every message's latency; 0 disables the histograms)\n";
+	cerr << "  --clock SOURCE             auto|tsc|monotonic, default auto (calibrated TSC/cntvct when invariant)\n";
+	cerr << "  --work KERNEL              none|memcpy[:PASSES]|hash[:PASSES]|spin:NS per message, default none\n";
+	cerr << "  --print-interval N         Default 1 (seconds)\n";
+	cerr << "  --csv PATH                 Append CSV results to PATH\n";
+	cerr << "  --results PATH             Append a binary run record (histogram, intervals) for mq_report\n";
+}
+
+static Config parseArgs(int argc, char** argv) {
+	Config cfg;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		auto need = [&](const string& opt) {
+			if (i + 1 >= argc) {
+				cerr << "Missing value for " << opt << "\n";
+				usage(argv[0]);
+				exit(1);
+			}
+		};
+		auto value = [&]() -> const char* { need(arg); return argv[++i]; };
+		if (parseCommonOption(cfg, arg, value)) continue;
+		if (arg == "--max-inflight") { need(arg); cfg.maxInFlight = stol(argv[++i]); }
+		else if (arg == "--zero-copy") { need(arg); cfg.zeroCopy = parseBool(argv[++i]); }
+		else if (arg == "--occupancy-interval-us") { need(arg); cfg.occupancyIntervalUs = stoi(argv[++i]); }
+		else if (arg == "--help" || arg == "-h") { usage(argv[0]); exit(0); }
+		else {
+			cerr << "Unknown option: " << arg << "\n";
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+	return cfg;
+}
+
+int main(int argc, char** argv) {
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	Config cfg = parseArgs(argc, argv);
+
+	if (cfg.messageSize == 0 || cfg.producers <= 0 || cfg.consumers <= 0 ||
+	    cfg.durationSeconds <= 0 || cfg.printIntervalSeconds <= 0 || cfg.maxInFlight <= 0 || cfg.rate < 0.0 || cfg.occupancyIntervalUs < 0) {
+		cerr << "Invalid config\n";
+		return 1;
+	}
+	if (!setupClock(cfg.clock)) {
+		cerr << "clock must be auto, tsc or monotonic\n";
+		return 1;
+	}
+	if (!setupWork(cfg)) {
+		cerr << "work must be none, memcpy[:PASSES], hash[:PASSES] or spin:NS\n";
+		return 1;
+	}
+	if (cfg.maxInFlight >= 0xFFFFFFFFl || cfg.maxInFlight > SEM_VALUE_MAX) {
+		cerr << "max-inflight must be < " << min<long>(0xFFFFFFFFl, SEM_VALUE_MAX) << "\n";
+		return 1;
+	}
+
+	const size_t capacity = static_cast<size_t>(cfg.maxInFlight);
+	vector<unique_ptr<Worker>> workers;
+	for (int i = 0; i < cfg.consumers; ++i) workers.push_back(make_unique<Worker>(capacity));
+	sem_t spaceSem;
+	sem_init(&spaceSem, 0, static_cast<unsigned>(cfg.maxInFlight));
+
+	// --zero-copy: max-inflight slots of message-size bytes (cache-line stride)
+	// and a free list of their indices; spaceSem counts the free slots.
+	const size_t stride = (cfg.messageSize + 63) & ~size_t(63);
+	vector<uint8_t> slab(cfg.zeroCopy ? capacity * stride : 0);
+	BoundedQueue<uint32_t> freeSlots(cfg.zeroCopy ? capacity : 1);
+	if (cfg.zeroCopy) {
+		for (size_t i = 0; i < capacity; ++i) freeSlots.push(static_cast<uint32_t>(i));
+	}
+
+	vector<StealCounters> producerSlots(static_cast<size_t>(cfg.producers));
+	atomic<bool> workersDone{false};
+	atomic<uint64_t> rr{0};
+	atomic<int> parked{0};
+
+	// Counts the message, runs the --work kernel, records its latency and
+	// gives its space back.
+	auto consume = [&](Worker& self, const Task& task) {
+		ThreadCounters::bump(self.counters.messages);
+		ThreadCounters::bump(self.counters.bytes, cfg.messageSize);
+		ThreadCounters::bump(self.counters.workNs, runWork(cfg.workKernel, self.sink, task.data, cfg.messageSize));
+		if (cfg.latencySample && cfg.messageSize >= sizeof(MsgHeader)) {
+			const MsgHeader* h = reinterpret_cast<const MsgHeader*>(task.data);
+			uint64_t recvNs = nowNs();
+			if (recvNs >= h->intendedTimeNs) self.latHist.record(recvNs - h->intendedTimeNs);
+		}
+		if (cfg.zeroCopy) freeSlots.push(task.slot);
+		else delete[] task.data;
+		sem_post(&spaceSem);
+	};
+
+	// Own queue first, then the others starting with the next worker; spins
+	// briefly when everything is empty, then parks until a producer hands it
+	// (or, while its owner is busy, any queue) a message.
+	auto workFunc = [&](int id) {
+		Worker& self = *workers[static_cast<size_t>(id)];
+		const size_t n = workers.size();
+		int idle = 0;
+		Task task;
+		while (true) {
+			bool got = self.queue.pop(task);
+			for (size_t k = 1; !got && k < n; ++k) {
+				got = workers[(static_cast<size_t>(id) + k) % n]->queue.pop(task);
+				if (got) ThreadCounters::bump(self.counters.stolen);
+			}
+			if (got) {
+				consume(self, task);
+				idle = 0;
+				continue;
+			}
+			if (workersDone.load(memory_order_acquire)) break;
+			if (++idle < kSpinBeforePark) {
+				cpuRelax();
+				continue;
+			}
+			ThreadCounters::bump(self.counters.parks);
+			parked.fetch_add(1, memory_order_seq_cst);
+			eventWait(self.wake, kWaitNs, 0, [&] {
+				if (workersDone.load(memory_order_relaxed)) return true;
+				for (const auto& w : workers) if (!w->queue.empty()) return true;
+				return false;
+			});
+			parked.fetch_sub(1, memory_order_relaxed);
+			idle = 0;
+		}
+	};
+
+	auto produceFunc = [&](int producerId) {
+		StealCounters& counters = producerSlots[static_cast<size_t>(producerId)];
+		const bool hasHeader = cfg.messageSize >= sizeof(MsgHeader);
+		PayloadFill filler(static_cast<uint64_t>(producerId));
+		Pacer pacer(cfg.rate, cfg.producers, producerId);
+		uint64_t seq = 0;
+		while (!stopFlag.load(memory_order_relaxed)) {
+			uint64_t intended = 0;
+			if (pacer.enabled()) {
+				intended = pacer.next();
+				Pacer::waitUntil(intended);
+			}
+			// Stamped before waiting for space, as in gcd_benchmark, so the
+			// semaphore wait is charged to latency.
+			uint64_t sendNs = nowNs();
+			while (sem_wait(&spaceSem) != 0 && errno == EINTR) {}
+			if (stopFlag.load(memory_order_relaxed)) break;
+
+			// Header and payload are written straight into the message (its slab
+			// slot with --zero-copy), with no scratch buffer to copy from.
+			Task task;
+			if (cfg.zeroCopy) {
+				if (!freeSlots.pop(task.slot)) break;
+				task.data = slab.data() + static_cast<size_t>(task.slot) * stride;
+			} else {
+				task.data = new uint8_t[cfg.messageSize]();
+			}
+			if (hasHeader) {
+				MsgHeader* header = reinterpret_cast<MsgHeader*>(task.data);
+				header->sequence = seq++;
+				header->sendTimeNs = sendNs;
+				header->intendedTimeNs = pacer.enabled() ? intended : sendNs;
+				header->producerId = static_cast<uint32_t>(producerId);
+			}
+			if (cfg.randomPayload) {
+				size_t start = hasHeader ? sizeof(MsgHeader) : 0;
+				filler.fill(task.data + start, cfg.messageSize - start);
+			}
+			Worker& target = *workers[static_cast<size_t>(rr.fetch_add(1, memory_order_relaxed) % workers.size())];
+			// Cannot fail: all queues together never hold more than max-inflight.
+			target.queue.push(task);
+			// Wake the owner if it is parked; if it is busy, wake a parked
+			// worker to steal the message instead of letting it wait.
+			if (target.wake.waiters.load(memory_order_seq_cst) > 0) {
+				eventNotify(target.wake);
+			} else if (parked.load(memory_order_seq_cst) > 0) {
+				for (auto& w : workers) {
+					if (w->wake.waiters.load(memory_order_relaxed) == 0) continue;
+					eventNotify(w->wake);
+					break;
+				}
+			}
+			ThreadCounters::bump(counters.messages);
+			ThreadCounters::bump(counters.bytes, cfg.messageSize);
+		}
+	};
+
+	// Messages handed off but not yet taken by a worker (the gcd_benchmark
+	// in-flight gauge, bounded by spaceSem at max-inflight).
+	OccupancySampler occupancy(cfg.maxInFlight, 1, cfg.occupancyIntervalUs, [&](int) -> long {
+		size_t queued = 0;
+		for (const auto& w : workers) queued += w->queue.size();
+		return static_cast<long>(queued);
+	});
+	occupancy.start();
+
+	vector<thread> threads;
+	for (int i = 0; i < cfg.consumers; ++i) threads.emplace_back(workFunc, i);
+	vector<thread> producers;
+	for (int i = 0; i < cfg.producers; ++i) producers.emplace_back(produceFunc, i);
+
+	auto sumWorkers = [&](atomic<uint64_t> StealCounters::* field) {
+		uint64_t n = 0;
+		for (const auto& w : workers) n += (w->counters.*field).load(memory_order_relaxed);
+		return n;
+	};
+	auto sumProducers = [&](atomic<uint64_t> StealCounters::* field) {
+		uint64_t n = 0;
+		for (const StealCounters& c : producerSlots) n += (c.*field).load(memory_order_relaxed);
+		return n;
+	};
+
+	const auto start = chrono::steady_clock::now();
+	const auto endTime = start + chrono::seconds(cfg.durationSeconds);
+	IntervalSeries intervals;
+	while (chrono::steady_clock::now() < endTime && !stopFlag.load(memory_order_relaxed)) {
+		this_thread::sleep_for(chrono::seconds(cfg.printIntervalSeconds));
+		uint64_t sent = sumProducers(&ThreadCounters::messages);
+		uint64_t recv = sumWorkers(&ThreadCounters::messages);
+		intervals.add(chrono::duration<double>(chrono::steady_clock::now() - start).count(), sent, recv);
+		cout << "STEAL Progress: sent=" << sent << " recv=" << recv
+		     << " sentMiB=" << fixed << setprecision(2) << (double)sumProducers(&ThreadCounters::bytes) / (1024.0 * 1024.0)
+		     << " recvMiB=" << fixed << setprecision(2) << (double)sumWorkers(&ThreadCounters::bytes) / (1024.0 * 1024.0)
+		     << " stolen=" << sumWorkers(&StealCounters::stolen) << "\n";
+		cout.flush();
+	}
+	stopFlag.store(true, memory_order_relaxed);
+	occupancy.stop();
+	// Unblock producers waiting for space (at most one wait each), then let
+	// the workers drain what was handed off before they exit.
+	for (int i = 0; i < cfg.producers; ++i) sem_post(&spaceSem);
+	for (auto& t : producers) t.join();
+	workersDone.store(true, memory_order_release);
+	for (auto& w : workers) eventNotify(w->wake);
+	for (auto& t : threads) t.join();
+
+	const auto end = chrono::steady_clock::now();
+	double elapsedSec = chrono::duration<double>(end - start).count();
+	if (elapsedSec <= 0) elapsedSec = static_cast<double>(cfg.durationSeconds);
+	uint64_t sent = sumProducers(&ThreadCounters::messages);
+	uint64_t recv = sumWorkers(&ThreadCounters::messages);
+	uint64_t sbytes = sumProducers(&ThreadCounters::bytes);
+	uint64_t rbytes = sumWorkers(&ThreadCounters::bytes);
+	uint64_t stolen = sumWorkers(&StealCounters::stolen);
+	uint64_t parks = sumWorkers(&StealCounters::parks);
+	uint64_t workNs = sumWorkers(&ThreadCounters::workNs);
+
+	auto merged = make_unique<LatencyHistogram>();
+	for (const auto& w : workers) merged->merge(w->latHist);
+	vector<pair<double, double>> pctUs;
+	computePercentiles(*merged, pctUs);
+
+	double stolenPct = recv ? 100.0 * static_cast<double>(stolen) / static_cast<double>(recv) : 0.0;
+	cout << "\nSTEAL Summary:\n";
+	printThroughputSummary(elapsedSec, sent, recv, sbytes, rbytes);
+	if (cfg.zeroCopy) {
+		cout << "  payload:             slab " << cfg.maxInFlight << " x " << stride
+		     << " B (task carries a slot pointer, no per-message allocation)\n";
+	} else {
+		cout << "  payload:             copy (heap buffer per message, freed by the worker)\n";
+	}
+	cout << "  work-stealing:       stolen=" << stolen << " (" << fixed << setprecision(1) << stolenPct
+	     << "%) parks=" << parks << "\n";
+	for (int i = 0; i < cfg.consumers; ++i) {
+		const StealCounters& c = workers[static_cast<size_t>(i)]->counters;
+		double share = recv ? 100.0 * static_cast<double>(c.messages.load()) / static_cast<double>(recv) : 0.0;
+		cout << "  worker[" << i << "]:           recv=" << c.messages.load()
+		     << " msg/s=" << fixed << setprecision(2) << c.messages.load() / elapsedSec
+		     << " share=" << fixed << setprecision(1) << share << "%"
+		     << " stolen=" << c.stolen.load() << " parks=" << c.parks.load() << "\n";
+	}
+	printOfferedRate(cfg, sent, elapsedSec);
+	printWorkSummary(cfg, workNs, recv, elapsedSec, cfg.consumers);
+	printLatencySummary(pctUs);
+	printOccupancySummary(occupancy, 1, "in-flight", recv / elapsedSec);
+	const long peakRss = peakRssKiB();
+	cout << "  memory:              peak-rss=" << peakRss << " KiB\n";
+
+	ResultRow row;
+	row.backend = "steal";
+	row.queueName = "steal_queues";
+	row.depth = cfg.maxInFlight;
+	row.elapsedSec = elapsedSec;
+	row.recvMessages = recv;
+	row.recvBytes = rbytes;
+	row.pctUs = pctUs;
+	row.workNs = workNs;
+	row.hist = merged.get();
+	row.intervals = move(intervals.samples);
+	appendExtra(row.extra, "payload", cfg.zeroCopy ? "slab" : "copy");
+	if (cfg.rate > 0.0) appendExtra(row.extra, "rate", formatDouble(cfg.rate));
+	appendExtra(row.extra, "stolen", to_string(stolen));
+	appendExtra(row.extra, "stolenPct", formatDouble(stolenPct, 1));
+	appendExtra(row.extra, "parks", to_string(parks));
+	appendOccupancyExtras(row.extra, occupancy, 1, recv / elapsedSec);
+	appendExtra(row.extra, "peakRssKiB", to_string(peakRss));
+	appendResultRow(cfg, row);
+
+	sem_destroy(&spaceSem);
+	return 0;
+}
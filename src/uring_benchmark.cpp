@@ -0,0 +1,756 @@
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <poll.h>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "bench_core.h"
+#include "payload_fill.h"
+
+using namespace std;
+
+// io_uring counterpart of mq_benchmark: the same common options, summary and
+// CSV row, with the per-message blocking syscall replaced by batched
+// submission. Two carriers:
+//   pipe    producers keep --batch IORING_OP_WRITEs in flight on one shared
+//           pipe and consumers keep --batch IORING_OP_READs in flight, so one
+//           io_uring_enter submits and reaps up to a batch of messages.
+//   mqueue  mq_send/mq_receive on O_NONBLOCK descriptors (io_uring has no
+//           mqueue opcode), with IORING_OP_POLL_ADD as the readiness wait
+//           once a queue is full or empty; consumers drain up to --batch
+//           messages per wakeup.
+// The loops drive the ring directly rather than through Transport, whose
+// one-message-per-call shape is exactly what batching removes.
+struct Config : BenchConfig {
+	string queueName = "/uring_bench";
+	string carrier = "pipe";
+	long maxMessages = 1024;
+	int batch = 32;
+	bool unlinkAtStart = true;
+	bool unlinkAtEnd = true;
+};
+
+static void onSignal(int) {
+	stopFlag.store(true, memory_order_relaxed);
+}
+
+// The shared ThreadCounters plus the io_uring backend's syscall counts.
+struct alignas(64) UringCounters : ThreadCounters {
+	atomic<uint64_t> enters{0};   // io_uring_enter calls
+	atomic<uint64_t> syscalls{0}; // enters plus direct mq_send/mq_receive calls
+};
+
+struct UringStats : Stats {
+	uint64_t enters = 0;
+	uint64_t syscalls = 0;
+};
+
+static UringStats sumUringCounters(const vector<UringCounters>& producerSlots, const vector<UringCounters>& consumerSlots) {
+	UringStats s;
+	addCounters(s, producerSlots.data(), static_cast<int>(producerSlots.size()), consumerSlots.data(),
+	            static_cast<int>(consumerSlots.size()));
+	for (const vector<UringCounters>* slots : {&producerSlots, &consumerSlots}) {
+		for (const UringCounters& c : *slots) {
+			s.enters += c.enters.load(memory_order_relaxed);
+			s.syscalls += c.syscalls.load(memory_order_relaxed);
+		}
+	}
+	return s;
+}
+
+// Minimal io_uring over the raw syscalls (no liburing dependency). One ring
+// per thread, so the SQ tail and CQ head are only written by their owner; the
+// kernel side is synchronised with acquire/release on the shared indices.
+class Uring {
+public:
+	~Uring() {
+		if (sqRing_ && sqRing_ != MAP_FAILED) munmap(sqRing_, sqRingBytes_);
+		if (!singleMmap_ && cqRing_ && cqRing_ != MAP_FAILED) munmap(cqRing_, cqRingBytes_);
+		if (sqes_ && sqes_ != MAP_FAILED) munmap(sqes_, sqesBytes_);
+		if (fd_ >= 0) close(fd_);
+	}
+
+	// Returns false with errno set when the kernel refuses the ring.
+	bool init(unsigned entries) {
+		io_uring_params p{};
+		p.flags = IORING_SETUP_COOP_TASKRUN;
+		fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+		if (fd_ < 0 && errno == EINVAL) {
+			p = io_uring_params{};
+			fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+		}
+		if (fd_ < 0) return false;
+		if (!(p.features & IORING_FEAT_EXT_ARG)) {
+			errno = ENOSYS;
+			return false;
+		}
+		sqRingBytes_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+		cqRingBytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		singleMmap_ = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (singleMmap_) sqRingBytes_ = cqRingBytes_ = max(sqRingBytes_, cqRingBytes_);
+		sqRing_ = mmap(nullptr, sqRingBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+		if (sqRing_ == MAP_FAILED) return false;
+		if (singleMmap_) {
+			cqRing_ = sqRing_;
+		} else {
+			cqRing_ = mmap(nullptr, cqRingBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+			if (cqRing_ == MAP_FAILED) return false;
+		}
+		sqesBytes_ = p.sq_entries * sizeof(io_uring_sqe);
+		sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqesBytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+		if (sqes_ == MAP_FAILED) return false;
+
+		uint8_t* sq = static_cast<uint8_t*>(sqRing_);
+		sqHead_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.head);
+		sqTail_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.tail);
+		sqMask_ = *reinterpret_cast<uint32_t*>(sq + p.sq_off.ring_mask);
+		sqEntries_ = p.sq_entries;
+		sqArray_ = reinterpret_cast<uint32_t*>(sq + p.sq_off.array);
+		uint8_t* cq = static_cast<uint8_t*>(cqRing_);
+		cqHead_ = reinterpret_cast<uint32_t*>(cq + p.cq_off.head);
+		cqTail_ = reinterpret_cast<uint32_t*>(cq + p.cq_off.tail);
+		cqMask_ = *reinterpret_cast<uint32_t*>(cq + p.cq_off.ring_mask);
+		cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+		localTail_ = *sqTail_;
+		return true;
+	}
+
+	// Next free SQE, zeroed, or nullptr while the SQ is full.
+	io_uring_sqe* next() {
+		if (localTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_) return nullptr;
+		uint32_t index = localTail_ & sqMask_;
+		io_uring_sqe* sqe = &sqes_[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqArray_[index] = index;
+		localTail_++;
+		pending_++;
+		return sqe;
+	}
+
+	// Submits everything queued by next() and, with waitFor > 0, waits up to
+	// timeoutNs for that many completions. Returns -1 only on a real error;
+	// a timeout or a signal is a normal return.
+	int enter(unsigned waitFor, uint64_t timeoutNs) {
+		__atomic_store_n(sqTail_, localTail_, __ATOMIC_RELEASE);
+		unsigned flags = 0;
+		__kernel_timespec ts{static_cast<long long>(timeoutNs / 1000000000ull), static_cast<long long>(timeoutNs % 1000000000ull)};
+		io_uring_getevents_arg arg{};
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+		if (waitFor > 0) flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		long ret = syscall(__NR_io_uring_enter, fd_, pending_, waitFor, flags,
+		                   waitFor > 0 ? static_cast<void*>(&arg) : nullptr, waitFor > 0 ? sizeof(arg) : 0);
+		if (ret >= 0) {
+			pending_ -= static_cast<unsigned>(ret);
+			return static_cast<int>(ret);
+		}
+		if (errno == ETIME || errno == EINTR || errno == EBUSY) return 0;
+		return -1;
+	}
+
+	// Calls onCqe(userData, res) for every available completion.
+	template <typename OnCqe>
+	unsigned reap(OnCqe onCqe) {
+		uint32_t head = *cqHead_;
+		uint32_t tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+		unsigned n = 0;
+		for (; head != tail; ++head, ++n) {
+			const io_uring_cqe& cqe = cqes_[head & cqMask_];
+			onCqe(cqe.user_data, cqe.res);
+		}
+		__atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+		return n;
+	}
+
+private:
+	int fd_ = -1;
+	bool singleMmap_ = false;
+	void* sqRing_ = nullptr;
+	void* cqRing_ = nullptr;
+	io_uring_sqe* sqes_ = nullptr;
+	size_t sqRingBytes_ = 0;
+	size_t cqRingBytes_ = 0;
+	size_t sqesBytes_ = 0;
+	uint32_t* sqHead_ = nullptr;
+	uint32_t* sqTail_ = nullptr;
+	uint32_t* sqArray_ = nullptr;
+	uint32_t sqMask_ = 0;
+	uint32_t sqEntries_ = 0;
+	uint32_t* cqHead_ = nullptr;
+	uint32_t* cqTail_ = nullptr;
+	uint32_t cqMask_ = 0;
+	io_uring_cqe* cqes_ = nullptr;
+	uint32_t localTail_ = 0;
+	unsigned pending_ = 0;
+};
+
+// How long a wait in io_uring_enter lasts before the loop re-checks stopFlag.
+static constexpr uint64_t kWaitNs = 100 * 1000 * 1000;
+static constexpr uint64_t kCancelTag = ~0ull;
+
+static void prepRw(io_uring_sqe* sqe, uint8_t op, int fd, void* buf, size_t len, uint64_t userData) {
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t>(buf);
+	sqe->len = static_cast<uint32_t>(len);
+	sqe->off = ~0ull; // current position; pipes ignore it
+	sqe->user_data = userData;
+}
+
+static void prepPoll(io_uring_sqe* sqe, int fd, unsigned events, uint64_t userData) {
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = userData;
+}
+
+// Cancels whatever is still in flight and waits (bounded) for the
+// completions, so no request outlives the buffers it points into.
+static void drainInFlight(Uring& ring, size_t& inFlight, UringCounters& counters) {
+	if (inFlight == 0) return;
+	if (io_uring_sqe* sqe = ring.next()) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+		sqe->user_data = kCancelTag;
+	}
+	for (int tries = 0; inFlight > 0 && tries < 10; ++tries) {
+		UringCounters::bump(counters.enters);
+		UringCounters::bump(counters.syscalls);
+		if (ring.enter(1, kWaitNs) < 0) break;
+		ring.reap([&](uint64_t userData, int) {
+			if (userData != kCancelTag && inFlight > 0) inFlight--;
+		});
+	}
+}
+
+static void stampHeader(uint8_t* record, const Config& cfg, Pacer& pacer, PayloadFill& filler, uint64_t seq, int producerId) {
+	MsgHeader* header = cfg.messageSize >= sizeof(MsgHeader) ? reinterpret_cast<MsgHeader*>(record) : nullptr;
+	uint64_t intended = 0;
+	if (pacer.enabled()) {
+		intended = pacer.next();
+		Pacer::waitUntil(intended);
+	}
+	if (cfg.randomPayload) {
+		size_t start = header ? sizeof(MsgHeader) : 0;
+		filler.fill(record + start, cfg.messageSize - start);
+	}
+	if (header) {
+		header->sequence = seq;
+		header->sendTimeNs = nowNs();
+		header->intendedTimeNs = pacer.enabled() ? intended : header->sendTimeNs;
+		header->producerId = static_cast<uint32_t>(producerId);
+	}
+}
+
+static void recordLatency(const uint8_t* record, size_t len, const Config& cfg, LatencyHistogram& latHist) {
+	if (!cfg.latencySample || len < sizeof(MsgHeader)) return;
+	const MsgHeader* header = reinterpret_cast<const MsgHeader*>(record);
+	uint64_t recvNs = nowNs();
+	if (recvNs >= header->intendedTimeNs) latHist.record(recvNs - header->intendedTimeNs);
+}
+
+// Keeps up to batch writes in flight, each from its own slot: every pass
+// refills the free slots, submits them in one io_uring_enter and waits for a
+// completion only when no slot is free. With --rate a message is submitted as
+// soon as it is due.
+static void pipeProducer(int fd, const Config& cfg, UringCounters& counters, int producerId) {
+	Uring ring;
+	const size_t slots = static_cast<size_t>(cfg.batch);
+	if (!ring.init(static_cast<unsigned>(slots) + 1)) {
+		perror("io_uring_setup");
+		UringCounters::bump(counters.errors);
+		return;
+	}
+	vector<uint8_t> buffers(slots * cfg.messageSize, 0);
+	vector<uint32_t> freeSlots;
+	for (size_t s = slots; s-- > 0;) freeSlots.push_back(static_cast<uint32_t>(s));
+	PayloadFill filler(static_cast<uint64_t>(producerId));
+	Pacer pacer(cfg.rate, cfg.producers, producerId);
+	size_t inFlight = 0;
+	uint64_t seq = 0;
+	while (!stopFlag.load(memory_order_relaxed)) {
+		while (!freeSlots.empty() && !stopFlag.load(memory_order_relaxed)) {
+			uint32_t slot = freeSlots.back();
+			uint8_t* record = buffers.data() + slot * cfg.messageSize;
+			io_uring_sqe* sqe = ring.next();
+			if (!sqe) break;
+			freeSlots.pop_back();
+			stampHeader(record, cfg, pacer, filler, seq++, producerId);
+			prepRw(sqe, IORING_OP_WRITE, fd, record, cfg.messageSize, slot);
+			inFlight++;
+			if (pacer.enabled()) break;
+		}
+		UringCounters::bump(counters.enters);
+		UringCounters::bump(counters.syscalls);
+		if (ring.enter(freeSlots.empty() ? 1 : 0, kWaitNs) < 0) {
+			UringCounters::bump(counters.errors);
+			break;
+		}
+		ring.reap([&](uint64_t slot, int res) {
+			inFlight--;
+			freeSlots.push_back(static_cast<uint32_t>(slot));
+			if (res == static_cast<int>(cfg.messageSize)) {
+				UringCounters::bump(counters.messages);
+				UringCounters::bump(counters.bytes, cfg.messageSize);
+			} else if (res == -EAGAIN) {
+				UringCounters::bump(counters.eagain);
+			} else {
+				UringCounters::bump(counters.errors);
+			}
+		});
+	}
+	drainInFlight(ring, inFlight, counters);
+}
+
+// Keeps a read of message-size bytes in flight per slot and re-arms each one
+// as it completes; the re-arms go out with the next wait. Every write is at
+// most PIPE_BUF bytes (atomic) and every read asks for exactly one message, so
+// reads never split or merge records.
+static void pipeConsumer(int fd, const Config& cfg, UringCounters& counters, LatencyHistogram& latHist) {
+	Uring ring;
+	const size_t slots = static_cast<size_t>(cfg.batch);
+	if (!ring.init(static_cast<unsigned>(slots) + 1)) {
+		perror("io_uring_setup");
+		UringCounters::bump(counters.errors);
+		return;
+	}
+	vector<uint8_t> buffers(slots * cfg.messageSize, 0);
+	WorkSink sink;
+	size_t inFlight = 0;
+	auto arm = [&](uint32_t slot) {
+		io_uring_sqe* sqe = ring.next();
+		if (!sqe) return;
+		prepRw(sqe, IORING_OP_READ, fd, buffers.data() + slot * cfg.messageSize, cfg.messageSize, slot);
+		inFlight++;
+	};
+	for (size_t s = 0; s < slots; ++s) arm(static_cast<uint32_t>(s));
+	while (!stopFlag.load(memory_order_relaxed)) {
+		UringCounters::bump(counters.enters);
+		UringCounters::bump(counters.syscalls);
+		if (ring.enter(1, kWaitNs) < 0) {
+			UringCounters::bump(counters.errors);
+			break;
+		}
+		ring.reap([&](uint64_t slot, int res) {
+			inFlight--;
+			if (res > 0) {
+				UringCounters::bump(counters.messages);
+				UringCounters::bump(counters.bytes, static_cast<uint64_t>(res));
+				const uint8_t* msg = buffers.data() + slot * cfg.messageSize;
+				UringCounters::bump(counters.workNs, runWork(cfg.workKernel, sink, msg, static_cast<size_t>(res)));
+				recordLatency(msg, static_cast<size_t>(res), cfg, latHist);
+			} else if (res == -EAGAIN) {
+				UringCounters::bump(counters.eagain);
+			} else {
+				UringCounters::bump(counters.errors);
+			}
+			if (!stopFlag.load(memory_order_relaxed)) arm(static_cast<uint32_t>(slot));
+		});
+	}
+	drainInFlight(ring, inFlight, counters);
+}
+
+// Sends until the queue is full, then parks on a POLLOUT poll request.
+static void mqueueProducer(mqd_t mq, const Config& cfg, UringCounters& counters, int producerId) {
+	Uring ring;
+	if (!ring.init(2)) {
+		perror("io_uring_setup");
+		UringCounters::bump(counters.errors);
+		return;
+	}
+	vector<uint8_t> buffer(cfg.messageSize, 0);
+	PayloadFill filler(static_cast<uint64_t>(producerId));
+	Pacer pacer(cfg.rate, cfg.producers, producerId);
+	bool pending = false;
+	size_t inFlight = 0;
+	uint64_t seq = 0;
+	while (!stopFlag.load(memory_order_relaxed)) {
+		if (!pending) stampHeader(buffer.data(), cfg, pacer, filler, seq, producerId);
+		UringCounters::bump(counters.syscalls);
+		if (mq_send(mq, reinterpret_cast<const char*>(buffer.data()), cfg.messageSize, 0) == 0) {
+			pending = false;
+			seq++;
+			UringCounters::bump(counters.messages);
+			UringCounters::bump(counters.bytes, cfg.messageSize);
+			continue;
+		}
+		pending = true;
+		if (errno != EAGAIN) {
+			UringCounters::bump(counters.errors);
+			continue;
+		}
+		UringCounters::bump(counters.eagain);
+		if (inFlight == 0) {
+			if (io_uring_sqe* sqe = ring.next()) {
+				prepPoll(sqe, static_cast<int>(mq), POLLOUT, 0);
+				inFlight++;
+			}
+		}
+		UringCounters::bump(counters.enters);
+		UringCounters::bump(counters.syscalls);
+		if (ring.enter(1, kWaitNs) < 0) {
+			UringCounters::bump(counters.errors);
+			break;
+		}
+		ring.reap([&](uint64_t, int) { inFlight--; });
+	}
+	drainInFlight(ring, inFlight, counters);
+}
+
+// Drains up to batch messages, then parks on a POLLIN poll request.
+static void mqueueConsumer(mqd_t mq, const Config& cfg, UringCounters& counters, LatencyHistogram& latHist) {
+	Uring ring;
+	if (!ring.init(2)) {
+		perror("io_uring_setup");
+		UringCounters::bump(counters.errors);
+		return;
+	}
+	mq_attr attr{};
+	mq_getattr(mq, &attr);
+	vector<uint8_t> buffer(static_cast<size_t>(max<long>(attr.mq_msgsize, static_cast<long>(cfg.messageSize))), 0);
+	WorkSink sink;
+	size_t inFlight = 0;
+	while (!stopFlag.load(memory_order_relaxed)) {
+		bool empty = false;
+		for (int k = 0; k < cfg.batch; ++k) {
+			UringCounters::bump(counters.syscalls);
+			ssize_t n = mq_receive(mq, reinterpret_cast<char*>(buffer.data()), buffer.size(), nullptr);
+			if (n < 0) {
+				if (errno == EAGAIN) empty = true;
+				else UringCounters::bump(counters.errors);
+				break;
+			}
+			UringCounters::bump(counters.messages);
+			UringCounters::bump(counters.bytes, static_cast<uint64_t>(n));
+			UringCounters::bump(counters.workNs, runWork(cfg.workKernel, sink, buffer.data(), static_cast<size_t>(n)));
+			recordLatency(buffer.data(), static_cast<size_t>(n), cfg, latHist);
+		}
+		if (!empty) continue;
+		UringCounters::bump(counters.eagain);
+		if (inFlight == 0) {
+			if (io_uring_sqe* sqe = ring.next()) {
+				prepPoll(sqe, static_cast<int>(mq), POLLIN, 0);
+				inFlight++;
+			}
+		}
+		UringCounters::bump(counters.enters);
+		UringCounters::bump(counters.syscalls);
+		if (ring.enter(1, kWaitNs) < 0) {
+			UringCounters::bump(counters.errors);
+			break;
+		}
+		ring.reap([&](uint64_t, int) { inFlight--; });
+	}
+	drainInFlight(ring, inFlight, counters);
+}
+
+static void printConfig(const Config& cfg) {
+	cout << "Configuration:\n";
+	cout << "  carrier:              " << cfg.carrier << "\n";
+	if (cfg.carrier == "mqueue") cout << "  queue-name:           " << cfg.queueName << "\n";
+	cout << "  duration-seconds:     " << cfg.durationSeconds << "\n";
+	cout << "  message-size:         " << cfg.messageSize << "\n";
+	cout << "  max-messages:         " << cfg.maxMessages << "\n";
+	cout << "  producers:            " << cfg.producers << "\n";
+	cout << "  consumers:            " << cfg.consumers << "\n";
+	cout << "  batch:                " << cfg.batch << "\n";
+	cout << "  random-payload:       " << (cfg.randomPayload ? "true" : "false") << "\n";
+	cout << "  rate:                 " << (cfg.rate > 0.0 ? to_string(cfg.rate) : string("closed-loop")) << "\n";
+	cout << "  latency-sample:       " << (cfg.latencySample ? "every message" : "off") << "\n";
+	cout << "  clock:                " << cfg.clock << "\n";
+	cout << "  work:                 " << cfg.work << "\n";
+	cout << "  print-interval-s:     " << cfg.printIntervalSeconds << "\n";
+	if (!cfg.csvPath.empty()) {
+		cout << "  csv-path:             " << cfg.csvPath << "\n";
+	}
+	if (!cfg.resultsPath.empty()) {
+		cout << "  results-path:         " << cfg.resultsPath << "\n";
+	}
+	cout.flush();
+}
+
+static void usage(const char* argv0) {
+	cerr << "Usage: " << argv0 << " [options]\n";
+	cerr << "Options:\n";
+	cerr << "  --carrier pipe|mqueue      Default pipe (batched io_uring READ/WRITE); mqueue polls mqd_t readiness\n";
+	cerr << "  --queue-name NAME          Default /uring_bench (mqueue carrier)\n";
+	cerr << "  --duration-seconds N       Default 5\n";
+	cerr << "  --message-size N           Default 256 (<= PIPE_BUF for pipe, <= msgsize_max for mqueue)\n";
+	cerr << "  --max-messages N           Default 1024 (pipe buffer = N x message-size, or mq_maxmsg)\n";
+	cerr << "  --producers N              Default 1\n";
+	cerr << "  --consumers N              Default 1\n";
+	cerr << "  --batch N                  Default 32 (requests in flight per thread / messages drained per wakeup)\n";
+	cerr << "  --unlink-start true|false  Default true (mqueue carrier)\n";
+	cerr << "  --unlink-end true|false    Default true (mqueue carrier)\n";
+	cerr << "  --random-payload true|false Default false\n";
+	cerr << "  --rate MSGS_PER_SEC        Default 0 (closed loop); total open-loop rate split across producers\n";
+	cerr << "  --latency-sample 0|1       Default 1 (record every message's latency; 0 disables the histograms)\n";
+	cerr << "  --clock SOURCE             auto|tsc|monotonic, default auto (calibrated TSC/cntvct when invariant)\n";
+	cerr << "  --work KERNEL              none|memcpy[:PASSES]|hash[:PASSES]|spin:NS per message, default none\n";
+	cerr << "  --print-interval N         Default 1 (seconds)\n";
+	cerr << "  --csv PATH                 Append CSV results to PATH\n";
+	cerr << "  --results PATH             Append a binary run record (histogram, intervals) for mq_report\n";
+}
+
+static Config parseArgs(int argc, char** argv) {
+	Config cfg;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		auto need = [&](const string& opt) {
+			if (i + 1 >= argc) {
+				cerr << "Missing value for " << opt << "\n";
+				usage(argv[0]);
+				exit(1);
+			}
+		};
+		auto value = [&]() -> const char* { need(arg); return argv[++i]; };
+		if (parseCommonOption(cfg, arg, value)) continue;
+		if (arg == "--carrier") { need(arg); cfg.carrier = argv[++i]; }
+		else if (arg == "--queue-name") { need(arg); cfg.queueName = argv[++i]; }
+		else if (arg == "--max-messages") { need(arg); cfg.maxMessages = stol(argv[++i]); }
+		else if (arg == "--batch") { need(arg); cfg.batch = stoi(argv[++i]); }
+		else if (arg == "--unlink-start") { need(arg); cfg.unlinkAtStart = parseBool(argv[++i]); }
+		else if (arg == "--unlink-end") { need(arg); cfg.unlinkAtEnd = parseBool(argv[++i]); }
+		else if (arg == "--help" || arg == "-h") { usage(argv[0]); exit(0); }
+		else {
+			cerr << "Unknown option: " << arg << "\n";
+			usage(argv[0]);
+			exit(1);
+		}
+	}
+	return cfg;
+}
+
+int main(int argc, char** argv) {
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+	signal(SIGPIPE, SIG_IGN);
+
+	Config cfg = parseArgs(argc, argv);
+	printConfig(cfg);
+
+	if (cfg.messageSize == 0) {
+		cerr << "message-size must be > 0\n";
+		return 1;
+	}
+	if (cfg.producers <= 0 || cfg.consumers <= 0) {
+		cerr << "producers and consumers must be >= 1\n";
+		return 1;
+	}
+	if (cfg.durationSeconds <= 0) {
+		cerr << "duration-seconds must be >= 1\n";
+		return 1;
+	}
+	if (cfg.printIntervalSeconds <= 0) {
+		cerr << "print-interval must be >= 1\n";
+		return 1;
+	}
+	if (!setupClock(cfg.clock)) {
+		cerr << "clock must be auto, tsc or monotonic\n";
+		return 1;
+	}
+	if (!setupWork(cfg)) {
+		cerr << "work must be none, memcpy[:PASSES], hash[:PASSES] or spin:NS\n";
+		return 1;
+	}
+	if (cfg.maxMessages <= 0) {
+		cerr << "max-messages must be >= 1\n";
+		return 1;
+	}
+	if (cfg.batch <= 0 || cfg.batch > 4096) {
+		cerr << "batch must be in 1..4096\n";
+		return 1;
+	}
+	if (cfg.rate < 0.0) {
+		cerr << "rate must be >= 0\n";
+		return 1;
+	}
+	if (cfg.carrier != "pipe" && cfg.carrier != "mqueue") {
+		cerr << "carrier must be pipe or mqueue\n";
+		return 1;
+	}
+	if (cfg.carrier == "pipe" && cfg.messageSize > PIPE_BUF) {
+		cerr << "message-size must be <= " << PIPE_BUF << " (PIPE_BUF) with --carrier pipe\n";
+		return 1;
+	}
+
+	// Probe once here so an unsupported kernel fails with one clear message
+	// instead of one perror per thread.
+	{
+		Uring probe;
+		if (!probe.init(2)) {
+			cerr << "io_uring unavailable: " << strerror(errno)
+			     << (errno == ENOSYS ? " (needs Linux >= 5.11 with IORING_FEAT_EXT_ARG)" : "")
+			     << (errno == EPERM ? " (see /proc/sys/kernel/io_uring_disabled)" : "") << "\n";
+			return 2;
+		}
+	}
+
+	int pipeFds[2] = {-1, -1};
+	mqd_t mq = static_cast<mqd_t>(-1);
+	long depth = cfg.maxMessages;
+	if (cfg.carrier == "pipe") {
+		if (pipe2(pipeFds, O_CLOEXEC) != 0) {
+			perror("pipe2");
+			return 2;
+		}
+		long maxPipe = readLongFromFile("/proc/sys/fs/pipe-max-size", 1048576);
+		long wanted = min<long>(cfg.maxMessages * static_cast<long>(cfg.messageSize), maxPipe);
+		fcntl(pipeFds[1], F_SETPIPE_SZ, static_cast<int>(wanted));
+		long actual = fcntl(pipeFds[1], F_GETPIPE_SZ);
+		if (actual > 0) depth = actual / static_cast<long>(cfg.messageSize);
+		cout << "Effective pipe attributes:\n";
+		cout << "  bytes:       " << actual << "\n";
+		cout << "  messages:    " << depth << "\n";
+	} else {
+		long sysMaxmsg = readLongFromFile("/proc/sys/fs/mqueue/msg_max", 10);
+		long sysMsgsize = readLongFromFile("/proc/sys/fs/mqueue/msgsize_max", 8192);
+		if (depth > sysMaxmsg) {
+			cerr << "Note: requested max-messages=" << depth << " exceeds system msg_max=" << sysMaxmsg << ", capping.\n";
+			depth = sysMaxmsg;
+		}
+		if (static_cast<long>(cfg.messageSize) > sysMsgsize) {
+			cerr << "message-size must be <= system msgsize_max=" << sysMsgsize << " with --carrier mqueue\n";
+			return 1;
+		}
+		if (cfg.unlinkAtStart) mq_unlink(cfg.queueName.c_str());
+		mq_attr attr{};
+		attr.mq_maxmsg = depth;
+		attr.mq_msgsize = static_cast<long>(cfg.messageSize);
+		mq = mq_open(cfg.queueName.c_str(), O_CREAT | O_RDWR | O_NONBLOCK | O_CLOEXEC, 0600, &attr);
+		if (mq == static_cast<mqd_t>(-1)) {
+			perror("mq_open");
+			return 2;
+		}
+		mq_getattr(mq, &attr);
+		depth = attr.mq_maxmsg;
+		cout << "Effective queue attributes:\n";
+		cout << "  mq_maxmsg:   " << attr.mq_maxmsg << "\n";
+		cout << "  mq_msgsize:  " << attr.mq_msgsize << "\n";
+	}
+	cout.flush();
+
+	vector<UringCounters> producerSlots(static_cast<size_t>(cfg.producers));
+	vector<UringCounters> consumerSlots(static_cast<size_t>(cfg.consumers));
+	vector<LatencyHistogram> hists(static_cast<size_t>(cfg.consumers));
+	vector<thread> threads;
+	threads.reserve(static_cast<size_t>(cfg.producers + cfg.consumers));
+	for (int i = 0; i < cfg.consumers; ++i) {
+		threads.emplace_back([&, i] {
+			if (cfg.carrier == "pipe") pipeConsumer(pipeFds[0], cfg, consumerSlots[static_cast<size_t>(i)], hists[static_cast<size_t>(i)]);
+			else mqueueConsumer(mq, cfg, consumerSlots[static_cast<size_t>(i)], hists[static_cast<size_t>(i)]);
+		});
+	}
+	for (int i = 0; i < cfg.producers; ++i) {
+		threads.emplace_back([&, i] {
+			if (cfg.carrier == "pipe") pipeProducer(pipeFds[1], cfg, producerSlots[static_cast<size_t>(i)], i);
+			else mqueueProducer(mq, cfg, producerSlots[static_cast<size_t>(i)], i);
+		});
+	}
+
+	const auto start = chrono::steady_clock::now();
+	const auto endTime = start + chrono::seconds(cfg.durationSeconds);
+	IntervalSeries intervals;
+	while (chrono::steady_clock::now() < endTime && !stopFlag.load(memory_order_relaxed)) {
+		this_thread::sleep_for(chrono::seconds(cfg.printIntervalSeconds));
+		UringStats snap = sumUringCounters(producerSlots, consumerSlots);
+		intervals.add(chrono::duration<double>(chrono::steady_clock::now() - start).count(), snap.sentMessages,
+		              snap.recvMessages);
+		cout << "URING Progress: sent=" << snap.sentMessages << " recv=" << snap.recvMessages
+		     << " sentMiB=" << fixed << setprecision(2) << (double)snap.sentBytes / (1024.0 * 1024.0)
+		     << " recvMiB=" << fixed << setprecision(2) << (double)snap.recvBytes / (1024.0 * 1024.0)
+		     << " enters=" << snap.enters << "\n";
+		cout.flush();
+	}
+	stopFlag.store(true, memory_order_relaxed);
+	for (auto& t : threads) t.join();
+
+	const auto end = chrono::steady_clock::now();
+	double elapsedSec = chrono::duration<double>(end - start).count();
+	if (elapsedSec <= 0) elapsedSec = static_cast<double>(cfg.durationSeconds);
+
+	UringStats stats = sumUringCounters(producerSlots, consumerSlots);
+	uint64_t sent = stats.sentMessages;
+	uint64_t recv = stats.recvMessages;
+
+	auto merged = make_unique<LatencyHistogram>();
+	for (const LatencyHistogram& h : hists) merged->merge(h);
+	vector<pair<double, double>> pctUs;
+	computePercentiles(*merged, pctUs);
+
+	uint64_t moved = sent + recv;
+	double msgsPerEnter = stats.enters ? static_cast<double>(moved) / static_cast<double>(stats.enters) : 0.0;
+	double syscallsPerMsg = moved ? static_cast<double>(stats.syscalls) / static_cast<double>(moved) : 0.0;
+
+	cout << "\nURING Summary:\n";
+	printThroughputSummary(elapsedSec, sent, recv, stats.sentBytes, stats.recvBytes);
+	printOfferedRate(cfg, sent, elapsedSec);
+	printWorkSummary(cfg, stats.workNs, recv, elapsedSec, cfg.consumers);
+	cout << "  send-errors:         " << stats.sendErrors << " (EAGAIN " << stats.sendEagain << ")\n";
+	cout << "  recv-errors:         " << stats.recvErrors << " (EAGAIN " << stats.recvEagain << ")\n";
+	cout << "  io_uring:            enters=" << stats.enters << " msgs/enter=" << fixed << setprecision(2) << msgsPerEnter
+	     << " syscalls/msg=" << fixed << setprecision(3) << syscallsPerMsg << " (sends + receives)\n";
+	for (int i = 0; i < cfg.producers; ++i) {
+		const UringCounters& c = producerSlots[static_cast<size_t>(i)];
+		cout << "  producer[" << i << "]:         sent=" << c.messages.load()
+		     << " msg/s=" << fixed << setprecision(2) << c.messages.load() / elapsedSec
+		     << " errors=" << c.errors.load() << " eagain=" << c.eagain.load() << " enters=" << c.enters.load() << "\n";
+	}
+	for (int i = 0; i < cfg.consumers; ++i) {
+		const UringCounters& c = consumerSlots[static_cast<size_t>(i)];
+		double share = recv ? 100.0 * static_cast<double>(c.messages.load()) / static_cast<double>(recv) : 0.0;
+		cout << "  consumer[" << i << "]:         recv=" << c.messages.load()
+		     << " msg/s=" << fixed << setprecision(2) << c.messages.load() / elapsedSec
+		     << " share=" << fixed << setprecision(1) << share << "%"
+		     << " errors=" << c.errors.load() << " eagain=" << c.eagain.load() << " enters=" << c.enters.load() << "\n";
+	}
+	printLatencySummary(pctUs);
+
+	string extra;
+	if (cfg.rate > 0.0) appendExtra(extra, "rate", formatDouble(cfg.rate));
+	appendExtra(extra, "carrier", cfg.carrier);
+	appendExtra(extra, "batch", to_string(cfg.batch));
+	appendExtra(extra, "enters", to_string(stats.enters));
+	appendExtra(extra, "msgsPerEnter", formatDouble(msgsPerEnter));
+	appendExtra(extra, "syscallsPerMsg", formatDouble(syscallsPerMsg, 4));
+	ResultRow row;
+	row.backend = "io_uring_" + cfg.carrier;
+	row.queueName = cfg.carrier == "mqueue" ? cfg.queueName : "pipe";
+	row.depth = depth;
+	row.nonBlocking = false;
+	row.elapsedSec = elapsedSec;
+	row.recvMessages = recv;
+	row.recvBytes = stats.recvBytes;
+	row.pctUs = pctUs;
+	row.extra = extra;
+	row.workNs = stats.workNs;
+	row.hist = merged.get();
+	row.intervals = move(intervals.samples);
+	appendResultRow(cfg, row);
+
+	if (cfg.carrier == "pipe") {
+		close(pipeFds[0]);
+		close(pipeFds[1]);
+	} else {
+		mq_close(mq);
+		if (cfg.unlinkAtEnd) mq_unlink(cfg.queueName.c_str());
+	}
+	return 0;
+}